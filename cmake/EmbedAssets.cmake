@@ -0,0 +1,39 @@
+# Writes OUTPUT: a C file with the files FILES (|-separated, relative to
+# ROOT) in it as the embedded_assets table of assets.c, sorted by name.
+#
+#   cmake -DROOT=res -DFILES="a.txt|b.tbf" -DOUTPUT=assets_embedded.c -P EmbedAssets.cmake
+
+string(REPLACE "|" ";" names "${FILES}")
+list(SORT names)
+
+set(code "/* generated from ${ROOT} by EmbedAssets.cmake: don't edit */\n\n")
+set(code "${code}#include \"assets.h\"\n\n")
+set(table "")
+set(i 0)
+set(sixteen_bytes "")
+foreach(j RANGE 15)
+	set(sixteen_bytes "${sixteen_bytes}0x[0-9a-f][0-9a-f],")
+endforeach()
+foreach(name IN LISTS names)
+	file(READ "${ROOT}/${name}" hex HEX)
+	string(LENGTH "${hex}" hex_len)
+	math(EXPR len "${hex_len} / 2")
+	string(LENGTH "${name}" name_len)
+	string(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1," bytes "${hex}")
+	string(REGEX REPLACE "(${sixteen_bytes})" "\\1\n    " bytes "${bytes}")
+	# (one more byte, so that no array is empty)
+	set(code "${code}static const unsigned char asset_${i}[] = {\n    ${bytes}0\n};\n\n")
+	set(table "${table}    { \"${name}\", ${name_len}, asset_${i}, ${len} },\n")
+	math(EXPR i "${i} + 1")
+endforeach()
+
+set(code "${code}const struct asset embedded_assets[] = {\n${table}    { NULL, 0, NULL, 0 }\n};\n")
+set(code "${code}const size_t n_embedded_assets = ${i};\n")
+
+# only touch it when it changes, so nothing rebuilds for nothing
+if(EXISTS "${OUTPUT}")
+	file(READ "${OUTPUT}" old_code)
+endif()
+if(NOT old_code STREQUAL code)
+	file(WRITE "${OUTPUT}" "${code}")
+endif()
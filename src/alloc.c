@@ -0,0 +1,155 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <SDL.h>
+
+#include "alloc.h"
+
+static const char *const subsystem_names[N_ALLOC_SUBSYSTEMS] = {
+    "world", "trampoline", "ball", "attachment", "render", "stream", "other"
+};
+
+const char *alloc_subsystem_name(enum alloc_subsystem sub)
+{
+    return subsystem_names[sub];
+}
+
+#ifdef ENABLE_ALLOC_STATS
+
+/* in front of every block, so that free() knows what to take off */
+union alloc_header {
+    struct {
+        size_t size;
+        enum alloc_subsystem sub;
+    } h;
+    /* keep the block after it suitably aligned */
+    long double ld;
+    void *p;
+    long long ll;
+};
+
+static struct alloc_stats stats[N_ALLOC_SUBSYSTEMS];
+/* both threads allocate; a spinlock is plenty for something this rare */
+static SDL_SpinLock stats_lock = 0;
+
+static void count_alloc(enum alloc_subsystem sub, size_t old_size, size_t size)
+{
+    SDL_AtomicLock(&stats_lock);
+    stats[sub].calls++;
+    stats[sub].bytes += size;
+    stats[sub].live_bytes += (int64_t) size - (int64_t) old_size;
+    SDL_AtomicUnlock(&stats_lock);
+}
+
+static void *finish_alloc(union alloc_header *h, enum alloc_subsystem sub, size_t size)
+{
+    if (h == NULL) return NULL;
+    h->h.size = size;
+    h->h.sub = sub;
+    count_alloc(sub, 0, size);
+    return h + 1;
+}
+
+void *tb_malloc(enum alloc_subsystem sub, size_t size)
+{
+    return finish_alloc(malloc(sizeof(union alloc_header) + size), sub, size);
+}
+
+void *tb_calloc(enum alloc_subsystem sub, size_t n, size_t size)
+{
+    if (size != 0 && n > (SIZE_MAX - sizeof(union alloc_header)) / size) return NULL;
+    return finish_alloc(calloc(1, sizeof(union alloc_header) + n * size), sub, n * size);
+}
+
+void *tb_realloc(enum alloc_subsystem sub, void *p, size_t size)
+{
+    if (p == NULL) return tb_malloc(sub, size);
+
+    union alloc_header *h = ((union alloc_header *) p) - 1;
+    size_t old_size = h->h.size;
+    sub = h->h.sub;
+
+    h = realloc(h, sizeof(union alloc_header) + size);
+    if (h == NULL) return NULL;
+    h->h.size = size;
+    count_alloc(sub, old_size, size);
+    return h + 1;
+}
+
+void tb_free(void *p)
+{
+    if (p == NULL) return;
+
+    union alloc_header *h = ((union alloc_header *) p) - 1;
+    SDL_AtomicLock(&stats_lock);
+    stats[h->h.sub].frees++;
+    stats[h->h.sub].live_bytes -= h->h.size;
+    SDL_AtomicUnlock(&stats_lock);
+    free(h);
+}
+
+void get_alloc_stats(struct alloc_stats out[N_ALLOC_SUBSYSTEMS])
+{
+    SDL_AtomicLock(&stats_lock);
+    memcpy(out, stats, sizeof(stats));
+    SDL_AtomicUnlock(&stats_lock);
+}
+
+#else /* ! ENABLE_ALLOC_STATS */
+
+void *tb_malloc(enum alloc_subsystem sub, size_t size)
+{
+    (void) sub;
+    return malloc(size);
+}
+
+void *tb_calloc(enum alloc_subsystem sub, size_t n, size_t size)
+{
+    (void) sub;
+    return calloc(n, size);
+}
+
+void *tb_realloc(enum alloc_subsystem sub, void *p, size_t size)
+{
+    (void) sub;
+    return realloc(p, size);
+}
+
+void tb_free(void *p)
+{
+    free(p);
+}
+
+void get_alloc_stats(struct alloc_stats out[N_ALLOC_SUBSYSTEMS])
+{
+    memset(out, 0, N_ALLOC_SUBSYSTEMS * sizeof(struct alloc_stats));
+}
+
+#endif /* ENABLE_ALLOC_STATS */
+
+uint64_t alloc_calls_total()
+{
+    struct alloc_stats s[N_ALLOC_SUBSYSTEMS];
+    uint64_t total = 0;
+
+    get_alloc_stats(s);
+    for (int i=0; i<N_ALLOC_SUBSYSTEMS; ++i) total += s[i].calls;
+    return total;
+}
+
+void print_alloc_stats(FILE *fp)
+{
+#ifdef ENABLE_ALLOC_STATS
+    struct alloc_stats s[N_ALLOC_SUBSYSTEMS];
+
+    get_alloc_stats(s);
+    fprintf(fp, "%-12s %10s %10s %14s %12s\n", "heap", "allocs", "frees", "bytes", "live bytes");
+    for (int i=0; i<N_ALLOC_SUBSYSTEMS; ++i) {
+        fprintf(fp, "%-12s %10llu %10llu %14llu %12lld\n", subsystem_names[i],
+                (unsigned long long) s[i].calls, (unsigned long long) s[i].frees,
+                (unsigned long long) s[i].bytes, (long long) s[i].live_bytes);
+    }
+#else
+    fprintf(fp, "allocation accounting is not compiled in\n");
+#endif
+}
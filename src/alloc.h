@@ -0,0 +1,65 @@
+/*
+    alloc.h
+
+    heap allocation accounting, per subsystem
+
+    Everything the game allocates goes through the TB_ macros, which count
+    calls and bytes for the subsystem named. Once a world is loaded and has
+    been drawn, stepping and drawing it shouldn't allocate at all: the
+    counters are there to prove it.
+    Configure with -DENABLE_ALLOC_STATS=OFF and the macros are plain
+    malloc() and friends.
+*/
+
+#ifndef TRAMPBALL_ALLOC_H
+#define TRAMPBALL_ALLOC_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "config.h"
+
+enum alloc_subsystem {
+    ALLOC_WORLD,        /* worlds and their lists */
+    ALLOC_TRAMPOLINE,
+    ALLOC_BALL,         /* and walls */
+    ALLOC_ATTACHMENT,
+    ALLOC_RENDER,
+    ALLOC_STREAM,       /* streaming and reloading */
+    ALLOC_OTHER,
+    N_ALLOC_SUBSYSTEMS
+};
+
+struct alloc_stats {
+    uint64_t calls;     /* malloc, calloc and realloc */
+    uint64_t frees;
+    uint64_t bytes;     /* total ever allocated */
+    int64_t live_bytes;
+};
+
+#ifdef ENABLE_ALLOC_STATS
+#  define TB_MALLOC(sub, size) tb_malloc(sub, size)
+#  define TB_CALLOC(sub, n, size) tb_calloc(sub, n, size)
+#  define TB_REALLOC(sub, p, size) tb_realloc(sub, p, size)
+#  define TB_FREE(p) tb_free(p)
+#else
+#  define TB_MALLOC(sub, size) malloc(size)
+#  define TB_CALLOC(sub, n, size) calloc(n, size)
+#  define TB_REALLOC(sub, p, size) realloc(p, size)
+#  define TB_FREE(p) free(p)
+#endif
+
+void *tb_malloc(enum alloc_subsystem sub, size_t size);
+void *tb_calloc(enum alloc_subsystem sub, size_t n, size_t size);
+/* the block keeps the subsystem it was first allocated for */
+void *tb_realloc(enum alloc_subsystem sub, void *p, size_t size);
+void tb_free(void *p);
+
+const char *alloc_subsystem_name(enum alloc_subsystem sub);
+/* all zeros if accounting is compiled out */
+void get_alloc_stats(struct alloc_stats stats[N_ALLOC_SUBSYSTEMS]);
+uint64_t alloc_calls_total();
+void print_alloc_stats(FILE *fp);
+
+#endif /* TRAMPBALL_ALLOC_H */
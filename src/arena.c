@@ -0,0 +1,72 @@
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "arena.h"
+
+/* whatever needs the strictest alignment */
+union arena_align {
+    long double ld;
+    void *p;
+    long long ll;
+};
+
+#define ARENA_ALIGN sizeof(union arena_align)
+
+struct arena_chunk {
+    struct arena_chunk *next;
+    size_t size;
+    size_t used;
+    union arena_align data[];
+};
+
+void init_arena(arena *const a, enum alloc_subsystem sub)
+{
+    a->chunks = NULL;
+    a->next_chunk_size = ARENA_FIRST_CHUNK;
+    a->sub = sub;
+}
+
+void *arena_alloc(arena *const a, size_t size)
+{
+    struct arena_chunk *c = a->chunks;
+
+    size = (size + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN;
+
+    if (c == NULL || c->size - c->used < size) {
+        size_t chunk_size = a->next_chunk_size;
+        while (chunk_size < size) chunk_size *= 2;
+
+        c = TB_MALLOC(a->sub, sizeof(struct arena_chunk) + chunk_size);
+        if (c == NULL) return NULL;
+        c->size = chunk_size;
+        c->used = 0;
+        c->next = a->chunks;
+        a->chunks = c;
+        a->next_chunk_size = 2 * chunk_size;
+    }
+
+    void *p = ((char *) c->data) + c->used;
+    c->used += size;
+    return p;
+}
+
+bool arena_owns(const arena *const a, const void *const p)
+{
+    uintptr_t addr = (uintptr_t) p;
+
+    for (const struct arena_chunk *c = a->chunks; c; c = c->next) {
+        if (addr >= (uintptr_t) c->data && addr < (uintptr_t) c->data + c->size)
+            return true;
+    }
+    return false;
+}
+
+void free_arena(arena *const a)
+{
+    while (a->chunks != NULL) {
+        struct arena_chunk *c = a->chunks;
+        a->chunks = c->next;
+        TB_FREE(c);
+    }
+    a->next_chunk_size = ARENA_FIRST_CHUNK;
+}
@@ -0,0 +1,34 @@
+/*
+    arena.h
+
+    bump allocation for objects that are all freed together
+*/
+
+#ifndef TRAMPBALL_ARENA_H
+#define TRAMPBALL_ARENA_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "alloc.h"
+
+/* chunks start at this size and double as the arena grows */
+#define ARENA_FIRST_CHUNK 4096
+
+struct arena_chunk;
+
+typedef struct _arena {
+    struct arena_chunk *chunks; /* newest first */
+    size_t next_chunk_size;
+    enum alloc_subsystem sub;
+} arena;
+
+void init_arena(arena *const a, enum alloc_subsystem sub);
+/* suitably aligned for anything; NULL if out of memory */
+void *arena_alloc(arena *const a, size_t size);
+bool arena_owns(const arena *const a, const void *const p);
+/* frees everything that was ever allocated from it. The arena is left
+   empty, and can be used again. */
+void free_arena(arena *const a);
+
+#endif /* TRAMPBALL_ARENA_H */
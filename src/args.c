@@ -0,0 +1,85 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "args.h"
+
+int parse_args(int argc, char *argv[],
+               char *flags[],
+               char *opts_arg[],
+               int max_args,
+               bool out_flags[],
+               char *out_opt_values[],
+               char *out_args[])
+{
+    int i;
+
+    int n_args_so_far = 0;
+    int hungry_opt = -1;
+
+    for (int i=0; flags[i] != NULL; ++i) {
+        out_flags[i] = false;
+    }
+
+    for (int i=0; opts_arg[i] != NULL; ++i) {
+        out_opt_values[i] = NULL;
+    }
+
+    while (argc-- > 1) {
+        ++argv;
+
+        if (argv[0][0] == '-' && hungry_opt == -1) {
+            // this is an option/a flag
+            int candidates = 0;
+            int cand_flag = -1;
+            int cand_opt = -1;
+            int len = strlen(argv[0]);
+
+            for (i=0; flags[i] != NULL; ++i) {
+                if (strncmp(flags[i], &argv[0][1], len-1) == 0) {
+                    cand_flag = i;
+                    ++candidates;
+                }
+            }
+
+            for (i=0; opts_arg[i] != NULL; ++i) {
+                if (strncmp(opts_arg[i], &argv[0][1], len-1) == 0) {
+                    cand_opt = i;
+                    ++candidates;
+                    // an exact match beats any abbreviation
+                    if (opts_arg[i][len-1] == '\0') {
+                        cand_flag = -1;
+                        candidates = 1;
+                        break;
+                    }
+                }
+            }
+
+            if (candidates == 0) {
+                fprintf(stderr, "Unrecognized option: %s\n", &argv[0][1]);
+                return -1;
+            } else if (candidates == 1) {
+                if (cand_flag >= 0) {
+                    out_flags[cand_flag] = true;
+                } else  {
+                    hungry_opt = cand_opt;
+                }
+            } else {
+                fprintf(stderr, "Ambigious option: %s\n", &argv[0][1]);
+                return -1;
+            }
+        } else if (hungry_opt >= 0) {
+            // option value
+            out_opt_values[hungry_opt] = argv[0];
+            hungry_opt = -1;
+        } else {
+            // regular argument
+            if (n_args_so_far >= max_args) {
+                fprintf(stderr, "Too many arguments!\n");
+                return -1;
+            }
+            out_args[n_args_so_far++] = argv[0];
+        }
+    }
+
+    return n_args_so_far;
+}
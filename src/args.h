@@ -0,0 +1,23 @@
+/*
+    args.h
+
+    minimal command line parsing shared by the front end and the tools
+*/
+
+#ifndef TRAMPBALL_ARGS_H
+#define TRAMPBALL_ARGS_H
+
+#include <stdbool.h>
+
+/* flags and opts_arg are NULL-terminated lists of names; options may be
+   abbreviated as long as that is unambiguous. Returns the number of
+   positional arguments, or -1 on error. */
+int parse_args(int argc, char *argv[],
+               char *flags[],
+               char *opts_arg[],
+               int max_args,
+               bool out_flags[],
+               char *out_opt_values[],
+               char *out_args[]);
+
+#endif /* TRAMPBALL_ARGS_H */
@@ -0,0 +1,146 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "assets.h"
+#include "args.h"
+#include "tool.h"
+#include "config.h"
+
+#define MAX_PACK_ASSETS 256
+
+struct pack_item {
+    const char *name;
+    char *data;
+    size_t len;
+};
+
+static int compare_items(const void *a, const void *b)
+{
+    return strcmp(((const struct pack_item *) a)->name, ((const struct pack_item *) b)->name);
+}
+
+static void put_le32(FILE *const fp, uint32_t x)
+{
+    unsigned char b[4] = { x, x >> 8, x >> 16, x >> 24 };
+    fwrite(b, 1, 4, fp);
+}
+
+static size_t align_up(size_t n)
+{
+    return (n + ASSET_PACK_ALIGN - 1) / ASSET_PACK_ALIGN * ASSET_PACK_ALIGN;
+}
+
+static bool write_pack(FILE *const fp, const struct pack_item *const items, int n)
+{
+    static const char zeros[ASSET_PACK_ALIGN];
+    size_t names = 16 + 16 * (size_t) n, offset;
+    int i;
+
+    offset = names;
+    for (i=0; i<n; ++i) offset += strlen(items[i].name);
+
+    fwrite(ASSET_PACK_MAGIC, 1, ASSET_PACK_MAGIC_LEN, fp);
+    put_le32(fp, ASSET_PACK_VERSION);
+    put_le32(fp, n);
+    for (i=0; i<n; ++i) {
+        offset = align_up(offset);
+        put_le32(fp, names);
+        put_le32(fp, strlen(items[i].name));
+        put_le32(fp, offset);
+        put_le32(fp, items[i].len);
+        names += strlen(items[i].name);
+        offset += items[i].len;
+    }
+
+    offset = names;
+    for (i=0; i<n; ++i)
+        fputs(items[i].name, fp);
+    for (i=0; i<n; ++i) {
+        fwrite(zeros, 1, align_up(offset) - offset, fp);
+        fwrite(items[i].data, 1, items[i].len, fp);
+        offset = align_up(offset) + items[i].len;
+    }
+    return !ferror(fp) && offset <= UINT32_MAX;
+}
+
+static int list_pack(const char *const filename)
+{
+    const struct asset *assets;
+    size_t n, total = 0;
+
+    if (!open_asset_pack(filename)) return 1;
+    assets = asset_pack_contents(&n);
+    for (size_t i=0; i<n; ++i) {
+        printf("%10zu  %.*s\n", assets[i].len, (int) assets[i].name_len, assets[i].name);
+        total += assets[i].len;
+    }
+    printf("%10zu  in %zu assets\n", total, n);
+    close_asset_pack();
+    return 0;
+}
+
+int pack_main(int argc, char *argv[])
+{
+    char *flags[] = { "help", "list", NULL };
+    char *opts[] = { "dir", "output", NULL };
+    bool flag_states[2];
+    char *opt_vals[2];
+    char *names[MAX_PACK_ASSETS];
+    struct pack_item items[MAX_PACK_ASSETS];
+    const char *dir = ASSET_ROOT;
+    char path[4096];
+    int i, status = 0;
+
+    int n_args = parse_args(argc, argv, flags, opts, MAX_PACK_ASSETS,
+                            flag_states, opt_vals, names);
+
+    if (n_args < 1 || flag_states[0] || (flag_states[1] && n_args != 1) ||
+        (!flag_states[1] && opt_vals[1] == NULL)) {
+        fprintf(stderr, "trampball-tool pack - put the assets in one file\n"
+                        "\n"
+                        "  Usage: trampball-tool pack -output assets.tbp [-dir %s]\n"
+                        "         perfect16.tbf worldfile.txt ...\n"
+                        "     or: trampball-tool pack -list assets.tbp\n"
+                        "\n"
+                        "  The assets are named as they are given, relative to -dir; run\n"
+                        "  trampball with -assets assets.tbp, and anything it would have\n"
+                        "  opened as %sNAME comes out of the pack instead.\n",
+                        ASSET_ROOT, ASSET_ROOT);
+        return flag_states[0] ? 0 : 2;
+    }
+
+    if (flag_states[1]) return list_pack(names[0]);
+
+    if (opt_vals[0] != NULL) dir = opt_vals[0];
+    for (i=0; i<n_args; ++i) {
+        snprintf(path, sizeof(path), "%s%s%s", dir,
+                 (*dir && dir[strlen(dir)-1] != '/') ? "/" : "", names[i]);
+        items[i].name = names[i];
+        if ((items[i].data = read_whole_file(path, &items[i].len)) == NULL) {
+            while (i-- > 0) free(items[i].data);
+            return 1;
+        }
+    }
+    qsort(items, n_args, sizeof(struct pack_item), compare_items);
+    for (i=1; i<n_args; ++i) {
+        if (strcmp(items[i-1].name, items[i].name) == 0) {
+            fprintf(stderr, "%s is in there twice\n", items[i].name);
+            status = 2;
+        }
+    }
+
+    FILE *fp = NULL;
+    if (status == 0 && (fp = fopen(opt_vals[1], "wb")) == NULL) {
+        perror(opt_vals[1]);
+        status = 1;
+    }
+    if (fp != NULL && (!write_pack(fp, items, n_args) | (fclose(fp) != 0))) {
+        perror(opt_vals[1]);
+        status = 1;
+    }
+
+    for (i=0; i<n_args; ++i) free(items[i].data);
+    return status;
+}
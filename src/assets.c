@@ -0,0 +1,213 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <SDL.h>
+
+#include "assets.h"
+#include "alloc.h"
+#include "config.h"
+
+#ifndef _WIN32
+#  include <fcntl.h>
+#  include <unistd.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#endif
+
+#define PACK_HEADER_BYTES 16
+#define PACK_ENTRY_BYTES 16
+
+#ifdef EMBED_ASSETS
+/* written by cmake/EmbedAssets.cmake, sorted by name */
+extern const struct asset embedded_assets[];
+extern const size_t n_embedded_assets;
+#endif
+
+static struct {
+    const unsigned char *data;
+    size_t size;
+    bool mapped;
+    struct asset *index;
+    size_t n_assets;
+} pack;
+
+static uint32_t get_le32(const unsigned char *const p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static int compare_asset_name(const char *const name, size_t len, const struct asset *const a)
+{
+    int c = memcmp(name, a->name, len < a->name_len ? len : a->name_len);
+    if (c != 0) return c;
+    return (len > a->name_len) - (len < a->name_len);
+}
+
+static const struct asset *search_assets(const struct asset *const assets, size_t n,
+                                         const char *const name, size_t len)
+{
+    size_t lo = 0, hi = n;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int c = compare_asset_name(name, len, &assets[mid]);
+        if (c == 0) return &assets[mid];
+        if (c < 0) hi = mid;
+        else lo = mid + 1;
+    }
+    return NULL;
+}
+
+/* the whole file, mapped if possible */
+static bool load_pack_file(const char *const filename)
+{
+#ifndef _WIN32
+    struct stat st;
+    int fd = open(filename, O_RDONLY);
+
+    if (fd >= 0 && fstat(fd, &st) == 0 && st.st_size > 0) {
+        void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (p != MAP_FAILED) {
+            pack.data = p;
+            pack.size = st.st_size;
+            pack.mapped = true;
+            return true;
+        }
+    } else if (fd >= 0) {
+        close(fd);
+    }
+#endif
+
+    SDL_RWops *fp = SDL_RWFromFile(filename, "rb");
+    Sint64 size;
+    if (fp == NULL || (size = SDL_RWsize(fp)) <= 0) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "[Opening asset pack] %s: %s\n",
+                     filename, fp == NULL ? SDL_GetError() : "empty");
+        if (fp != NULL) SDL_RWclose(fp);
+        return false;
+    }
+
+    unsigned char *buf = TB_MALLOC(ALLOC_OTHER, size);
+    size_t got = 0, n;
+    while (buf != NULL && got < (size_t) size &&
+           (n = SDL_RWread(fp, buf + got, 1, size - got)) > 0)
+        got += n;
+    SDL_RWclose(fp);
+    if (got < (size_t) size) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "[Reading asset pack] %s\n", filename);
+        TB_FREE(buf);
+        return false;
+    }
+
+    pack.data = buf;
+    pack.size = size;
+    pack.mapped = false;
+    return true;
+}
+
+static bool index_pack(const char *const filename)
+{
+    const unsigned char *d = pack.data;
+
+    if (pack.size < PACK_HEADER_BYTES ||
+        memcmp(d, ASSET_PACK_MAGIC, ASSET_PACK_MAGIC_LEN) != 0 ||
+        get_le32(d + 8) != ASSET_PACK_VERSION) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "%s: not a version %d asset pack\n",
+                     filename, ASSET_PACK_VERSION);
+        return false;
+    }
+
+    size_t n = get_le32(d + 12);
+    if (n > (pack.size - PACK_HEADER_BYTES) / PACK_ENTRY_BYTES ||
+        (pack.index = TB_MALLOC(ALLOC_OTHER, (n + 1) * sizeof(struct asset))) == NULL) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "%s: truncated asset pack\n", filename);
+        return false;
+    }
+
+    for (size_t i=0; i<n; ++i) {
+        const unsigned char *e = d + PACK_HEADER_BYTES + i * PACK_ENTRY_BYTES;
+        uint32_t name_off = get_le32(e), name_len = get_le32(e + 4);
+        uint32_t data_off = get_le32(e + 8), data_len = get_le32(e + 12);
+
+        if (name_off > pack.size || name_len > pack.size - name_off ||
+            data_off > pack.size || data_len > pack.size - data_off ||
+            (i > 0 && compare_asset_name((const char *) d + name_off, name_len,
+                                         &pack.index[i-1]) <= 0)) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "%s: bad asset pack entry %zu\n",
+                         filename, i);
+            TB_FREE(pack.index);
+            pack.index = NULL;
+            return false;
+        }
+        pack.index[i] = (struct asset) { (const char *) d + name_off, name_len,
+                                         d + data_off, data_len };
+    }
+    pack.n_assets = n;
+    return true;
+}
+
+bool open_asset_pack(const char *const filename)
+{
+    close_asset_pack();
+    if (!load_pack_file(filename)) return false;
+    if (!index_pack(filename)) {
+        close_asset_pack();
+        return false;
+    }
+    return true;
+}
+
+void close_asset_pack(void)
+{
+    if (pack.data != NULL) {
+#ifndef _WIN32
+        if (pack.mapped)
+            munmap((void *) pack.data, pack.size);
+        else
+#endif
+            TB_FREE((void *) pack.data);
+    }
+    TB_FREE(pack.index);
+    memset(&pack, 0, sizeof(pack));
+}
+
+const struct asset *asset_pack_contents(size_t *const n_assets)
+{
+    *n_assets = pack.n_assets;
+    return pack.index;
+}
+
+const struct asset *find_asset(const char *const name)
+{
+    const struct asset *a = NULL;
+    size_t len = strlen(name);
+
+#ifdef EMBED_ASSETS
+    a = search_assets(embedded_assets, n_embedded_assets, name, len);
+#endif
+    if (a == NULL && pack.index != NULL)
+        a = search_assets(pack.index, pack.n_assets, name, len);
+    return a;
+}
+
+static const struct asset *find_asset_path(const char *const path)
+{
+    size_t root_len = strlen(ASSET_ROOT);
+
+    if (strncmp(path, ASSET_ROOT, root_len) != 0) return NULL;
+    return find_asset(path + root_len);
+}
+
+bool is_packed_asset(const char *const path)
+{
+    return find_asset_path(path) != NULL;
+}
+
+SDL_RWops *open_asset(const char *const path)
+{
+    const struct asset *a = find_asset_path(path);
+
+    if (a != NULL) return SDL_RWFromConstMem(a->data, a->len);
+    return SDL_RWFromFile(path, "rb");
+}
@@ -0,0 +1,54 @@
+/*
+    assets.h
+
+    the files under ASSET_ROOT, from wherever they can be had with the
+    fewest file opens: built into the binary (EMBED_ASSETS), an asset
+    pack mapped into memory, or else the loose files
+
+    An asset pack is one file with all the assets in it, little-endian:
+
+        "TBPACK\0\0"                                        8 bytes
+        version n_assets                                    uint32
+        n_assets x, sorted by name:
+            name_offset name_length data_offset data_length uint32
+        the names, then the data: each asset 16-byte aligned
+
+    Offsets are from the start of the file. trampball-tool pack writes
+    them.
+*/
+
+#ifndef TRAMPBALL_ASSETS_H
+#define TRAMPBALL_ASSETS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <SDL.h>
+
+#define ASSET_PACK_MAGIC "TBPACK\0"  /* and the terminator: 8 bytes */
+#define ASSET_PACK_MAGIC_LEN 8
+#define ASSET_PACK_VERSION 1
+#define ASSET_PACK_ALIGN 16
+
+struct asset {
+    const char *name;   /* relative to ASSET_ROOT; not terminated in a pack */
+    size_t name_len;
+    const unsigned char *data;
+    size_t len;
+};
+
+/* Use this pack for whatever isn't built in, until close_asset_pack().
+   It's mapped, not read, where there's mmap(). */
+bool open_asset_pack(const char *const filename);
+void close_asset_pack(void);
+/* the open pack's assets, in name order */
+const struct asset *asset_pack_contents(size_t *const n_assets);
+
+/* name is relative to ASSET_ROOT: the built-in copy, or the pack's */
+const struct asset *find_asset(const char *const name);
+/* whether a path (ASSET_ROOT and all) would come from find_asset() */
+bool is_packed_asset(const char *const path);
+/* in place of SDL_RWFromFile(path, "rb"): assets from memory, without
+   copying them, and anything else from the file */
+SDL_RWops *open_asset(const char *const path);
+
+#endif /* TRAMPBALL_ASSETS_H */
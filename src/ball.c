@@ -1,45 +1,69 @@
 #include "ball.h"
+#include "alloc.h"
 
 ball *new_ball()
 {
-    ball *b = malloc(sizeof(ball));
-    b->position.x = b->position.y = b->speed.x = b->speed.y = 0.0f;
+    return init_ball(TB_MALLOC(ALLOC_BALL, sizeof(ball)));
+}
+
+ball *init_ball(ball *const b)
+{
+    b->position.x = b->position.y = b->speed.x = b->speed.y = REAL(0.0);
     b->mass = BALL_MASS;
     b->radius = BALL_RADIUS;
     b->remote_controlled = false;
     b->applied_force = (vector2f) {0, 0};
     b->bounce = BALL_BOUNCE;
+    b->id = 0;
     b->lock = SDL_CreateMutex();
     return b;
 }
 
 void free_ball(ball *b)
+{
+    cleanup_ball(b);
+    TB_FREE(b);
+}
+
+void cleanup_ball(ball *const b)
 {
     SDL_DestroyMutex(b->lock);
-    free(b);
 }
 
-void iterate_ball(ball *const b, const float dt_ms)
+void iterate_ball(ball *const b, const real dt_ms, const vector2f gravity)
 {
     if (b->remote_controlled) return;
     /*
      x(t) = v(0) * t + a * t^2 / 2
     */
 
-    float dt = dt_ms * 1e-3f;
-    float a_x = b->applied_force.x / b->mass + gravity_accel.x;
-    float a_y = b->applied_force.y / b->mass + gravity_accel.y;
+    real dt = dt_ms * REAL(1e-3);
+    real a_x = b->applied_force.x / b->mass + gravity.x;
+    real a_y = b->applied_force.y / b->mass + gravity.y;
 
     SDL_LockMutex(b->lock);
 
-    b->position.x += b->speed.x * dt + a_x * dt * dt * 0.5f;
-    b->position.y += b->speed.y * dt + a_y * dt * dt * 0.5f;
+    b->position.x += b->speed.x * dt + a_x * dt * dt * REAL(0.5);
+    b->position.y += b->speed.y * dt + a_y * dt * dt * REAL(0.5);
     b->speed.x += a_x * dt;
     b->speed.y += a_y * dt;
 
     SDL_UnlockMutex(b->lock);
 }
 
+/* how far iterate_ball() would move the ball */
+vector2f ball_displacement(const ball *const b, const real dt_ms, const vector2f gravity)
+{
+    if (b->remote_controlled) return (vector2f) {0, 0};
+
+    real dt = dt_ms * REAL(1e-3);
+    real a_x = b->applied_force.x / b->mass + gravity.x;
+    real a_y = b->applied_force.y / b->mass + gravity.y;
+
+    return (vector2f) { b->speed.x * dt + a_x * dt * dt * REAL(0.5),
+                        b->speed.y * dt + a_y * dt * dt * REAL(0.5) };
+}
+
 void force_advance_ball(ball *const b, const vector2f new_speed, const vector2f pos_delta)
 {
     SDL_LockMutex(b->lock);
@@ -11,26 +11,31 @@
 #include <stdbool.h>
 #include <SDL.h>
 
-#define BALL_MASS 100.0f
-#define BALL_RADIUS 50.0f
-#define BALL_BOUNCE 0.2f
+#define BALL_MASS REAL(100.0)
+#define BALL_RADIUS REAL(50.0)
+#define BALL_BOUNCE REAL(0.2)
 
 typedef struct _ball {
     vector2f position;
-    float radius;
-    float mass;
+    real radius;
+    real mass;
     bool remote_controlled;
     vector2f speed;
     vector2f applied_force;
-    float bounce;
+    real bounce;
     SDL_mutex *lock;
-    // float spin;
+    unsigned id;    /* unique within its world, from add_ball() */
+    // real spin;
 } ball;
 
 ball *new_ball();
 void free_ball(ball *b);
+/* the same, for balls in memory of one's own */
+ball *init_ball(ball *const b);
+void cleanup_ball(ball *const b);
 
-void iterate_ball(ball *const b, const float dt_ms);
+void iterate_ball(ball *const b, const real dt_ms, const vector2f gravity);
+vector2f ball_displacement(const ball *const b, const real dt_ms, const vector2f gravity);
 void force_advance_ball(ball *const b, const vector2f new_speed, const vector2f pos_delta);
 
 #endif /* TRAMPBALL_BALL_H */
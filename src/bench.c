@@ -0,0 +1,223 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <SDL.h>
+
+#include "game.h"
+#include "workers.h"
+#include "libtrampball.h"
+#include "args.h"
+#include "tool.h"
+#include "config.h"
+
+#define MAX_BENCH_WORLDS 16
+#define FREE_PREFIX "free:"
+
+static const char *default_worlds[] = {
+    ASSET("worldfile.txt"),
+    ASSET("multiball-test.world"),
+    ASSET("corner-test.world"),
+    ASSET("refine-test.world"),
+    FREE_PREFIX "21",
+    FREE_PREFIX "161",
+    NULL
+};
+
+struct bench_result {
+    double e0;
+    double e_final;
+    double final_drift;   /* (E_end - E_0) / |E_0| */
+    double max_drift;     /* largest |E - E_0| / |E_0| seen */
+    double wall_s;        /* time spent in game_iteration() only */
+    long substeps;
+    double ball_ke;       /* the balls' kinetic energy at the end: 0 once they're at rest */
+};
+
+/*
+ * free:ANCHORS is a single trampoline with that many anchors, plucked and
+ * let go: no balls, no gravity and no damping, so nothing but the
+ * integrator (and its rounding) can change the energy.
+ */
+static struct world *load_bench_world(const char *const name)
+{
+    static const char free_world[] = "STAGE 600 0 0 1000\n"
+                                     "GRAVITY 0 0\n"
+                                     "TRAMPOLINE %d 100 300 800 0\n"
+                                     "    K 100000\n";
+    char buf[128];
+    struct trampoline_list *tl;
+
+    if (strncmp(name, FREE_PREFIX, strlen(FREE_PREFIX)) != 0)
+        return trampball_world_from_file(name);
+
+    int anchors = strtol(name + strlen(FREE_PREFIX), NULL, 10);
+    if (anchors < 3) {
+        fprintf(stderr, "%s: a free trampoline needs at least 3 anchors\n", name);
+        return NULL;
+    }
+    int len = snprintf(buf, sizeof(buf), free_world, anchors);
+    struct world *w = trampball_world_from_buffer(buf, len);
+    if (w == NULL) return NULL;
+
+    // the first and third modes, so that it isn't a single sine wave
+    for (tl = w->trampolines; tl; tl = tl->next) {
+        trampoline *t = tl->t;
+        for (int i=0; i<t->n_anchors; ++i) {
+            double phase = M_PI * i / (t->n_anchors - 1);
+            t->offsets[i].y = 60 * sin(phase) + 20 * sin(3 * phase);
+        }
+        t->damping = 0;
+    }
+    return w;
+}
+
+static bool run_bench(const char *const world_fn, int n_steps, float interval_ms,
+                      bool no_damping, int solver_iterations, struct worker_pool *const pool,
+                      struct bench_result *const res)
+{
+    struct trampoline_list *tl;
+    struct ball_list *bl;
+    Uint64 ticks = 0, t0;
+
+    struct world *w = load_bench_world(world_fn);
+    if (w == NULL) return false;
+    w->workers = pool;
+    w->solver_iterations = solver_iterations;
+
+    if (no_damping)
+        for (tl = w->trampolines; tl; tl = tl->next)
+            tl->t->damping = 0;
+
+    res->e0 = world_energy(w);
+    res->max_drift = 0;
+    res->substeps = 0;
+
+    for (int step=0; step<n_steps; ++step) {
+        t0 = SDL_GetPerformanceCounter();
+        res->substeps += game_iteration(w, interval_ms);
+        ticks += SDL_GetPerformanceCounter() - t0;
+
+        double drift = fabs(world_energy(w) - res->e0) / fabs(res->e0);
+        if (drift > res->max_drift) res->max_drift = drift;
+    }
+
+    res->e_final = world_energy(w);
+    res->final_drift = (res->e_final - res->e0) / fabs(res->e0);
+    res->wall_s = ((double) ticks) / SDL_GetPerformanceFrequency();
+    res->ball_ke = 0;
+    for (bl = w->balls; bl; bl = bl->next) {
+        const ball *b = bl->b;
+        res->ball_ke += 0.5 * b->mass * (b->speed.x * b->speed.x + b->speed.y * b->speed.y);
+    }
+
+    trampball_world_destroy(w);
+    return true;
+}
+
+int bench_main(int argc, char *argv[])
+{
+    char *flags[] = { "help", "nodamping", NULL };
+    char *opts[] = { "steps", "interval", "output", "threads", "solveriters", NULL };
+    bool flag_states[2];
+    char *opt_vals[5];
+    char *world_fns[MAX_BENCH_WORLDS + 1];
+    const char *const *worlds = (const char *const *) world_fns;
+    int n_steps = 6000;
+    float interval_ms = 10;
+    int n_threads = 1;
+    int solver_iterations = BALL_SOLVER_ITERATIONS;
+    struct worker_pool *pool = NULL;
+    char *endp;
+
+    int n_worlds = parse_args(argc, argv, flags, opts, MAX_BENCH_WORLDS,
+                              flag_states, opt_vals, world_fns);
+
+    if (n_worlds < 0 || flag_states[0]) {
+        fprintf(stderr, "trampball-tool bench - energy drift and throughput of this build's physics\n"
+                        "\n"
+                        "  Usage: trampball-tool bench [-steps 6000] [-interval 10] [-nodamping]\n"
+                        "         [-output results.csv] [-threads 1] [-solveriters %d]\n"
+                        "         [world.txt ...]\n"
+                        "\n"
+                        "  Without any world files, the bundled worlds and free:21 and\n"
+                        "  free:161 are used: free:ANCHORS is a plucked trampoline with no\n"
+                        "  balls, gravity or damping, whose drift is the integrator's alone.\n"
+                        "  -nodamping switches off trampoline damping in the others, so that\n"
+                        "  less of the energy change is physical. -threads splits trampolines\n"
+                        "  with a lot of anchors between that many threads. -solveriters sets\n"
+                        "  how hard the ball-ball contacts are worked on each step: ball_ke\n"
+                        "  shows how well a pile has settled by the end.\n"
+                        "\n"
+                        "  The precision column tells builds apart: configure one build tree\n"
+                        "  each with -DPHYSICS_PRECISION=float, double and mixed, and\n"
+                        "  concatenate their output to compare them.\n",
+                BALL_SOLVER_ITERATIONS);
+        return flag_states[0] ? 0 : 2;
+    }
+
+    if (n_worlds == 0) worlds = default_worlds;
+    else world_fns[n_worlds] = NULL;
+
+    if (opt_vals[0] != NULL) {
+        n_steps = strtol(opt_vals[0], &endp, 10);
+        if (*opt_vals[0] == '\0' || *endp != '\0' || n_steps < 1) {
+            fprintf(stderr, "not a positive integer: %s\n", opt_vals[0]);
+            return 2;
+        }
+    }
+    if (opt_vals[1] != NULL) {
+        interval_ms = strtod(opt_vals[1], &endp);
+        if (*opt_vals[1] == '\0' || *endp != '\0' || interval_ms <= 0) {
+            fprintf(stderr, "not a positive number: %s\n", opt_vals[1]);
+            return 2;
+        }
+    }
+
+    FILE *out = stdout;
+    if (opt_vals[3] != NULL) {
+        n_threads = strtol(opt_vals[3], &endp, 10);
+        if (*opt_vals[3] == '\0' || *endp != '\0' || n_threads < 1) {
+            fprintf(stderr, "not a positive integer: %s\n", opt_vals[3]);
+            return 2;
+        }
+    }
+    if (opt_vals[4] != NULL) {
+        solver_iterations = strtol(opt_vals[4], &endp, 10);
+        if (*opt_vals[4] == '\0' || *endp != '\0' || solver_iterations < 1) {
+            fprintf(stderr, "not a positive integer: %s\n", opt_vals[4]);
+            return 2;
+        }
+    }
+    if (opt_vals[2] != NULL && (out = fopen(opt_vals[2], "w")) == NULL) {
+        perror(opt_vals[2]);
+        return 1;
+    }
+    if (n_threads > 1 && (pool = new_worker_pool(n_threads)) == NULL) {
+        fprintf(stderr, "could not start %d threads: %s\n", n_threads, SDL_GetError());
+        if (out != stdout) fclose(out);
+        return 1;
+    }
+
+    fprintf(out, "world,precision,threads,solver_iters,steps,interval_ms,damping,wall_s,"
+                 "steps_per_s,substeps_per_s,e0,e_final,final_drift,max_drift,ball_ke\n");
+
+    int status = 0;
+    for (int i=0; worlds[i] != NULL; ++i) {
+        struct bench_result res;
+        if (!run_bench(worlds[i], n_steps, interval_ms, flag_states[1], solver_iterations,
+                       pool, &res)) {
+            status = 1;
+            continue;
+        }
+        fprintf(out, "%s,%s,%d,%d,%d,%g,%s,%.3f,%.0f,%.0f,%.9g,%.9g,%.6e,%.6e,%.3e\n",
+                worlds[i], PHYSICS_PRECISION_NAME, n_threads, solver_iterations, n_steps,
+                interval_ms, flag_states[1] ? "off" : "on", res.wall_s,
+                n_steps / res.wall_s, res.substeps / res.wall_s,
+                res.e0, res.e_final, res.final_drift, res.max_drift, res.ball_ke);
+    }
+
+    if (pool != NULL) free_worker_pool(pool);
+    if (out != stdout) fclose(out);
+    return status;
+}
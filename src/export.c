@@ -0,0 +1,341 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <SDL.h>
+
+#include "export.h"
+#include "alloc.h"
+
+enum export_format { EXPORT_PNG, EXPORT_Y4M };
+
+struct frame_exporter {
+    enum export_format format;
+    char *filename;
+    FILE *fp;                   /* the Y4M stream */
+    int width, height;
+    uint32_t *frames[EXPORT_QUEUE_FRAMES]; /* ARGB8888, packed */
+    uint8_t *scratch;           /* a PNG row, or the Y4M planes */
+
+    /* protected by lock */
+    unsigned submitted, written;
+    bool quit, failed;
+
+    SDL_mutex *lock;
+    SDL_cond *changed;          /* either count moved, or quit */
+    SDL_Thread *thread;
+};
+
+/* exactly one integer conversion, and no others */
+static bool valid_frame_pattern(const char *p)
+{
+    int conversions = 0;
+
+    for (; *p; ++p) {
+        if (*p != '%') continue;
+        if (*++p == '%') continue;
+        while (isdigit((unsigned char) *p)) ++p;
+        if (*p != 'd') return false;
+        ++conversions;
+    }
+    return conversions == 1;
+}
+
+static bool write_y4m_frame(struct frame_exporter *const e, const uint32_t *const argb)
+{
+    const int n = e->width * e->height;
+    uint8_t *y = e->scratch, *u = y + n, *v = u + n;
+
+    // BT.601, studio range, no chroma subsampling (C444)
+    for (int i=0; i<n; ++i) {
+        int r = (argb[i] >> 16) & 0xff, g = (argb[i] >> 8) & 0xff, b = argb[i] & 0xff;
+        y[i] = ((66*r + 129*g + 25*b + 128) >> 8) + 16;
+        u[i] = (-38*r - 74*g + 112*b + 128 + (128 << 8)) >> 8;
+        v[i] = (112*r - 94*g - 18*b + 128 + (128 << 8)) >> 8;
+    }
+
+    return fputs("FRAME\n", e->fp) >= 0 &&
+           fwrite(e->scratch, 3, n, e->fp) == (size_t) n &&
+           fflush(e->fp) == 0;
+}
+
+static uint32_t crc_table[256];
+
+static void init_crc_table()
+{
+    for (uint32_t n=0; n<256; ++n) {
+        uint32_t c = n;
+        for (int k=0; k<8; ++k)
+            c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+        crc_table[n] = c;
+    }
+}
+
+static uint32_t update_crc(uint32_t crc, const uint8_t *const buf, size_t len)
+{
+    for (size_t i=0; i<len; ++i)
+        crc = crc_table[(crc ^ buf[i]) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+static void put_be32(uint8_t *const p, uint32_t x)
+{
+    p[0] = x >> 24;
+    p[1] = x >> 16;
+    p[2] = x >> 8;
+    p[3] = x;
+}
+
+/* a PNG chunk, written as it comes: the CRC covers the type and the data */
+struct png_chunk {
+    FILE *fp;
+    uint32_t crc;
+    bool ok;
+};
+
+static void begin_png_chunk(struct png_chunk *const c, FILE *const fp,
+                            const char type[4], uint32_t length)
+{
+    uint8_t len[4];
+
+    put_be32(len, length);
+    c->fp = fp;
+    c->crc = update_crc(0xffffffffu, (const uint8_t *) type, 4);
+    c->ok = fwrite(len, 1, 4, fp) == 4 && fwrite(type, 1, 4, fp) == 4;
+}
+
+static void png_chunk_data(struct png_chunk *const c, const uint8_t *const buf, size_t len)
+{
+    c->crc = update_crc(c->crc, buf, len);
+    c->ok = c->ok && fwrite(buf, 1, len, c->fp) == len;
+}
+
+static bool end_png_chunk(struct png_chunk *const c)
+{
+    uint8_t crc[4];
+
+    put_be32(crc, c->crc ^ 0xffffffffu);
+    return c->ok && fwrite(crc, 1, 4, c->fp) == 4;
+}
+
+/*
+ * RGB, 8 bits per channel, no filtering, and a zlib stream made of
+ * stored deflate blocks of at most 65535 bytes each.
+ */
+static bool write_png_frame(struct frame_exporter *const e, const uint32_t *const argb,
+                            unsigned frame_no)
+{
+    static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    static const uint8_t zlib_header[2] = { 0x78, 0x01 };
+    const size_t row_len = 1 + 3 * (size_t) e->width;
+    const size_t raw_len = row_len * e->height;
+    const size_t n_blocks = raw_len / 65535 + 1;
+    uint32_t adler_a = 1, adler_b = 0;
+    size_t block_left = 0, raw_left = raw_len;
+    struct png_chunk c;
+    uint8_t buf[13];
+    char filename[4096];
+    bool ok;
+    FILE *fp;
+
+    snprintf(filename, sizeof(filename), e->filename, frame_no);
+    if ((fp = fopen(filename, "wb")) == NULL) {
+        perror(filename);
+        return false;
+    }
+
+    ok = fwrite(signature, 1, 8, fp) == 8;
+
+    put_be32(buf, e->width);
+    put_be32(buf + 4, e->height);
+    buf[8] = 8;     /* bit depth */
+    buf[9] = 2;     /* truecolour */
+    buf[10] = buf[11] = buf[12] = 0;
+    begin_png_chunk(&c, fp, "IHDR", 13);
+    png_chunk_data(&c, buf, 13);
+    ok = end_png_chunk(&c) && ok;
+
+    begin_png_chunk(&c, fp, "IDAT", 2 + 5 * n_blocks + raw_len + 4);
+    png_chunk_data(&c, zlib_header, 2);
+    for (int y=0; y<e->height; ++y) {
+        const uint32_t *src = argb + (size_t) e->width * y;
+        uint8_t *row = e->scratch;
+
+        row[0] = 0; /* filter: none */
+        for (int x=0; x<e->width; ++x) {
+            row[1 + 3*x] = src[x] >> 16;
+            row[2 + 3*x] = src[x] >> 8;
+            row[3 + 3*x] = src[x];
+        }
+        for (size_t i=0; i<row_len; ++i) {
+            adler_a = (adler_a + row[i]) % 65521;
+            adler_b = (adler_b + adler_a) % 65521;
+        }
+
+        // the rows don't line up with the blocks
+        for (size_t done = 0; done < row_len; ) {
+            if (block_left == 0) {
+                block_left = raw_left < 65535 ? raw_left : 65535;
+                buf[0] = (raw_left == block_left) ? 1 : 0; /* last block? */
+                buf[1] = block_left & 0xff;
+                buf[2] = block_left >> 8;
+                buf[3] = ~buf[1];
+                buf[4] = ~buf[2];
+                png_chunk_data(&c, buf, 5);
+            }
+            size_t len = row_len - done < block_left ? row_len - done : block_left;
+            png_chunk_data(&c, row + done, len);
+            done += len;
+            block_left -= len;
+            raw_left -= len;
+        }
+    }
+    put_be32(buf, (adler_b << 16) | adler_a);
+    png_chunk_data(&c, buf, 4);
+    ok = end_png_chunk(&c) && ok;
+
+    begin_png_chunk(&c, fp, "IEND", 0);
+    ok = end_png_chunk(&c) && ok;
+
+    if (fclose(fp) != 0) ok = false;
+    if (!ok) perror(filename);
+    return ok;
+}
+
+static int encoder_main(void *data)
+{
+    struct frame_exporter *e = data;
+
+    SDL_LockMutex(e->lock);
+    for (;;) {
+        while (e->written == e->submitted && !e->quit)
+            SDL_CondWait(e->changed, e->lock);
+        if (e->written == e->submitted) break;
+        unsigned frame_no = e->written;
+        SDL_UnlockMutex(e->lock);
+
+        const uint32_t *frame = e->frames[frame_no % EXPORT_QUEUE_FRAMES];
+        bool ok = (e->format == EXPORT_Y4M) ? write_y4m_frame(e, frame) :
+                                              write_png_frame(e, frame, frame_no);
+
+        SDL_LockMutex(e->lock);
+        e->written++;
+        if (!ok) e->failed = true;
+        SDL_CondBroadcast(e->changed);
+    }
+    SDL_UnlockMutex(e->lock);
+
+    return 0;
+}
+
+struct frame_exporter *new_frame_exporter(const char *const filename, int width, int height,
+                                          int fps_num, int fps_den)
+{
+    struct frame_exporter *e = TB_CALLOC(ALLOC_RENDER, 1, sizeof(struct frame_exporter));
+    size_t len = strlen(filename);
+    const size_t frame_size = sizeof(uint32_t) * width * height;
+
+    e->width = width;
+    e->height = height;
+    e->filename = TB_MALLOC(ALLOC_RENDER, len + 1);
+    strcpy(e->filename, filename);
+
+    if (strcmp(filename, "-") == 0 || (len > 4 && strcmp(filename + len - 4, ".y4m") == 0)) {
+        e->format = EXPORT_Y4M;
+        e->fp = (strcmp(filename, "-") == 0) ? stdout : fopen(filename, "wb");
+        if (e->fp == NULL) {
+            perror(filename);
+            goto fail;
+        }
+        if (fprintf(e->fp, "YUV4MPEG2 W%d H%d F%d:%d Ip A1:1 C444\n",
+                    width, height, fps_num, fps_den) < 0) {
+            perror(filename);
+            goto fail;
+        }
+        e->scratch = TB_MALLOC(ALLOC_RENDER, 3 * (size_t) width * height);
+    } else {
+        if (!valid_frame_pattern(filename)) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "%s: PNG file names need one %%d for the frame number\n", filename);
+            goto fail;
+        }
+        e->format = EXPORT_PNG;
+        init_crc_table();
+        e->scratch = TB_MALLOC(ALLOC_RENDER, 1 + 3 * (size_t) width);
+    }
+
+    for (int i=0; i<EXPORT_QUEUE_FRAMES; ++i) {
+        if ((e->frames[i] = TB_MALLOC(ALLOC_RENDER, frame_size)) == NULL)
+            goto fail;
+    }
+    if (e->scratch == NULL ||
+        (e->lock = SDL_CreateMutex()) == NULL ||
+        (e->changed = SDL_CreateCond()) == NULL ||
+        (e->thread = SDL_CreateThread(encoder_main, "encoder", e)) == NULL) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Can't start the encoder - %s\n",
+                     SDL_GetError());
+        goto fail;
+    }
+
+    return e;
+
+fail:
+    free_frame_exporter(e);
+    return NULL;
+}
+
+bool export_frame(struct frame_exporter *const e, const SDL_Surface *const surface)
+{
+    const size_t row_size = sizeof(uint32_t) * e->width;
+    bool failed;
+
+    SDL_LockMutex(e->lock);
+    while (e->submitted - e->written == EXPORT_QUEUE_FRAMES && !e->failed)
+        SDL_CondWait(e->changed, e->lock);
+    failed = e->failed;
+    SDL_UnlockMutex(e->lock);
+    if (failed) return false;
+
+    // the encoder won't touch this one until it's been submitted
+    uint32_t *frame = e->frames[e->submitted % EXPORT_QUEUE_FRAMES];
+    for (int y=0; y<e->height; ++y)
+        memcpy(frame + (size_t) y * e->width,
+               (const uint8_t *) surface->pixels + y * surface->pitch, row_size);
+
+    SDL_LockMutex(e->lock);
+    e->submitted++;
+    SDL_CondBroadcast(e->changed);
+    SDL_UnlockMutex(e->lock);
+
+    return true;
+}
+
+bool free_frame_exporter(struct frame_exporter *const e)
+{
+    bool ok = true;
+
+    if (e->thread != NULL) {
+        SDL_LockMutex(e->lock);
+        e->quit = true;
+        SDL_CondBroadcast(e->changed);
+        SDL_UnlockMutex(e->lock);
+        SDL_WaitThread(e->thread, NULL);
+        ok = !e->failed;
+    } else {
+        ok = false;
+    }
+
+    if (e->fp != NULL && e->fp != stdout && fclose(e->fp) != 0) {
+        perror(e->filename);
+        ok = false;
+    }
+    if (e->changed != NULL) SDL_DestroyCond(e->changed);
+    if (e->lock != NULL) SDL_DestroyMutex(e->lock);
+    for (int i=0; i<EXPORT_QUEUE_FRAMES; ++i)
+        TB_FREE(e->frames[i]);
+    TB_FREE(e->scratch);
+    TB_FREE(e->filename);
+    TB_FREE(e);
+    return ok;
+}
@@ -0,0 +1,38 @@
+/*
+    export.h
+
+    writing rendered frames out as a PNG sequence or a Y4M stream
+
+    Frames are copied into a small ring of buffers, then encoded and
+    written on a thread of their own: the renderer only ever waits if the
+    encoder has fallen a whole ring behind. PNGs are stored without
+    compression, which is quick; recompress them afterwards if size
+    matters.
+*/
+
+#ifndef TRAMPBALL_EXPORT_H
+#define TRAMPBALL_EXPORT_H
+
+#include <stdbool.h>
+#include <SDL.h>
+
+/* frames that may be waiting for the encoder */
+#define EXPORT_QUEUE_FRAMES 8
+
+struct frame_exporter;
+
+/*
+ * A filename ending in .y4m, or "-" for stdout, gets a Y4M stream at
+ * fps_num/fps_den frames per second. Anything else is a printf() pattern
+ * with one integer conversion for numbering PNG files, e.g. out/%05d.png.
+ * NULL on failure.
+ */
+struct frame_exporter *new_frame_exporter(const char *const filename, int width, int height,
+                                          int fps_num, int fps_den);
+/* surface: width x height, SDL_PIXELFORMAT_ARGB8888. false once writing
+   has failed */
+bool export_frame(struct frame_exporter *const e, const SDL_Surface *const surface);
+/* writes out whatever is queued first; false if any frame failed */
+bool free_frame_exporter(struct frame_exporter *const e);
+
+#endif /* TRAMPBALL_EXPORT_H */
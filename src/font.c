@@ -3,6 +3,8 @@
 #include <stdlib.h>
 #include <SDL.h>
 #include "font.h"
+#include "alloc.h"
+#include "assets.h"
 
 bool init_trampballfont(SDL_Renderer *const ren, const char *const filename,
                         Uint32 fg_rgba, Uint32 bg_rgba,
@@ -17,7 +19,7 @@ bool init_trampballfont(SDL_Renderer *const ren, const char *const filename,
     SDL_Surface *surface;
     SDL_Color colours[256];
 
-    if ((fp = SDL_RWFromFile(filename, "rb")) == NULL) {
+    if ((fp = open_asset(filename)) == NULL) {
         SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "[Opening font] %s\n", SDL_GetError());
         return false;
     }
@@ -60,21 +62,21 @@ bool init_trampballfont(SDL_Renderer *const ren, const char *const filename,
         total_bytes = total_pixels;
     }
 
-    buf2 = malloc(total_bytes);
+    buf2 = TB_MALLOC(ALLOC_RENDER, total_bytes);
 
     bytes = 0;
     do {
         int just_read = SDL_RWread(fp, &buf2[bytes], 1, total_bytes-bytes);
         if (just_read <= 0) {
             SDL_RWclose(fp);
-            free(buf2);
+            TB_FREE(buf2);
             return false;
         }
         bytes += just_read;
     } while (bytes < total_bytes);
 
     if (bitmode) {
-        buf3 = malloc(total_pixels);
+        buf3 = TB_MALLOC(ALLOC_RENDER, total_pixels);
         for (i=0; i<total_pixels; ++i) {
             buf3[i] = ((buf2[i/8] >> (7 - i%8)) & 1) ? 0xff : 0x00;
         }
@@ -90,8 +92,8 @@ bool init_trampballfont(SDL_Renderer *const ren, const char *const filename,
                                        0, 0, 0, 0);
 
     if (surface == NULL) {
-        free(buf2);
-        if (bitmode) free(buf3);
+        TB_FREE(buf2);
+        if (bitmode) TB_FREE(buf3);
         return false;
     }
 
@@ -109,8 +111,8 @@ bool init_trampballfont(SDL_Renderer *const ren, const char *const filename,
 
     SDL_FreeSurface(surface);
 
-    free(buf2);
-    if (bitmode) free(buf3);
+    TB_FREE(buf2);
+    if (bitmode) TB_FREE(buf3);
 
     if (font->texture != NULL) {
         return true;
@@ -12,106 +12,611 @@
 #include <SDL.h>
 
 #include "game.h"
+#include "alloc.h"
+#include "trace.h"
+#include "worldbin.h"
+#include "assets.h"
 
-vector2f gravity_accel = {0, -700};
+struct world *new_world()
+{
+    struct world *world = TB_MALLOC(ALLOC_WORLD, sizeof(struct world));
+    world->game_stage = (stage) { /* top */ 300,
+                                  /* left */ 0,
+                                  /* bottom */ 0,
+                                  /* right */ 300 };
+    world->gravity = DEFAULT_GRAVITY;
+    world->trampolines = NULL;
+    world->balls = NULL;
+    world->walls = NULL;
+    world->n_balls = 0;
+    world->last_ball_id = 0;
+    world->solver_iterations = BALL_SOLVER_ITERATIONS;
+    world->spare_trampoline_nodes = NULL;
+    world->spare_ball_nodes = NULL;
+    world->spare_wall_nodes = NULL;
+    world->workers = NULL;
+    memset(&world->contacts, 0, sizeof(world->contacts));
+    init_arena(&world->arenas[WORLD_ARENA_TRAMPOLINES], ALLOC_TRAMPOLINE);
+    init_arena(&world->arenas[WORLD_ARENA_BALLS], ALLOC_BALL);
+    init_arena(&world->arenas[WORLD_ARENA_WALLS], ALLOC_BALL);
+    init_arena(&world->arenas[WORLD_ARENA_LIST_NODES], ALLOC_WORLD);
+    return world;
+}
 
-struct world game_world = { { /* top */ 300,
-                              /* left */ 0,
-                              /* bottom */ 0,
-                              /* right */ 300 },
-                            NULL,
-                            NULL,
-                            NULL };
+void free_world(struct world *const world)
+{
+    cleanup_world(world);
+    TB_FREE(world);
+}
 
+/*
+ * Whatever came from the arenas goes with them; only the mutexes (and the
+ * attachments that didn't fit in a trampoline's block) need freeing one
+ * by one.
+ */
+void cleanup_world(struct world *const world)
+{
+    struct trampoline_list *tl;
+    struct ball_list *bl;
+    struct wall_list *wl;
+
+    for (tl = world->trampolines; tl; tl = tl->next)
+        discard_trampoline(world, tl->t);
+    for (bl = world->balls; bl; bl = bl->next)
+        discard_ball(world, bl->b);
+    for (wl = world->walls; wl; wl = wl->next)
+        discard_wall(world, wl->w);
+
+    world->trampolines = NULL;
+    world->balls = NULL;
+    world->walls = NULL;
+    world->n_balls = 0;
+    world->spare_trampoline_nodes = NULL;
+    world->spare_ball_nodes = NULL;
+    world->spare_wall_nodes = NULL;
+    for (int i=0; i<N_WORLD_ARENAS; ++i)
+        free_arena(&world->arenas[i]);
+
+    TB_FREE(world->contacts.balls);
+    TB_FREE(world->contacts.batches);
+    TB_FREE(world->contacts.n_contacts);
+    TB_FREE(world->contacts.contacts);
+    TB_FREE(world->contacts.impulses);
+    memset(&world->contacts, 0, sizeof(world->contacts));
+}
 
-void cleanup_world()
+void discard_trampoline(struct world *const world, trampoline *const t)
 {
-    while (game_world.trampolines != NULL) {
-        struct trampoline_list *t_item = game_world.trampolines;
-        free_trampoline(t_item->t);
-        game_world.trampolines = t_item->next;
-        free(t_item);
-    }
+    if (arena_owns(&world->arenas[WORLD_ARENA_TRAMPOLINES], t))
+        cleanup_trampoline(t);
+    else
+        free_trampoline(t);
+}
 
-    while (game_world.balls != NULL) {
-        struct ball_list *b_item = game_world.balls;
-        free_ball(b_item->b);
-        game_world.balls = b_item->next;
-        free(b_item);
-    }
+void discard_ball(struct world *const world, ball *const b)
+{
+    if (arena_owns(&world->arenas[WORLD_ARENA_BALLS], b))
+        cleanup_ball(b);
+    else
+        free_ball(b);
+}
 
-    while (game_world.walls != NULL) {
-        struct wall_list *w_item = game_world.walls;
-        free_wall(w_item->w);
-        game_world.walls = w_item->next;
-        free(w_item);
-    }
+void discard_wall(struct world *const world, wall *const w)
+{
+    if (!arena_owns(&world->arenas[WORLD_ARENA_WALLS], w))
+        free_wall(w);
 }
 
-inline struct trampoline_list *add_trampoline(trampoline *const t)
+inline struct trampoline_list *add_trampoline(struct world *const world, trampoline *const t)
 {
-    struct trampoline_list *tl = malloc(sizeof(struct trampoline_list));
+    struct trampoline_list *tl = world->spare_trampoline_nodes;
+    if (tl != NULL)
+        world->spare_trampoline_nodes = tl->next;
+    else
+        tl = arena_alloc(&world->arenas[WORLD_ARENA_LIST_NODES], sizeof(struct trampoline_list));
     tl->t = t;
-    tl->next = game_world.trampolines;
-    game_world.trampolines = tl;
+    tl->next = world->trampolines;
+    world->trampolines = tl;
     return tl;
 }
 
-inline struct ball_list *add_ball(ball *const b)
+/* so that stepping the world never has to */
+static void reserve_ball_contacts(struct ball_contacts *const c, int n_balls)
+{
+    int size = c->size ? c->size : 16;
+
+    if (n_balls <= c->size) return;
+    while (size < n_balls) size *= 2;
+
+    c->balls = TB_REALLOC(ALLOC_WORLD, c->balls, size * sizeof(ball *));
+    c->batches = TB_REALLOC(ALLOC_WORLD, c->batches, size * sizeof(uint64_t));
+    c->n_contacts = TB_REALLOC(ALLOC_WORLD, c->n_contacts, size * sizeof(int));
+    c->contacts = TB_REALLOC(ALLOC_WORLD, c->contacts,
+                             size * BALL_CONTACTS_PER_BALL * sizeof(struct ball_contact));
+    c->size = size;
+
+    // room for BALL_CONTACTS_PER_BALL / 2 contacts a ball with the table
+    // at most half full: more than the three or so a ball has in a packed
+    // pile of equal balls. any more just start from nothing
+    c->impulse_slots = BALL_CONTACTS_PER_BALL * size;
+    c->impulses = TB_REALLOC(ALLOC_WORLD, c->impulses,
+                             c->impulse_slots * sizeof(struct ball_contact_impulse));
+    memset(c->impulses, 0, c->impulse_slots * sizeof(struct ball_contact_impulse));
+}
+
+inline struct ball_list *add_ball(struct world *const world, ball *const b)
 {
-    struct ball_list *bl = malloc(sizeof(struct ball_list));
+    struct ball_list *bl = world->spare_ball_nodes;
+    if (bl != NULL)
+        world->spare_ball_nodes = bl->next;
+    else
+        bl = arena_alloc(&world->arenas[WORLD_ARENA_LIST_NODES], sizeof(struct ball_list));
     bl->b = b;
-    bl->next = game_world.balls;
-    game_world.balls = bl;
+    bl->next = world->balls;
+    world->balls = bl;
+    b->id = ++world->last_ball_id;
+    reserve_ball_contacts(&world->contacts, ++world->n_balls);
     return bl;
 }
 
-inline struct wall_list *add_wall(wall *const w)
+inline struct wall_list *add_wall(struct world *const world, wall *const w)
 {
-    struct wall_list *wl = malloc(sizeof(struct wall_list));
+    struct wall_list *wl = world->spare_wall_nodes;
+    if (wl != NULL)
+        world->spare_wall_nodes = wl->next;
+    else
+        wl = arena_alloc(&world->arenas[WORLD_ARENA_LIST_NODES], sizeof(struct wall_list));
     wl->w = w;
-    wl->next = game_world.walls;
-    game_world.walls = wl;
+    wl->next = world->walls;
+    world->walls = wl;
     return wl;
 }
 
-void game_iteration(const float dt_ms)
+/*
+ * These only take the object out of the world; they don't free it. Any
+ * attachments between the object and the rest of the world go, too.
+ */
+bool remove_trampoline(struct world *const world, trampoline *const t)
+{
+    for (struct trampoline_list **p = &world->trampolines; *p; p = &(*p)->next) {
+        if ((*p)->t == t) {
+            struct trampoline_list *item = *p;
+            *p = item->next;
+            item->next = world->spare_trampoline_nodes;
+            world->spare_trampoline_nodes = item;
+
+            while (t->attached_objects) {
+                t->attached_objects->b->remote_controlled = false;
+                remove_attachment(t, t->attached_objects);
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+bool remove_ball(struct world *const world, ball *const b)
+{
+    for (struct ball_list **p = &world->balls; *p; p = &(*p)->next) {
+        if ((*p)->b == b) {
+            struct ball_list *item = *p;
+            *p = item->next;
+            item->next = world->spare_ball_nodes;
+            world->spare_ball_nodes = item;
+            world->n_balls--;
+
+            for (struct trampoline_list *tl = world->trampolines; tl; tl = tl->next)
+                detach_ball(tl->t, b);
+            b->remote_controlled = false;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool remove_wall(struct world *const world, const wall *const w)
+{
+    for (struct wall_list **p = &world->walls; *p; p = &(*p)->next) {
+        if ((*p)->w == w) {
+            struct wall_list *item = *p;
+            *p = item->next;
+            item->next = world->spare_wall_nodes;
+            world->spare_wall_nodes = item;
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Move a ball, stopping at any wall or stage edge it would hit on the way
+ * so it can't tunnel through them with large steps.
+ */
+static void advance_ball(struct world *const world, ball *const b, const real dt_ms)
 {
-    struct trampoline_list *tl;
-    struct ball_list *bl, *bl2;
     struct wall_list *wl;
+    real dt_left = dt_ms;
 
-    for (tl = game_world.trampolines; tl; tl = tl->next) {
-        for (bl = game_world.balls; bl; bl = bl->next)
-            collide_ball_trampoline(bl->b, tl->t);
+    for (int i=0; i<MAX_CCD_SUBSTEPS; ++i) {
+        vector2f d = ball_displacement(b, dt_left, world->gravity);
+
+        // moving less than one radius, the ball can't skip past a line
+        // without the discrete check noticing.
+        if (d.x*d.x + d.y*d.y <= b->radius*b->radius) break;
+
+        struct ball_impact impact = { 1, {0, 0}, 0 };
+        bool hit = sweep_ball_edges(b, &world->game_stage, d, &impact);
+        for (wl = world->walls; wl; wl = wl->next)
+            hit |= sweep_ball_wall(b, wl->w, d, &impact);
+        if (!hit) break;
+
+        iterate_ball(b, dt_left * impact.toi, world->gravity);
+        resolve_ball_impact(b, &impact);
+        dt_left -= dt_left * impact.toi;
+    }
+
+    iterate_ball(b, dt_left, world->gravity);
+}
+
+struct ball_phase_job {
+    struct world *world;
+    real dt_ms;
+    int n_balls;
+    int n_batches;
+    bool leftovers; /* pairs for worker 0 to resolve on its own */
+};
+
+enum contact_pass { CONTACT_PREPARE, CONTACT_SOLVE, CONTACT_SEPARATE, N_CONTACT_PASSES };
+
+static void sync_ball_workers(struct worker_pool *const pool)
+{
+    if (pool != NULL) worker_barrier(pool);
+}
+
+/*
+ * Ball i is paired with the n-1-i balls after it, so the first r rows
+ * have r*(2n-1-r)/2 pairs between them: this splits the rows so that each
+ * worker gets about the same number of pairs to look at.
+ */
+static int first_pair_row(int n, int worker, int n_workers)
+{
+    if (worker >= n_workers) return n;
+
+    double b = 2.0 * n - 1;
+    double pairs = (double) n * (n - 1) / 2 * worker / n_workers;
+    int r = (int) ((b - sqrt(b*b - 8*pairs)) / 2);
+    return r < 0 ? 0 : r > n ? n : r;
+}
+
+/*
+ * Greedy colouring of the contact graph, in ball order: each pair goes in
+ * the first batch neither of its balls is in yet. Returns the number of
+ * batches used, not counting the last.
+ */
+static int batch_ball_contacts(struct ball_contacts *const c, int n_balls,
+                               bool *const leftovers)
+{
+    int i, k, batch, n_batches = 0;
+
+    memset(c->batches, 0, n_balls * sizeof(uint64_t));
+    *leftovers = false;
+
+    for (i=0; i<n_balls; ++i) {
+        struct ball_contact *row = &c->contacts[i * BALL_CONTACTS_PER_BALL];
+        for (k=0; k<c->n_contacts[i]; ++k) {
+            uint64_t taken = c->batches[i] | c->batches[row[k].other];
+            for (batch=0; batch<BALL_CONTACT_BATCHES-1 && (taken >> batch) & 1; ++batch);
+            row[k].batch = batch;
+            if (batch == BALL_CONTACT_BATCHES-1) {
+                *leftovers = true;
+                continue;
+            }
+            c->batches[i] |= ((uint64_t) 1) << batch;
+            c->batches[row[k].other] |= ((uint64_t) 1) << batch;
+            if (batch >= n_batches) n_batches = batch + 1;
+        }
+        // there may be more that didn't fit
+        if (c->n_contacts[i] == BALL_CONTACTS_PER_BALL) *leftovers = true;
+    }
+
+    return n_batches;
+}
+
+static uint64_t contact_pair_key(const ball *const b1, const ball *const b2)
+{
+    return b1->id < b2->id ? (uint64_t) b1->id << 32 | b2->id
+                           : (uint64_t) b2->id << 32 | b1->id;
+}
+
+static unsigned contact_slot(uint64_t pair, int n_slots)
+{
+    return (pair * UINT64_C(0x9E3779B97F4A7C15)) >> 32 & (n_slots - 1);
+}
+
+static real last_contact_impulse(const struct ball_contacts *const c, uint64_t pair)
+{
+    for (unsigned s = contact_slot(pair, c->impulse_slots); c->impulses[s].pair != 0;
+         s = (s + 1) & (c->impulse_slots - 1)) {
+        if (c->impulses[s].pair == pair) return c->impulses[s].impulse;
+    }
+    return 0;
+}
 
-        iterate_trampoline(tl->t, dt_ms);
+/* what the next step starts from: only contacts that pushed are kept */
+static void keep_contact_impulses(struct ball_contacts *const c, int n_balls)
+{
+    int kept = 0;
+
+    memset(c->impulses, 0, c->impulse_slots * sizeof(struct ball_contact_impulse));
+    for (int i=0; i<n_balls; ++i) {
+        const struct ball_contact *row = &c->contacts[i * BALL_CONTACTS_PER_BALL];
+        for (int k=0; k<c->n_contacts[i] && kept < c->impulse_slots / 2; ++k) {
+            if (row[k].solver.impulse <= 0) continue;
+            uint64_t pair = contact_pair_key(c->balls[i], c->balls[row[k].other]);
+            unsigned s = contact_slot(pair, c->impulse_slots);
+            while (c->impulses[s].pair != 0) s = (s + 1) & (c->impulse_slots - 1);
+            c->impulses[s] = (struct ball_contact_impulse) { pair, row[k].solver.impulse };
+            ++kept;
+        }
     }
+}
 
-    for (bl = game_world.balls; bl; bl = bl->next) {
-        collide_ball_edges(bl->b, &game_world.game_stage);
+static void run_contact_pass(struct ball_contacts *const c, int lo, int hi, int batch,
+                             enum contact_pass pass)
+{
+    for (int i=lo; i<hi; ++i) {
+        struct ball_contact *row = &c->contacts[i * BALL_CONTACTS_PER_BALL];
+        for (int k=0; k<c->n_contacts[i]; ++k) {
+            if (row[k].batch != batch) continue;
+            ball *b1 = c->balls[i], *b2 = c->balls[row[k].other];
+            switch (pass) {
+            case CONTACT_PREPARE:
+                prepare_ball_contact(b1, b2, &row[k].solver);
+                break;
+            case CONTACT_SOLVE:
+                solve_ball_contact(b1, b2, &row[k].solver);
+                break;
+            default:
+                separate_balls(b1, b2);
+                break;
+            }
+        }
+    }
+}
+
+/*
+ * The balls' part of a step, in phases: each ball against the stage and
+ * the walls; then the ball-ball contacts, a batch of disjoint pairs at a
+ * time in each pass of the solver; then each ball moves. Any worker can
+ * take any ball within a phase, and the outcome is the same however many
+ * workers there are. With no pool, it's called directly, as the only
+ * worker.
+ */
+static void ball_phase_worker(struct worker_pool *const pool, int worker, int n_workers,
+                              void *arg)
+{
+    struct ball_phase_job *job = arg;
+    struct world *const world = job->world;
+    struct ball_contacts *const c = &world->contacts;
+    ball **const balls = c->balls;
+    const int n = job->n_balls;
+    struct wall_list *wl;
+    int i, j, batch, iter, lo, hi;
+    enum contact_pass pass;
+
+    TRACE_BEGIN("collide_ball_walls");
+    worker_range(n, worker, n_workers, &lo, &hi);
+    for (i=lo; i<hi; ++i) {
+        collide_ball_edges(balls[i], &world->game_stage);
+        for (wl = world->walls; wl; wl = wl->next)
+            collide_ball_wall(balls[i], wl->w);
+    }
+    TRACE_END();
+    sync_ball_workers(pool);
+
+    TRACE_BEGIN("find_ball_contacts");
+    for (i=first_pair_row(n, worker, n_workers); i<first_pair_row(n, worker+1, n_workers); ++i) {
+        struct ball_contact *row = &c->contacts[i * BALL_CONTACTS_PER_BALL];
+        c->n_contacts[i] = 0;
+        for (j=i+1; j<n && c->n_contacts[i] < BALL_CONTACTS_PER_BALL; ++j) {
+            if (balls_touching(balls[i], balls[j])) {
+                struct ball_contact *contact = &row[c->n_contacts[i]++];
+                contact->other = j;
+                contact->solver.impulse =
+                    last_contact_impulse(c, contact_pair_key(balls[i], balls[j]));
+            }
+        }
+    }
+    TRACE_END();
+    sync_ball_workers(pool);
 
-        for (wl = game_world.walls; wl; wl = wl->next)
-            collide_ball_wall(bl->b, wl->w);
+    if (worker == 0) {
+        TRACE_BEGIN("batch_ball_contacts");
+        job->n_batches = batch_ball_contacts(c, n, &job->leftovers);
+        TRACE_END();
+    }
+    sync_ball_workers(pool);
+
+    TRACE_BEGIN("collide_ball_ball");
+    // (with no batches, there's nothing to wait for each other over)
+    for (pass=CONTACT_PREPARE; job->n_batches > 0 && pass<N_CONTACT_PASSES; ++pass) {
+        for (iter=0; iter<(pass == CONTACT_SOLVE ? world->solver_iterations : 1); ++iter) {
+            for (batch=0; batch<job->n_batches; ++batch) {
+                run_contact_pass(c, lo, hi, batch, pass);
+                sync_ball_workers(pool);
+            }
+            if (pass == CONTACT_SOLVE) {
+                // only balls being pushed by others: a lone ball has to
+                // be left to bounce off the edge
+                for (i=lo; i<hi; ++i)
+                    if (c->batches[i] != 0)
+                        hold_ball_at_edges(balls[i], &world->game_stage);
+                sync_ball_workers(pool);
+            }
+        }
+    }
 
-        for (bl2 = bl->next; bl2; bl2 = bl2->next)
-            collide_ball_ball(bl->b, bl2->b);
+    if (worker == 0 && job->leftovers) {
+        for (pass=CONTACT_PREPARE; pass<N_CONTACT_PASSES; ++pass) {
+            for (iter=0; iter<(pass == CONTACT_SOLVE ? world->solver_iterations : 1); ++iter)
+                run_contact_pass(c, 0, n, BALL_CONTACT_BATCHES-1, pass);
+        }
+        // and the ones there wasn't room to keep
+        for (i=0; i<n; ++i) {
+            const struct ball_contact *row = &c->contacts[i * BALL_CONTACTS_PER_BALL];
+            if (c->n_contacts[i] == BALL_CONTACTS_PER_BALL) {
+                for (j=row[BALL_CONTACTS_PER_BALL-1].other+1; j<n; ++j)
+                    collide_ball_ball(balls[i], balls[j]);
+            }
+        }
+    }
+    TRACE_END();
+    sync_ball_workers(pool);
 
-        iterate_ball(bl->b, dt_ms);
+    if (worker == 0) {
+        TRACE_BEGIN("keep_contact_impulses");
+        keep_contact_impulses(c, n);
+        TRACE_END();
     }
+
+    TRACE_BEGIN("iterate_ball");
+    for (i=lo; i<hi; ++i)
+        advance_ball(world, balls[i], job->dt_ms);
+    TRACE_END();
 }
 
-bool init_game_sdlrw(SDL_RWops *fp);
+int game_iteration(struct world *const world, const real dt_ms)
+{
+    struct trampoline_list *tl;
+    struct ball_list *bl;
+    struct ball_phase_job job = { world, dt_ms, 0, 0, false };
+    int substeps = 0;
+
+    TRACE_BEGIN("trampolines");
+    for (tl = world->trampolines; tl; tl = tl->next) {
+        TRACE_BEGIN("collide_ball_trampoline");
+        for (bl = world->balls; bl; bl = bl->next)
+            collide_ball_trampoline(bl->b, tl->t);
+        TRACE_END();
+
+        TRACE_BEGIN("iterate_trampoline");
+        substeps += iterate_trampoline_parallel(tl->t, dt_ms, world->gravity, world->workers);
+        TRACE_END();
+    }
+    TRACE_END();
+
+    TRACE_BEGIN("balls");
+    for (bl = world->balls; bl; bl = bl->next)
+        world->contacts.balls[job.n_balls++] = bl->b;
+    if (world->workers != NULL && worker_pool_size(world->workers) > 1 &&
+        job.n_balls >= BALL_PARALLEL_MIN_BALLS)
+        run_on_workers(world->workers, ball_phase_worker, &job);
+    else
+        ball_phase_worker(NULL, 0, 1, &job);
+    TRACE_END();
+
+    return substeps;
+}
 
-bool init_game(const char *const world_file_name)
+/*
+ * Total mechanical energy, in mass * pixel^2 / sec^2.
+ *
+ * The trampoline is a chain of zero-length springs (see
+ * trampoline_advance()), so its elastic energy is k/2 * |segment|^2 summed
+ * over all segments, measured relative to the flat, unstretched state.
+ * On an adaptive trampoline, each anchor and segment has its own mass
+ * and k.
+ */
+double world_energy(const struct world *const world)
+{
+    struct trampoline_list *tl;
+    struct ball_list *bl;
+    const vector2f g = world->gravity;
+    double energy = 0;
+
+    for (bl = world->balls; bl; bl = bl->next) {
+        const ball *b = bl->b;
+        energy += 0.5 * b->mass * (b->speed.x * b->speed.x + b->speed.y * b->speed.y);
+        energy -= b->mass * (g.x * b->position.x + g.y * b->position.y);
+    }
+
+    for (tl = world->trampolines; tl; tl = tl->next) {
+        const trampoline *t = tl->t;
+        const struct trampoline_mesh *m = t->mesh;
+        double dx = ((double) t->width) / t->n_anchors;
+        double dm = t->density * dx;
+        int i;
+
+        if (m != NULL) {
+            for (i=0; i<t->n_anchors; ++i) {
+                const vector2f v = t->speed[i];
+                const vector2f x = t->offsets[i];
+                dm = t->density * m->length[i];
+                energy += 0.5 * dm * (v.x * v.x + v.y * v.y);
+                energy -= dm * (g.x * x.x + g.y * x.y);
+            }
+            for (i=0; i<t->n_anchors-1; ++i) {
+                double h = m->rest_x[i+1] - m->rest_x[i];
+                double sx = h + t->offsets[i+1].x - t->offsets[i].x;
+                double sy = t->offsets[i+1].y - t->offsets[i].y;
+                energy += 0.5 * t->k * m->stiffness[i] * (sx * sx + sy * sy - h * h);
+            }
+            continue;
+        }
+
+        for (i=0; i<t->n_anchors; ++i) {
+            const vector2f v = t->speed[i];
+            const vector2f x = t->offsets[i];
+            energy += 0.5 * dm * (v.x * v.x + v.y * v.y);
+            energy -= dm * (g.x * x.x + g.y * x.y);
+        }
+        for (i=0; i<t->n_anchors-1; ++i) {
+            double sx = dx + t->offsets[i+1].x - t->offsets[i].x;
+            double sy = t->offsets[i+1].y - t->offsets[i].y;
+            energy += 0.5 * t->k * (sx * sx + sy * sy - dx * dx);
+        }
+    }
+
+    return energy;
+}
+
+/*
+ * Total linear momentum of the balls and trampoline anchors. Gravity, the
+ * walls and the stage all push, so it isn't conserved - but it is a cheap
+ * and sensitive fingerprint of the state.
+ */
+void world_momentum(const struct world *const world, double *const px, double *const py)
+{
+    struct trampoline_list *tl;
+    struct ball_list *bl;
+
+    *px = *py = 0;
+
+    for (bl = world->balls; bl; bl = bl->next) {
+        *px += bl->b->mass * bl->b->speed.x;
+        *py += bl->b->mass * bl->b->speed.y;
+    }
+
+    for (tl = world->trampolines; tl; tl = tl->next) {
+        const trampoline *t = tl->t;
+        double dm = t->density * ((double) t->width) / t->n_anchors;
+        for (int i=0; i<t->n_anchors; ++i) {
+            if (t->mesh != NULL) dm = t->density * t->mesh->length[i];
+            *px += dm * t->speed[i].x;
+            *py += dm * t->speed[i].y;
+        }
+    }
+}
+
+bool init_game(struct world *const world, const char *const world_file_name)
 {
     SDL_RWops *fp;
-    if ((fp = SDL_RWFromFile(world_file_name, "rb")) == NULL) {
+    if ((fp = open_asset(world_file_name)) == NULL) {
         SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "[Opening world file] %s\n", SDL_GetError());
         return false;
     }
 
-    bool status = init_game_sdlrw(fp);
+    bool status = init_game_sdlrw(world, fp);
     SDL_RWclose(fp);
     return status;
 }
@@ -119,6 +624,7 @@ bool init_game(const char *const world_file_name)
 #define max_line_len 200
 
 struct parser_state {
+    struct world *world;
     trampoline *t;
     ball *b;
 };
@@ -126,7 +632,7 @@ struct parser_state {
 static bool handle_worldfile_line(const char *lineptr, size_t len,
                                   struct parser_state *const state);
 
-bool init_game_sdlrw(SDL_RWops *fp)
+bool init_game_sdlrw(struct world *const world, SDL_RWops *fp)
 {
     int new_bytes;
     size_t len_buffered;
@@ -136,7 +642,13 @@ bool init_game_sdlrw(SDL_RWops *fp)
     char *buffer_end = &linebuffer[max_line_len];
     char *newline_ptr;
     bool eof = false;
-    struct parser_state state = { NULL, NULL };
+    struct parser_state state = { world, NULL, NULL };
+
+    // a binary world, or the start of a text one
+    new_bytes = SDL_RWread(fp, linebuffer, 1, WORLD_BINARY_MAGIC_LEN);
+    if (new_bytes == WORLD_BINARY_MAGIC_LEN && is_binary_world(linebuffer))
+        return load_binary_world(world, fp);
+    if (new_bytes > 0) data_endptr += new_bytes;
 
     while (!eof) {
         new_bytes = SDL_RWread(fp, data_endptr, 1, (buffer_end-data_endptr));
@@ -146,7 +658,7 @@ bool init_game_sdlrw(SDL_RWops *fp)
         } else if (new_bytes == 0) {
             eof = true;
             // handle files not ending in newlines.
-            if (*(data_endptr-1) != '\n')
+            if (data_endptr == linebuffer || *(data_endptr-1) != '\n')
                 *(data_endptr++) = '\n';
         }
 
@@ -165,14 +677,14 @@ bool init_game_sdlrw(SDL_RWops *fp)
     return true;
 }
 
-static inline const char *get_floats_from_line(const char *lineptr, size_t len, int count, float *dest)
+static inline const char *get_floats_from_line(const char *lineptr, size_t len, int count, real *dest)
 {
     char *sep, *val_end;
     for (int i=0; count != 0; i++, count--) {
         sep = memchr(lineptr, ' ', len);
         if (sep == NULL && count != 1) return NULL;
 
-        dest[i] = strtof(lineptr, &val_end);
+        dest[i] = strtod(lineptr, &val_end);
         if (sep != NULL && val_end != sep)
             return NULL;
 
@@ -203,7 +715,7 @@ static bool handle_worldfile_line(const char *lineptr, size_t len,
                                   struct parser_state *const state)
 {
     char *sep;
-    float fvalues[4];
+    real fvalues[4];
     long ivalues[6];
 
     while (len != 0 && isspace(*lineptr)) {
@@ -224,10 +736,10 @@ static bool handle_worldfile_line(const char *lineptr, size_t len,
 
         if(get_longs_from_line(lineptr, len, 4, ivalues) == NULL) return false;
 
-        game_world.game_stage.top = ivalues[0];
-        game_world.game_stage.left = ivalues[1];
-        game_world.game_stage.bottom = ivalues[2];
-        game_world.game_stage.right = ivalues[3];
+        state->world->game_stage.top = ivalues[0];
+        state->world->game_stage.left = ivalues[1];
+        state->world->game_stage.bottom = ivalues[2];
+        state->world->game_stage.right = ivalues[3];
 
         state->b = NULL;
         state->t = NULL;
@@ -238,8 +750,8 @@ static bool handle_worldfile_line(const char *lineptr, size_t len,
 
         if (get_floats_from_line(lineptr, len, 2, fvalues) == NULL) return false;
 
-        gravity_accel.x = fvalues[0];
-        gravity_accel.y = fvalues[1];
+        state->world->gravity.x = fvalues[0];
+        state->world->gravity.y = fvalues[1];
 
         state->b = NULL;
         state->t = NULL;
@@ -250,9 +762,9 @@ static bool handle_worldfile_line(const char *lineptr, size_t len,
 
         if (get_floats_from_line(lineptr, len, 2, fvalues) == NULL) return false;
 
-        ball *b = new_ball();
+        ball *b = init_ball(arena_alloc(&state->world->arenas[WORLD_ARENA_BALLS], sizeof(ball)));
         b->position = (vector2f) { fvalues[0], fvalues[1] };
-        add_ball(b);
+        add_ball(state->world, b);
         state->b = b;
         state->t = NULL;
     /* [>BALL] RADIUS r */
@@ -292,17 +804,15 @@ static bool handle_worldfile_line(const char *lineptr, size_t len,
 
         if(get_longs_from_line(lineptr, len, 5, ivalues) == NULL) return false;
 
-        trampoline *t = new_trampoline(ivalues[0]);
+        trampoline *t = init_trampoline(arena_alloc(&state->world->arenas[WORLD_ARENA_TRAMPOLINES],
+                                                    trampoline_size(ivalues[0])),
+                                        ivalues[0]);
         t->x = ivalues[1];
         t->y = ivalues[2];
         t->width = ivalues[3];
-        if (ivalues[4] != 0) { /* height */
-            double delta_y = ((double)ivalues[4])/t->n_anchors;
-            for (int i=0; i<t->n_anchors; ++i) {
-                t->offsets[i].y = i * delta_y;
-            }
-        }
-        add_trampoline(t);
+        if (ivalues[4] != 0)
+            set_trampoline_height(t, ivalues[4]);
+        add_trampoline(state->world, t);
         state->b = NULL;
         state->t = t;
     /* [>TRAMPOLINE] K spring-constant */
@@ -335,6 +845,16 @@ static bool handle_worldfile_line(const char *lineptr, size_t len,
         if (get_floats_from_line(lineptr, len, 1, fvalues) == NULL) return false;
 
         state->t->damping = fvalues[0];
+    /* [>TRAMPOLINE] REFINE levels */
+    } else if (strncasecmp("REFINE", lineptr, sep-lineptr) == 0) {
+        len -= (1 + sep - lineptr);
+        lineptr = sep + 1;
+
+        if (state->t == NULL) return false;
+
+        if (get_longs_from_line(lineptr, len, 1, ivalues) == NULL) return false;
+
+        if (!set_trampoline_refinement(state->t, ivalues[0])) return false;
     /* [root] WALL x y dx1 dy1 dx2 dy2 */
     } else if (strncasecmp("WALL", lineptr, sep-lineptr) == 0) {
         len -= (1 + sep - lineptr);
@@ -342,14 +862,14 @@ static bool handle_worldfile_line(const char *lineptr, size_t len,
 
         if(get_longs_from_line(lineptr, len, 6, ivalues) == NULL) return false;
 
-        wall *w = new_wall();
+        wall *w = arena_alloc(&state->world->arenas[WORLD_ARENA_WALLS], sizeof(wall));
         w->position.x = ivalues[0];
         w->position.y = ivalues[1];
         w->side1.x = ivalues[2];
         w->side1.y = ivalues[3];
         w->side2.x = ivalues[4];
         w->side2.y = ivalues[5];
-        add_wall(w);
+        add_wall(state->world, w);
         state->b = NULL;
         state->t = NULL;
     } else {
@@ -1,9 +1,12 @@
 #ifndef TRAMPBALL_GAME_H
 #define TRAMPBALL_GAME_H
 
+#include <stdint.h>
+
 #include "trampoline.h"
 #include "ball.h"
 #include "interaction.h"
+#include "arena.h"
 
 struct trampoline_list {
     struct trampoline_list *next;
@@ -20,20 +23,99 @@ struct wall_list {
     wall *w;
 };
 
-extern struct world {
+#define DEFAULT_GRAVITY ((vector2f) {0, -700})
+/* how many wall/edge impacts a ball may have within one step */
+#define MAX_CCD_SUBSTEPS 4
+
+/* ball-ball contacts game_iteration() keeps track of per ball; a ball
+   touching more balls than this has the rest resolved one by one */
+#define BALL_CONTACTS_PER_BALL 8
+/* contacts are resolved in up to this many batches of disjoint pairs;
+   the last batch is for pairs that didn't fit in any of the others, and
+   isn't shared between the workers */
+#define BALL_CONTACT_BATCHES 64
+/* fewer balls than this aren't worth waking the workers for */
+#define BALL_PARALLEL_MIN_BALLS 64
+
+struct ball_contact {
+    int other;  /* the other ball's index, always the higher one */
+    int batch;
+    struct ball_pair_contact solver;
+};
+
+/* the impulse a contact ended a step with, keyed by the balls' ids */
+struct ball_contact_impulse {
+    uint64_t pair;  /* lower id << 32 | higher id; 0 for an empty slot */
+    real impulse;
+};
+
+/* scratch space for game_iteration(), grown as balls are added */
+struct ball_contacts {
+    ball **balls;               /* the ball list, as an array */
+    uint64_t *batches;          /* per ball: which batches it's in */
+    int *n_contacts;
+    struct ball_contact *contacts; /* BALL_CONTACTS_PER_BALL per ball */
+    int size;
+    /* last step's impulses, to start this step's from: an open-addressing
+       hash table of impulse_slots (a power of two) slots, at most half full */
+    struct ball_contact_impulse *impulses;
+    int impulse_slots;
+};
+
+/* what the world file describes is loaded into these, one per kind */
+enum world_arena {
+    WORLD_ARENA_TRAMPOLINES,
+    WORLD_ARENA_BALLS,
+    WORLD_ARENA_WALLS,
+    WORLD_ARENA_LIST_NODES,
+    N_WORLD_ARENAS
+};
+
+/* all the state of one simulation. worlds are independent of each other,
+   so different worlds may be stepped on different threads. */
+struct world {
     stage game_stage;
+    vector2f gravity;
     struct trampoline_list *trampolines;
     struct ball_list *balls;
     struct wall_list *walls;
-} game_world;
+    int n_balls;
+    unsigned last_ball_id;
+    /* times the ball-ball contacts are solved per step */
+    int solver_iterations;
+    /* list nodes of objects that have left the world, for reuse */
+    struct trampoline_list *spare_trampoline_nodes;
+    struct ball_list *spare_ball_nodes;
+    struct wall_list *spare_wall_nodes;
+    arena arenas[N_WORLD_ARENAS];
+    /* to share big jobs between, or NULL. Not owned by the world. */
+    struct worker_pool *workers;
+    struct ball_contacts contacts;
+};
+
+struct world *new_world();
+void free_world(struct world *const world);
+void cleanup_world(struct world *const world);
 
-void cleanup_world();
+struct trampoline_list *add_trampoline(struct world *const world, trampoline *const t);
+struct ball_list *add_ball(struct world *const world, ball *const b);
+struct wall_list *add_wall(struct world *const world, wall *const w);
+bool remove_trampoline(struct world *const world, trampoline *const t);
+bool remove_ball(struct world *const world, ball *const b);
+bool remove_wall(struct world *const world, const wall *const w);
+/* free an object that has been taken out of the world (or was never in
+   it). Objects loaded from the world file stay in the world's arenas
+   until it goes, objects from new_ball() etc. are freed now. */
+void discard_trampoline(struct world *const world, trampoline *const t);
+void discard_ball(struct world *const world, ball *const b);
+void discard_wall(struct world *const world, wall *const w);
 
-struct trampoline_list *add_trampoline(trampoline *const t);
-struct ball_list *add_ball(ball *const b);
-struct wall_list *add_wall(wall *const w);
+bool init_game(struct world *const world, const char *const world_file_name);
+bool init_game_sdlrw(struct world *const world, SDL_RWops *fp);
+/* returns the total number of trampoline substeps taken */
+int game_iteration(struct world *const world, const real dt_ms);
 
-bool init_game(const char *const world_file_name);
-void game_iteration(const float dt_ms);
+double world_energy(const struct world *const world);
+void world_momentum(const struct world *const world, double *const px, double *const py);
 
 #endif /* TRAMPBALL_GAME_H */
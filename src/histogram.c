@@ -0,0 +1,153 @@
+#include <limits.h>
+#include <string.h>
+
+#include "histogram.h"
+
+#define SUB_BUCKETS (1 << HISTOGRAM_SUB_BUCKET_BITS)
+#define HALF_SUB_BUCKETS (1 << (HISTOGRAM_SUB_BUCKET_BITS - 1))
+
+static inline int msb64(uint64_t v)
+{
+    int n = 0;
+    while (v >>= 1) ++n;
+    return n;
+}
+
+/*
+ * Values below SUB_BUCKETS get a bucket each. Above that, every power of
+ * two is split into HALF_SUB_BUCKETS equal buckets, so the relative error
+ * stays constant.
+ */
+static inline int bucket_index(uint64_t v)
+{
+    if (v < SUB_BUCKETS) return v;
+
+    if (v >= ((uint64_t) 1) << HISTOGRAM_MAX_BITS)
+        return HISTOGRAM_BUCKETS - 1;
+
+    int shift = msb64(v) - HISTOGRAM_SUB_BUCKET_BITS + 1;
+    return (shift << (HISTOGRAM_SUB_BUCKET_BITS - 1)) + (int)(v >> shift);
+}
+
+/* the highest value that would end up in bucket i */
+static inline uint64_t bucket_upper_bound(int i)
+{
+    if (i < SUB_BUCKETS) return i;
+
+    int shift = i / HALF_SUB_BUCKETS - 1;
+    uint64_t sub = i - shift * HALF_SUB_BUCKETS;
+    return ((sub + 1) << shift) - 1;
+}
+
+void histogram_init(histogram *const h, const char *const name)
+{
+    h->name = name;
+    histogram_reset(h);
+}
+
+void histogram_record(histogram *const h, uint64_t value_ns)
+{
+    SDL_AtomicAdd(&h->counts[bucket_index(value_ns)], 1);
+
+    int v = (value_ns > INT_MAX) ? INT_MAX : (int) value_ns;
+    int old_max;
+    do {
+        old_max = SDL_AtomicGet(&h->max_ns);
+        if (v <= old_max) break;
+    } while (!SDL_AtomicCAS(&h->max_ns, old_max, v));
+}
+
+void histogram_reset(histogram *const h)
+{
+    for (int i=0; i<HISTOGRAM_BUCKETS; ++i)
+        SDL_AtomicSet(&h->counts[i], 0);
+    SDL_AtomicSet(&h->max_ns, 0);
+}
+
+void histogram_summarize(histogram *const h, struct histogram_summary *const s)
+{
+    static const double quantiles[] = { 0.5, 0.99, 0.999 };
+    double *const results[] = { &s->p50_us, &s->p99_us, &s->p999_us };
+    int counts[HISTOGRAM_BUCKETS];
+    long total = 0;
+    int i, q;
+
+    // Writers may keep going while we read - that's fine, we just take
+    // whatever we see as our snapshot.
+    for (i=0; i<HISTOGRAM_BUCKETS; ++i) {
+        counts[i] = SDL_AtomicGet(&h->counts[i]);
+        total += counts[i];
+    }
+
+    s->name = h->name;
+    s->count = total;
+    s->max_us = SDL_AtomicGet(&h->max_ns) * 1e-3;
+
+    long seen = 0;
+    for (i=0, q=0; q<3; ++q) {
+        long rank = (long)(quantiles[q] * total + 0.5);
+        if (rank < 1) rank = 1;
+        while (i < HISTOGRAM_BUCKETS && seen + counts[i] < rank)
+            seen += counts[i++];
+        if (total == 0 || i == HISTOGRAM_BUCKETS) {
+            *results[q] = 0;
+        } else {
+            *results[q] = bucket_upper_bound(i) * 1e-3;
+            if (*results[q] > s->max_us) *results[q] = s->max_us;
+        }
+    }
+}
+
+bool open_histogram_dump(histogram_dump *const dump, const char *const filename)
+{
+    size_t len = strlen(filename);
+
+    dump->json = (len >= 5 && strcmp(&filename[len-5], ".json") == 0);
+    dump->first = true;
+
+    if ((dump->fp = fopen(filename, "w")) == NULL) {
+        perror("Error opening stats file");
+        return false;
+    }
+
+    if (dump->json)
+        fputs("[", dump->fp);
+    else
+        fputs("time_s,name,count,p50_us,p99_us,p99.9_us,max_us\n", dump->fp);
+
+    return true;
+}
+
+void write_histogram_dump(histogram_dump *const dump, double time_s,
+                          const struct histogram_summary *const summaries, int n)
+{
+    if (dump->fp == NULL) return;
+
+    for (int i=0; i<n; ++i) {
+        const struct histogram_summary *s = &summaries[i];
+        if (dump->json) {
+            fprintf(dump->fp, "%s\n {\"time_s\": %.3f, \"name\": \"%s\", \"count\": %ld, "
+                              "\"p50_us\": %.2f, \"p99_us\": %.2f, \"p99.9_us\": %.2f, "
+                              "\"max_us\": %.2f}",
+                    dump->first ? "" : ",", time_s, s->name, s->count,
+                    s->p50_us, s->p99_us, s->p999_us, s->max_us);
+        } else {
+            fprintf(dump->fp, "%.3f,%s,%ld,%.2f,%.2f,%.2f,%.2f\n",
+                    time_s, s->name, s->count,
+                    s->p50_us, s->p99_us, s->p999_us, s->max_us);
+        }
+        dump->first = false;
+    }
+
+    fflush(dump->fp);
+}
+
+void close_histogram_dump(histogram_dump *const dump)
+{
+    if (dump->fp == NULL) return;
+
+    if (dump->json)
+        fputs("\n]\n", dump->fp);
+    fclose(dump->fp);
+    dump->fp = NULL;
+}
@@ -0,0 +1,55 @@
+/*
+    histogram.h
+
+    lock-free log-linear (HDR-style) latency histograms
+*/
+
+#ifndef TRAMPBALL_HISTOGRAM_H
+#define TRAMPBALL_HISTOGRAM_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <SDL.h>
+
+/* 2^(SUB_BUCKET_BITS-1) buckets per power of two: ~3% resolution */
+#define HISTOGRAM_SUB_BUCKET_BITS 6
+/* values are in ns; anything at or above 2^HISTOGRAM_MAX_BITS (~68s)
+   ends up in the last bucket */
+#define HISTOGRAM_MAX_BITS 36
+#define HISTOGRAM_BUCKETS \
+    (((HISTOGRAM_MAX_BITS - HISTOGRAM_SUB_BUCKET_BITS + 1) << (HISTOGRAM_SUB_BUCKET_BITS - 1)) + \
+     (1 << HISTOGRAM_SUB_BUCKET_BITS))
+
+typedef struct _histogram {
+    const char *name;
+    SDL_atomic_t max_ns; /* saturates at INT_MAX (~2.1s) */
+    SDL_atomic_t counts[HISTOGRAM_BUCKETS];
+} histogram;
+
+struct histogram_summary {
+    const char *name;
+    long count;
+    double p50_us;
+    double p99_us;
+    double p999_us;
+    double max_us;
+};
+
+void histogram_init(histogram *const h, const char *const name);
+void histogram_record(histogram *const h, uint64_t value_ns);
+void histogram_reset(histogram *const h);
+void histogram_summarize(histogram *const h, struct histogram_summary *const s);
+
+typedef struct {
+    FILE *fp;
+    bool json;
+    bool first;
+} histogram_dump;
+
+bool open_histogram_dump(histogram_dump *const dump, const char *const filename);
+void write_histogram_dump(histogram_dump *const dump, double time_s,
+                          const struct histogram_summary *const summaries, int n);
+void close_histogram_dump(histogram_dump *const dump);
+
+#endif /* TRAMPBALL_HISTOGRAM_H */
@@ -1,76 +1,135 @@
 #include <math.h>
 #include <string.h>
-#ifdef _MSC_VER
-#  include <malloc.h>
-#else
-#  include <alloca.h>
-#endif
 
 #include "interaction.h"
 
 
+static inline real anchor_x(const trampoline *const t, const real *const rest_x,
+                            real dx, int i)
+{
+    return t->x + (rest_x ? rest_x[i] : i*dx) + t->offsets[i].x;
+}
+
+/* [*lo, *hi) are the anchors of t that may be between left and right:
+   those at rest there, and any neighbours that have been pulled in from
+   either side */
+static void anchors_between(const trampoline *const t, const real *const rest_x,
+                            real dx, real left, real right, int *lo, int *hi)
+{
+    const int n = t->n_anchors;
+    int i, j, mid;
+
+    // close enough to start from; the exact test is below
+    left -= t->x;
+    right -= t->x;
+    if (rest_x) {
+        for (i=0, j=n; i<j; ) {
+            mid = i + (j - i) / 2;
+            if (rest_x[mid] < left) i = mid + 1; else j = mid;
+        }
+        *lo = i;
+        for (j=n; i<j; ) {
+            mid = i + (j - i) / 2;
+            if (rest_x[mid] <= right) i = mid + 1; else j = mid;
+        }
+        *hi = i;
+    } else {
+        real l = real_ceil(left / dx), r = real_floor(right / dx) + 1;
+        *lo = l < 0 ? 0 : (l > n ? n : (int) l);
+        *hi = r < *lo ? *lo : (r > n ? n : (int) r);
+    }
+
+    left += t->x;
+    right += t->x;
+    while (*lo > 0 && anchor_x(t, rest_x, dx, *lo - 1) >= left) --*lo;
+    while (*hi < n && anchor_x(t, rest_x, dx, *hi) <= right) ++*hi;
+}
 
 bool collide_ball_trampoline(ball *const b, trampoline *const t)
 {
     int i, j, k;
 
     /* do they collide? */
-    float bb_left = b->position.x - b->radius;
-    float bb_right = b->position.x + b->radius;
-    float bb_top = b->position.y + b->radius;
-    float bb_bottom = b->position.y - b->radius;
-    float r_sq = b->radius * b->radius;
+    real bb_left = b->position.x - b->radius;
+    real bb_right = b->position.x + b->radius;
+    real bb_top = b->position.y + b->radius;
+    real bb_bottom = b->position.y - b->radius;
+    real r_sq = b->radius * b->radius;
 
     int n_anchors = t->n_anchors;
-    float dx = ((float) t->width) / (n_anchors-1);
-    int t_x = t->x;
+    real dx = ((real) t->width) / (n_anchors-1);
+    // where the anchors are at rest, if they aren't evenly spaced
+    const real *rest_x = t->mesh ? t->mesh->rest_x : NULL;
+    // and an adaptive trampoline wants to know about balls on the way,
+    // so that it can refine in time
+    real reach = b->radius;
+    if (rest_x)
+        reach += (real_fabs(b->speed.x) + real_fabs(b->speed.y)) * TRAMPOLINE_REFINE_LOOKAHEAD;
+    bool approaching = false;
     int t_y = t->y;
 
     int n_colliding = 0;
-    int *colliding_indices = alloca(n_anchors * sizeof(int));
+    int *const colliding_indices = t->contact_scratch;
+    int lo, hi;
     vector2f direction;
-    float min_dr_sq = 2 * r_sq;
+    real min_dr_sq = 2 * r_sq;
 
-    float combined_mass;
+    real combined_mass, colliding_mass = 0;
     vector2f combined_momentum = {0, 0};
 
-    for (i=0; i<n_anchors; ++i) {
-        float x, y;
+    // only the anchors near the ball can touch it
+    anchors_between(t, rest_x, dx, b->position.x - reach, b->position.x + reach,
+                    &lo, &hi);
+    for (i=lo; i<hi; ++i) {
+        real x, y;
 
         y = t_y + t->offsets[i].y;
-        if (y < bb_bottom || y > bb_top) continue;
-        x = t_x + i*dx + t->offsets[i].x;
-        if (x < bb_left || x > bb_right) continue;
+        if (y < b->position.y - reach || y > b->position.y + reach) continue;
+        x = anchor_x(t, rest_x, dx, i);
+        if (x < b->position.x - reach || x > b->position.x + reach) continue;
+        approaching = true;
+        if (y < bb_bottom || y > bb_top || x < bb_left || x > bb_right) continue;
 
         // We're within the bounding box rect.
-        float delta_x = b->position.x - x;
-        float delta_y = b->position.y - y;
-        float delta_r_sq = delta_x*delta_x + delta_y*delta_y;
+        real delta_x = b->position.x - x;
+        real delta_y = b->position.y - y;
+        real delta_r_sq = delta_x*delta_x + delta_y*delta_y;
         if (delta_r_sq <= r_sq) {
             // collision!
             colliding_indices[n_colliding] = i;
-            // we'll multiply in the mass later
-            combined_momentum.x += t->speed[i].x;
-            combined_momentum.y += t->speed[i].y;
+            if (rest_x) {
+                real dm = t->density * t->mesh->length[i];
+                combined_momentum.x += dm * t->speed[i].x;
+                combined_momentum.y += dm * t->speed[i].y;
+                colliding_mass += dm;
+            } else {
+                // we'll multiply in the mass later
+                combined_momentum.x += t->speed[i].x;
+                combined_momentum.y += t->speed[i].y;
+            }
 
             if (min_dr_sq > delta_r_sq) {
                 min_dr_sq = delta_r_sq;
-                float this_dr = sqrtf(delta_r_sq);
+                real this_dr = real_sqrt(delta_r_sq);
                 int i_before = i ? i-1 : 0;
                 int i_after = (i != n_anchors-1) ? i+1 : i;
-                float norm_x = (t->offsets[i_after].y - t->offsets[i_before].y);
-                float norm_y = - (2 * dx + t->offsets[i_after].x - t->offsets[i_before].x);
+                real norm_x = (t->offsets[i_after].y - t->offsets[i_before].y);
+                real span = rest_x ? rest_x[i_after] - rest_x[i_before] : 2 * dx;
+                real norm_y = - (span + t->offsets[i_after].x - t->offsets[i_before].x);
                 direction.x = this_dr * norm_x;
                 direction.y = this_dr * norm_y;
             }
 
             n_colliding++;
 
-            // float my_dist = fabsf(delta_x*v_hat.x + delta_y*v_hat.y);
+            // real my_dist = real_fabs(delta_x*v_hat.x + delta_y*v_hat.y);
             // if (my_dist < closest) closest = my_dist;
         }
     }
 
+    if (approaching && rest_x)
+        refine_trampoline_under(t, b->position.x - reach, b->position.x + reach);
+
     if (!n_colliding) {
         if(detach_ball(t, b))
             b->remote_controlled = false;
@@ -79,15 +138,18 @@ bool collide_ball_trampoline(ball *const b, trampoline *const t)
         b->remote_controlled = true;
     }
 
-    float dm = t->density * dx;
-    combined_momentum.x *= dm;
-    combined_momentum.y *= dm;
+    if (!rest_x) {
+        real dm = t->density * dx;
+        combined_momentum.x *= dm;
+        combined_momentum.y *= dm;
+        colliding_mass = dm * n_colliding;
+    }
     combined_momentum.x += b->mass * b->speed.x;
     combined_momentum.y += b->mass * b->speed.y;
-    combined_mass = dm * n_colliding + b->mass;
+    combined_mass = colliding_mass + b->mass;
 
-    float speed_x = combined_momentum.x / combined_mass;
-    float speed_y = combined_momentum.y / combined_mass;
+    real speed_x = combined_momentum.x / combined_mass;
+    real speed_y = combined_momentum.y / combined_mass;
 
     attachment *a = find_ball_attached(t, b);
     bool any_new = false;
@@ -96,7 +158,7 @@ bool collide_ball_trampoline(ball *const b, trampoline *const t)
 
     if (a == NULL) {
         // this is a collision we didn't know about!
-        a = new_attachment(t, n_anchors); // over-allocating, but that's OK
+        a = new_attachment(t, t->max_anchors); // over-allocating, but that's OK
         a->b = b;
     }
 
@@ -115,7 +177,7 @@ bool collide_ball_trampoline(ball *const b, trampoline *const t)
         }
     }
 
-    float dir_magn = sqrtf(direction.x*direction.x +
+    real dir_magn = real_sqrt(direction.x*direction.x +
                            direction.y*direction.y);
     a->direction_n.x = direction.x / dir_magn;
     a->direction_n.y = direction.y / dir_magn;
@@ -139,7 +201,7 @@ bool collide_ball_trampoline(ball *const b, trampoline *const t)
 
 bool collide_ball_edges(ball *const b, const stage *const s)
 {
-    float overlap;
+    real overlap;
 
     vector2f reflection = {1, 1};
     if (((overlap = b->position.x - b->radius - s->left) <= 0) ||
@@ -162,49 +224,104 @@ bool collide_ball_edges(ball *const b, const stage *const s)
     }
 }
 
-bool collide_ball_ball(ball *const b1, ball *const b2)
+bool balls_touching(const ball *const b1, const ball *const b2)
+{
+    real min_dist = b1->radius + b2->radius;
+    vector2f sep = { b2->position.x - b1->position.x,
+                     b2->position.y - b1->position.y };
+
+    return sep.x*sep.x + sep.y*sep.y <= min_dist * min_dist;
+}
+
+static void apply_ball_impulse(ball *const b1, ball *const b2, const vector2f n, real j)
 {
-    float min_dist = b1->radius + b2->radius;
-    float min_dist_sq = min_dist * min_dist;
+    b1->speed.x -= j * n.x / b1->mass;
+    b1->speed.y -= j * n.y / b1->mass;
+    b2->speed.x += j * n.x / b2->mass;
+    b2->speed.y += j * n.y / b2->mass;
+}
 
+bool prepare_ball_contact(ball *const b1, ball *const b2, struct ball_pair_contact *const c)
+{
+    real min_dist = b1->radius + b2->radius;
     vector2f sep = { b2->position.x - b1->position.x,
                      b2->position.y - b1->position.y };
-    float dist_sq = sep.x*sep.x + sep.y*sep.y;
+    real dist_sq = sep.x*sep.x + sep.y*sep.y;
 
-    if (dist_sq > min_dist_sq) {
-        return false;
-    } else {
-        float dist = sqrtf(dist_sq);
-        vector2f sep_n = { sep.x/dist, sep.y/dist };
-        vector2f momentum_transfer = {
-            (b1->speed.x * b1->mass * fabsf(sep_n.x) -
-             b2->speed.x * b2->mass * fabsf(sep_n.x)),
-            (b1->speed.y * b1->mass * fabsf(sep_n.y) -
-             b2->speed.y * b2->mass * fabsf(sep_n.y)),
-        };
-
-        // TODO: integrate ball.bounce factor somehow...
-        b1->speed.x -= momentum_transfer.x / b1->mass;
-        b1->speed.y -= momentum_transfer.y / b1->mass;
-        b2->speed.x += momentum_transfer.x / b2->mass;
-        b2->speed.y += momentum_transfer.y / b2->mass;
-
-        float rel_r = b1->radius / min_dist;
-        b1->position.x -= (min_dist - dist) * rel_r * sep_n.x;
-        b1->position.y -= (min_dist - dist) * rel_r * sep_n.y;
-        b2->position.x += (min_dist - dist) * (1 - rel_r) * sep_n.x;
-        b2->position.y += (min_dist - dist) * (1 - rel_r) * sep_n.y;
-        return true;
-    }
+    if (dist_sq > min_dist * min_dist) return false;
+
+    real dist = real_sqrt(dist_sq);
+    c->normal = dist > 0 ? (vector2f) { sep.x/dist, sep.y/dist } : (vector2f) { 0, 1 };
+    c->mass = 1 / (1 / b1->mass + 1 / b2->mass);
+
+    real v_n = (b2->speed.x - b1->speed.x) * c->normal.x +
+               (b2->speed.y - b1->speed.y) * c->normal.y;
+    real bounce = b1->bounce > b2->bounce ? b1->bounce : b2->bounce;
+    c->target = v_n < -BALL_BOUNCE_MIN_SPEED ? -bounce * v_n : 0;
+
+    apply_ball_impulse(b1, b2, c->normal, c->impulse);
+    return true;
+}
+
+void solve_ball_contact(ball *const b1, ball *const b2, struct ball_pair_contact *const c)
+{
+    real v_n = (b2->speed.x - b1->speed.x) * c->normal.x +
+               (b2->speed.y - b1->speed.y) * c->normal.y;
+    real impulse = c->impulse + c->mass * (c->target - v_n);
+
+    // contacts only ever push
+    if (impulse < 0) impulse = 0;
+    apply_ball_impulse(b1, b2, c->normal, impulse - c->impulse);
+    c->impulse = impulse;
+}
+
+void separate_balls(ball *const b1, ball *const b2)
+{
+    real min_dist = b1->radius + b2->radius;
+    vector2f sep = { b2->position.x - b1->position.x,
+                     b2->position.y - b1->position.y };
+    real dist = real_sqrt(sep.x*sep.x + sep.y*sep.y);
+    real overlap = min_dist - dist - BALL_CONTACT_SLOP;
+
+    if (overlap <= 0 || dist == 0) return;
+
+    vector2f sep_n = { sep.x/dist, sep.y/dist };
+    real rel_r = b1->radius / min_dist;
+    b1->position.x -= overlap * rel_r * sep_n.x;
+    b1->position.y -= overlap * rel_r * sep_n.y;
+    b2->position.x += overlap * (1 - rel_r) * sep_n.x;
+    b2->position.y += overlap * (1 - rel_r) * sep_n.y;
+}
+
+bool collide_ball_ball(ball *const b1, ball *const b2)
+{
+    struct ball_pair_contact c = { {0, 0}, 0, 0, 0 };
+
+    if (!prepare_ball_contact(b1, b2, &c)) return false;
+    solve_ball_contact(b1, b2, &c);
+    separate_balls(b1, b2);
+    return true;
+}
+
+void hold_ball_at_edges(ball *const b, const stage *const s)
+{
+    if (b->speed.x < 0 && b->position.x - b->radius <= s->left + BALL_CONTACT_SLOP)
+        b->speed.x = 0;
+    if (b->speed.x > 0 && b->position.x + b->radius >= s->right - BALL_CONTACT_SLOP)
+        b->speed.x = 0;
+    if (b->speed.y < 0 && b->position.y - b->radius <= s->bottom + BALL_CONTACT_SLOP)
+        b->speed.y = 0;
+    if (b->speed.y > 0 && b->position.y + b->radius >= s->top - BALL_CONTACT_SLOP)
+        b->speed.y = 0;
 }
 
 static int collide_ball_line(ball *const b, vector2i pos, vector2i extent)
 {
     vector2f offset, offset_hat, line_vec_hat;
-    float length, offset_sq, dist;
+    real length, offset_sq, dist;
 
     vector2i end_pos = { pos.x + extent.x, pos.y + extent.y };
-    float r_sq = b->radius*b->radius;
+    real r_sq = b->radius*b->radius;
 
     /* check whether the perpendicular from the centre onto our line
        falls within our segment */
@@ -225,11 +342,11 @@ check_corner:
     if (offset_sq > r_sq) {
         return 0;
     } else {
-        // length = sqrtf(extent.x*extent.x + extent.y*extent.y);
-        dist = sqrtf(offset_sq);
+        // length = real_sqrt(extent.x*extent.x + extent.y*extent.y);
+        dist = real_sqrt(offset_sq);
         /* repel any movement towards the corner */
         offset_hat = (vector2f) { offset.x/dist, offset.y/dist };
-        float speed_towards = b->speed.x * offset_hat.x +
+        real speed_towards = b->speed.x * offset_hat.x +
                               b->speed.y * offset_hat.y;
         b->speed.x = b->speed.x - speed_towards * offset_hat.x;
         b->speed.y = b->speed.y - speed_towards * offset_hat.y;
@@ -244,15 +361,15 @@ check_perpendicular:
 
        if we got here, then ``offset'' is the offset from the END point.
     */
-    length = sqrtf(extent.x*extent.x + extent.y*extent.y);
+    length = real_sqrt(extent.x*extent.x + extent.y*extent.y);
     // dist is positive if the ball is on the right hand side
     dist = (offset.x * extent.y - offset.y * extent.x) / length;
-    if (fabsf(dist) > b->radius) {
+    if (real_fabs(dist) > b->radius) {
         return 0;
     } else {
         /* reflect off of the line */
         line_vec_hat = (vector2f) { extent.x / length, extent.y / length };
-        float speed_along = b->speed.x * line_vec_hat.x + b->speed.y * line_vec_hat.y;
+        real speed_along = b->speed.x * line_vec_hat.x + b->speed.y * line_vec_hat.y;
         vector2f velocity_along = { speed_along * line_vec_hat.x, speed_along * line_vec_hat.y };
         b->speed.x = -b->bounce * (b->speed.x - velocity_along.x) + velocity_along.x;
         b->speed.y = -b->bounce * (b->speed.y - velocity_along.y) + velocity_along.y;
@@ -281,3 +398,108 @@ bool collide_ball_wall(ball *const b, const wall *const w)
         ) ? true : false;
 }
 
+bool sweep_ball_edges(const ball *const b, const stage *const s, const vector2f d,
+                      struct ball_impact *const impact)
+{
+    bool hit = false;
+    real t;
+
+    if (d.x < 0 && (t = (s->left + b->radius - b->position.x) / d.x) >= 0 && t < impact->toi) {
+        *impact = (struct ball_impact) { t, {1, 0}, b->bounce };
+        hit = true;
+    }
+    if (d.x > 0 && (t = (s->right - b->radius - b->position.x) / d.x) >= 0 && t < impact->toi) {
+        *impact = (struct ball_impact) { t, {-1, 0}, b->bounce };
+        hit = true;
+    }
+    if (d.y < 0 && (t = (s->bottom + b->radius - b->position.y) / d.y) >= 0 && t < impact->toi) {
+        *impact = (struct ball_impact) { t, {0, 1}, b->bounce };
+        hit = true;
+    }
+    if (d.y > 0 && (t = (s->top - b->radius - b->position.y) / d.y) >= 0 && t < impact->toi) {
+        *impact = (struct ball_impact) { t, {0, -1}, b->bounce };
+        hit = true;
+    }
+
+    return hit;
+}
+
+/* like collide_ball_line() does for corners: no bounce, just stop */
+static bool sweep_ball_corner(const ball *const b, vector2i corner, const vector2f d,
+                              struct ball_impact *const impact)
+{
+    vector2f offset = { b->position.x - corner.x, b->position.y - corner.y };
+    real a = d.x*d.x + d.y*d.y;
+    real half_b = offset.x*d.x + offset.y*d.y;
+    real c = offset.x*offset.x + offset.y*offset.y - b->radius*b->radius;
+    real disc = half_b*half_b - a*c;
+
+    // already touching (that's for the discrete check), moving away, or missing
+    if (c <= 0 || half_b >= 0 || disc < 0) return false;
+
+    real t = (-half_b - real_sqrt(disc)) / a;
+    if (t < 0 || t >= impact->toi) return false;
+
+    vector2f n = { offset.x + t*d.x, offset.y + t*d.y };
+    real n_len = real_sqrt(n.x*n.x + n.y*n.y);
+    *impact = (struct ball_impact) { t, { n.x/n_len, n.y/n_len }, 0 };
+    return true;
+}
+
+static bool sweep_ball_line(const ball *const b, vector2i pos, vector2i extent,
+                            const vector2f d, struct ball_impact *const impact)
+{
+    real length = real_sqrt(extent.x*extent.x + extent.y*extent.y);
+    vector2f n = { extent.y / length, -extent.x / length }; /* right hand side */
+    vector2f offset = { b->position.x - pos.x, b->position.y - pos.y };
+    real dist = offset.x * n.x + offset.y * n.y;
+    real approach = d.x * n.x + d.y * n.y;
+    real t;
+
+    if (real_fabs(dist) <= b->radius) {
+        // touching the line already; the discrete check deals with that
+        return false;
+    } else if (dist > 0) {
+        if (approach >= 0) return false;
+        t = (dist - b->radius) / -approach;
+    } else {
+        if (approach <= 0) return false;
+        t = (-dist - b->radius) / approach;
+        n = (vector2f) { -n.x, -n.y };
+    }
+
+    if (t < impact->toi) {
+        // does the contact point fall within the segment?
+        real along = (offset.x + t*d.x) * extent.x + (offset.y + t*d.y) * extent.y;
+        if (along >= 0 && along <= length * length) {
+            *impact = (struct ball_impact) { t, n, b->bounce };
+            return true;
+        }
+    }
+
+    bool hit = sweep_ball_corner(b, pos, d, impact);
+    hit |= sweep_ball_corner(b, (vector2i) { pos.x + extent.x, pos.y + extent.y }, d, impact);
+    return hit;
+}
+
+bool sweep_ball_wall(const ball *const b, const wall *const w, const vector2f d,
+                     struct ball_impact *const impact)
+{
+    bool hit = false;
+    hit |= sweep_ball_line(b, w->position, w->side1, d, impact);
+    hit |= sweep_ball_line(b, w->position, w->side2, d, impact);
+    hit |= sweep_ball_line(b, (vector2i){w->position.x + w->side1.x,
+                                         w->position.y + w->side1.y}, w->side2, d, impact);
+    hit |= sweep_ball_line(b, (vector2i){w->position.x + w->side2.x,
+                                         w->position.y + w->side2.y}, w->side1, d, impact);
+    return hit;
+}
+
+void resolve_ball_impact(ball *const b, const struct ball_impact *const impact)
+{
+    real v_n = b->speed.x * impact->normal.x + b->speed.y * impact->normal.y;
+    if (v_n >= 0) return;
+
+    b->speed.x -= (1 + impact->restitution) * v_n * impact->normal.x;
+    b->speed.y -= (1 + impact->restitution) * v_n * impact->normal.y;
+}
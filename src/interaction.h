@@ -5,6 +5,7 @@
 
 #include "trampoline.h"
 #include "ball.h"
+#include "alloc.h"
 
 typedef struct _stage {
     int top;
@@ -21,10 +22,60 @@ typedef struct _wall {
 
 bool collide_ball_trampoline(ball *const b, trampoline *const t);
 bool collide_ball_edges(ball *const b, const stage *const s);
+/* one pair on its own: see the ball_pair_contact functions for many */
 bool collide_ball_ball(ball *const b1, ball *const b2);
+/* whether collide_ball_ball() would do anything */
+bool balls_touching(const ball *const b1, const ball *const b2);
+
+/* overlap, in pixels, that touching balls are left with: it keeps the
+   contacts of a pile the same from one step to the next */
+#define BALL_CONTACT_SLOP REAL(0.5)
+/* balls meeting slower than this (pixels/sec) don't bounce off each other */
+#define BALL_BOUNCE_MIN_SPEED REAL(30.0)
+/* how many times each step the ball-ball contacts are solved, by default */
+#define BALL_SOLVER_ITERATIONS 8
+
+/*
+ * Ball-ball contacts, solved with sequential impulses. Once per step,
+ * prepare_ball_contact() sets a contact up and applies the impulse it
+ * ended the last step with; then solve_ball_contact() is called a few
+ * times for every contact in turn, so that the impulses settle on what
+ * the whole pile needs; then separate_balls() pushes apart what still
+ * overlaps. Impulse is momentum, in mass * pixel/sec.
+ */
+struct ball_pair_contact {
+    vector2f normal;    /* from the first ball to the second */
+    real mass;          /* effective mass along the normal */
+    real target;        /* normal speed to part at: bounce, if fast enough */
+    real impulse;       /* accumulated, never negative */
+};
+
+bool prepare_ball_contact(ball *const b1, ball *const b2, struct ball_pair_contact *const c);
+void solve_ball_contact(ball *const b1, ball *const b2, struct ball_pair_contact *const c);
+void separate_balls(ball *const b1, ball *const b2);
+/* the stage edges' side of the solver: no speed into an edge the ball is
+   resting on (collide_ball_edges() does the bouncing) */
+void hold_ball_at_edges(ball *const b, const stage *const s);
 bool collide_ball_wall(ball *const b, const wall *const w);
 
-#define new_wall() ((wall*)malloc(sizeof(wall)))
-#define free_wall(w) free(w)
+/*
+ * Continuous collision detection: the sweep_* functions look for the first
+ * contact of a ball moving by displacement d, and return true if it happens
+ * before impact->toi (a fraction of d), in which case impact is updated.
+ */
+struct ball_impact {
+    real toi;
+    vector2f normal; /* pointing away from the obstacle */
+    real restitution;
+};
+
+bool sweep_ball_edges(const ball *const b, const stage *const s, const vector2f d,
+                      struct ball_impact *const impact);
+bool sweep_ball_wall(const ball *const b, const wall *const w, const vector2f d,
+                     struct ball_impact *const impact);
+void resolve_ball_impact(ball *const b, const struct ball_impact *const impact);
+
+#define new_wall() ((wall*)TB_MALLOC(ALLOC_BALL, sizeof(wall)))
+#define free_wall(w) TB_FREE(w)
 
 #endif /* TRAMPBALL_INTERACTION_H */
@@ -0,0 +1,139 @@
+#include <stdlib.h>
+#include <SDL.h>
+
+#include "game.h"
+#include "libtrampball.h"
+
+trampball_world *trampball_world_from_file(const char *const filename)
+{
+    struct world *w = new_world();
+    if (!init_game(w, filename)) {
+        free_world(w);
+        return NULL;
+    }
+    return w;
+}
+
+trampball_world *trampball_world_from_buffer(const void *const buf, size_t len)
+{
+    SDL_RWops *fp;
+    if ((fp = SDL_RWFromConstMem(buf, len)) == NULL)
+        return NULL;
+
+    struct world *w = new_world();
+    bool status = init_game_sdlrw(w, fp);
+    SDL_RWclose(fp);
+
+    if (!status) {
+        free_world(w);
+        return NULL;
+    }
+    return w;
+}
+
+void trampball_world_destroy(trampball_world *const w)
+{
+    if (w != NULL) free_world(w);
+}
+
+void trampball_world_step(trampball_world *const w, int n_steps, float dt_ms)
+{
+    while (n_steps-- > 0)
+        game_iteration(w, dt_ms);
+}
+
+void trampball_world_set_gravity(trampball_world *const w, float x, float y)
+{
+    w->gravity = (vector2f) { x, y };
+}
+
+void trampball_world_set_solver_iterations(trampball_world *const w, int iterations)
+{
+    w->solver_iterations = iterations < 1 ? 1 : iterations;
+}
+
+int trampball_world_ball_count(const trampball_world *const w)
+{
+    int n = 0;
+    for (struct ball_list *bl = w->balls; bl; bl = bl->next) ++n;
+    return n;
+}
+
+int trampball_world_trampoline_count(const trampball_world *const w)
+{
+    int n = 0;
+    for (struct trampoline_list *tl = w->trampolines; tl; tl = tl->next) ++n;
+    return n;
+}
+
+static trampoline *get_trampoline(const trampball_world *const w, int idx)
+{
+    struct trampoline_list *tl;
+    for (tl = w->trampolines; tl && idx > 0; tl = tl->next, --idx);
+    return (tl && idx == 0) ? tl->t : NULL;
+}
+
+int trampball_world_trampoline_anchors(const trampball_world *const w, int idx)
+{
+    trampoline *t = get_trampoline(w, idx);
+    return t ? t->n_anchors : -1;
+}
+
+static int copy_ball_vectors(const trampball_world *const w, size_t member_offset,
+                             float *const xy, int max_items)
+{
+    int n = 0;
+    for (struct ball_list *bl = w->balls; bl && n < max_items; bl = bl->next, ++n) {
+        SDL_LockMutex(bl->b->lock);
+        const vector2f *v = (const vector2f *) (((const char *) bl->b) + member_offset);
+        xy[2*n] = v->x;
+        xy[2*n+1] = v->y;
+        SDL_UnlockMutex(bl->b->lock);
+    }
+    return n;
+}
+
+int trampball_world_get_ball_positions(const trampball_world *const w,
+                                       float *const xy, int max_items)
+{
+    return copy_ball_vectors(w, offsetof(ball, position), xy, max_items);
+}
+
+int trampball_world_get_ball_speeds(const trampball_world *const w,
+                                    float *const xy, int max_items)
+{
+    return copy_ball_vectors(w, offsetof(ball, speed), xy, max_items);
+}
+
+int trampball_world_get_trampoline_offsets(const trampball_world *const w, int idx,
+                                           float *const xy, int max_items)
+{
+    trampoline *t = get_trampoline(w, idx);
+    if (t == NULL) return -1;
+
+    int n = (t->n_anchors < max_items) ? t->n_anchors : max_items;
+
+    SDL_LockMutex(t->lock);
+    for (int i=0; i<n; ++i) {
+        xy[2*i] = t->offsets[i].x;
+        xy[2*i+1] = t->offsets[i].y;
+    }
+    SDL_UnlockMutex(t->lock);
+
+    return n;
+}
+
+int trampball_world_get_trampoline_rest_x(const trampball_world *const w, int idx,
+                                          float *const x, int max_items)
+{
+    trampoline *t = get_trampoline(w, idx);
+    if (t == NULL) return -1;
+
+    SDL_LockMutex(t->lock);
+    int n = (t->n_anchors < max_items) ? t->n_anchors : max_items;
+    for (int i=0; i<n; ++i)
+        x[i] = t->mesh ? t->mesh->rest_x[i] : ((float) t->width) * i / (t->n_anchors-1);
+    SDL_UnlockMutex(t->lock);
+
+    return n;
+}
@@ -0,0 +1,48 @@
+/*
+    libtrampball.h
+
+    embedding API: independent simulation worlds behind opaque handles
+
+    Worlds share no state with each other, so any number of them may live
+    in one process and be stepped concurrently from different threads
+    (one thread per world at a time).
+
+    Balls and trampolines are numbered in the order the world keeps them,
+    which is the reverse of the order they appear in the world file.
+*/
+
+#ifndef TRAMPBALL_LIBTRAMPBALL_H
+#define TRAMPBALL_LIBTRAMPBALL_H
+
+#include <stddef.h>
+
+typedef struct world trampball_world;
+
+trampball_world *trampball_world_from_file(const char *const filename);
+trampball_world *trampball_world_from_buffer(const void *const buf, size_t len);
+void trampball_world_destroy(trampball_world *const w);
+
+void trampball_world_step(trampball_world *const w, int n_steps, float dt_ms);
+void trampball_world_set_gravity(trampball_world *const w, float x, float y);
+/* more settle piles of balls faster, and cost more; at least 1 */
+void trampball_world_set_solver_iterations(trampball_world *const w, int iterations);
+
+int trampball_world_ball_count(const trampball_world *const w);
+int trampball_world_trampoline_count(const trampball_world *const w);
+/* changes from step to step if the trampoline has REFINE levels */
+int trampball_world_trampoline_anchors(const trampball_world *const w, int idx);
+
+/* These copy x,y pairs into xy (room for max_items pairs) and return the
+   number of pairs written, or -1 if idx is out of range. */
+int trampball_world_get_ball_positions(const trampball_world *const w,
+                                       float *const xy, int max_items);
+int trampball_world_get_ball_speeds(const trampball_world *const w,
+                                    float *const xy, int max_items);
+int trampball_world_get_trampoline_offsets(const trampball_world *const w, int idx,
+                                           float *const xy, int max_items);
+/* where along the trampoline each anchor is at rest: what the offsets are
+   from (max_items of them into x). Evenly spaced, unless it has REFINE. */
+int trampball_world_get_trampoline_rest_x(const trampball_world *const w, int idx,
+                                          float *const x, int max_items);
+
+#endif /* TRAMPBALL_LIBTRAMPBALL_H */
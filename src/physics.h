@@ -12,14 +12,42 @@
  * unit for k: sec^-2
  */
 
+#include <math.h>
+#include "config.h"
+
+/*
+ * The simulation's scalar type, chosen at build time (PHYSICS_PRECISION):
+ * float, double, or float with double accumulators for the RK4 sums
+ * ("mixed"). vector2f keeps its name whatever it's made of.
+ */
+#ifdef PHYSICS_PRECISION_DOUBLE
+typedef double real;
+#  define REAL(c) c
+#  define real_sqrt sqrt
+#  define real_fabs fabs
+#  define real_ceil ceil
+#  define real_floor floor
+#else
+typedef float real;
+#  define REAL(c) c##f
+#  define real_sqrt sqrtf
+#  define real_fabs fabsf
+#  define real_ceil ceilf
+#  define real_floor floorf
+#endif
+
+#if defined(PHYSICS_PRECISION_DOUBLE) || defined(PHYSICS_PRECISION_MIXED)
+typedef double real_acc;
+#else
+typedef float real_acc;
+#endif
+
 typedef struct _vector2f {
-    float x, y;
+    real x, y;
 } vector2f;
 
 typedef struct _vector2i {
     int x, y;
 } vector2i;
 
-extern vector2f gravity_accel;
-
 #endif /* TRAMPBALL_PHYSICS_H */
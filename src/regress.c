@@ -0,0 +1,408 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <SDL.h>
+
+#include "game.h"
+#include "alloc.h"
+#include "libtrampball.h"
+#include "args.h"
+#include "tool.h"
+#include "config.h"
+
+#define MAX_REGRESS_WORLDS 16
+#define GENERATED_PREFIX "gen:"
+
+static const char *default_worlds[] = {
+    ASSET("corner-test.world"),
+    ASSET("multiball-test.world"),
+    ASSET("worldfile.txt"),
+    ASSET("refine-test.world"),
+    ASSET("bounce-test.world"),
+    GENERATED_PREFIX "1",
+    GENERATED_PREFIX "2",
+    GENERATED_PREFIX "3",
+    NULL
+};
+
+struct regress_params {
+    const char *dir;
+    int n_steps;
+    float interval_ms;
+    int every;          /* sample every this many steps */
+    double tolerance;   /* for positions, speeds and trampoline offsets */
+    double conserved_tolerance; /* for energy and momentum */
+};
+
+/*
+ * A sample is a flat list of numbers: energy, momentum x and y, then x, y,
+ * vx, vy of every ball, then the x, y offsets of every trampoline anchor.
+ */
+#define SAMPLE_HEADER 3
+
+struct sample {
+    int n;
+    int capacity;
+    double *v;
+};
+
+static void sample_push(struct sample *const s, double v)
+{
+    if (s->n == s->capacity) {
+        s->capacity = s->capacity ? 2 * s->capacity : 256;
+        s->v = realloc(s->v, s->capacity * sizeof(double));
+    }
+    s->v[s->n++] = v;
+}
+
+static void take_sample(const struct world *const w, struct sample *const s)
+{
+    struct ball_list *bl;
+    struct trampoline_list *tl;
+    double px, py;
+
+    s->n = 0;
+    world_momentum(w, &px, &py);
+    sample_push(s, world_energy(w));
+    sample_push(s, px);
+    sample_push(s, py);
+
+    for (bl = w->balls; bl; bl = bl->next) {
+        sample_push(s, bl->b->position.x);
+        sample_push(s, bl->b->position.y);
+        sample_push(s, bl->b->speed.x);
+        sample_push(s, bl->b->speed.y);
+    }
+    for (tl = w->trampolines; tl; tl = tl->next) {
+        for (int i=0; i<tl->t->n_anchors; ++i) {
+            sample_push(s, tl->t->offsets[i].x);
+            sample_push(s, tl->t->offsets[i].y);
+        }
+    }
+}
+
+/* what number idx of a sample of w is, for error messages */
+static void describe_value(const struct world *const w, int idx,
+                           char *const buf, size_t size)
+{
+    static const char *header[] = { "energy", "momentum x", "momentum y" };
+    static const char *ball_values[] = { "x", "y", "vx", "vy" };
+    struct ball_list *bl;
+    struct trampoline_list *tl;
+    int n;
+
+    if (idx < SAMPLE_HEADER) {
+        snprintf(buf, size, "%s", header[idx]);
+        return;
+    }
+    idx -= SAMPLE_HEADER;
+
+    for (n=0, bl = w->balls; bl; bl = bl->next, ++n) {
+        if (idx < 4) {
+            snprintf(buf, size, "ball %d %s", n, ball_values[idx]);
+            return;
+        }
+        idx -= 4;
+    }
+    for (n=0, tl = w->trampolines; tl; tl = tl->next, ++n) {
+        if (idx < 2 * tl->t->n_anchors) {
+            snprintf(buf, size, "trampoline %d anchor %d %s", n, idx / 2, (idx % 2) ? "y" : "x");
+            return;
+        }
+        idx -= 2 * tl->t->n_anchors;
+    }
+    snprintf(buf, size, "value %d", idx);
+}
+
+/*
+ * A random but reproducible world for the given seed: a few trampolines,
+ * balls dropping onto them, and some walls in the way.
+ */
+static char *generate_world(unsigned seed, size_t *const len)
+{
+    static const int anchor_counts[] = { 21, 33, 49 };
+    unsigned state = seed * 2654435761u + 1;
+    size_t size = 4096;
+    char *buf = malloc(size);
+    int n = 0, i;
+
+    int right = random_int(&state, 640, 1024);
+    int top = random_int(&state, 480, 800);
+
+    n += snprintf(buf + n, size - n, "STAGE %d 0 0 %d\n", top, right);
+    n += snprintf(buf + n, size - n, "GRAVITY 0 %d\n", -random_int(&state, 500, 900));
+
+    for (i = random_int(&state, 1, 3); i > 0; --i) {
+        int width = random_int(&state, 150, 300);
+        n += snprintf(buf + n, size - n, "TRAMPOLINE %d %d %d %d %d\n    K %d\n",
+                      anchor_counts[random_int(&state, 0, 2)],
+                      random_int(&state, 0, right - width),
+                      random_int(&state, 60, top / 2), width,
+                      random_int(&state, -100, 100),
+                      random_int(&state, 40000, 120000));
+    }
+    for (i = random_int(&state, 1, 4); i > 0; --i) {
+        n += snprintf(buf + n, size - n, "BALL %d %d\n    RADIUS %d\n    MASS %d\n",
+                      random_int(&state, 40, right - 40),
+                      random_int(&state, top / 2 + 40, top - 40),
+                      random_int(&state, 15, 35), random_int(&state, 50, 200));
+    }
+    for (i = random_int(&state, 0, 2); i > 0; --i) {
+        n += snprintf(buf + n, size - n, "WALL %d %d %d %d %d %d\n",
+                      random_int(&state, 0, right - 100), random_int(&state, 0, top - 100),
+                      random_int(&state, 20, 100), random_int(&state, -60, 60),
+                      random_int(&state, 5, 20), random_int(&state, -20, -5));
+    }
+
+    *len = n;
+    return buf;
+}
+
+static trampball_world *load_regress_world(const char *const name)
+{
+    if (strncmp(name, GENERATED_PREFIX, strlen(GENERATED_PREFIX)) == 0) {
+        size_t len;
+        char *buf = generate_world(strtoul(name + strlen(GENERATED_PREFIX), NULL, 10), &len);
+        trampball_world *w = trampball_world_from_buffer(buf, len);
+        free(buf);
+        return w;
+    } else {
+        return trampball_world_from_file(name);
+    }
+}
+
+/* dir/<world file name without directories>.golden */
+static void golden_path(const char *const dir, const char *const world,
+                        char *const buf, size_t size)
+{
+    const char *base = strrchr(world, '/');
+    base = base ? base + 1 : world;
+    snprintf(buf, size, "%s/%s.golden", dir, base);
+    for (char *p = buf + strlen(dir) + 1; *p; ++p)
+        if (*p == ':') *p = '-';
+}
+
+static bool record_world(const char *const world, const struct regress_params *const p)
+{
+    char path[1024];
+    struct sample s = { 0, 0, NULL };
+    FILE *fp;
+
+    trampball_world *w = load_regress_world(world);
+    if (w == NULL) {
+        fprintf(stderr, "%s: could not load world\n", world);
+        return false;
+    }
+
+    golden_path(p->dir, world, path, sizeof(path));
+    if ((fp = fopen(path, "w")) == NULL) {
+        perror(path);
+        trampball_world_destroy(w);
+        return false;
+    }
+
+    fprintf(fp, "trampball-regress %d %g %d %s\n", p->n_steps, p->interval_ms, p->every,
+            PHYSICS_PRECISION_NAME);
+
+    for (int step=0; step<=p->n_steps; ++step) {
+        if (step % p->every == 0 || step == p->n_steps) {
+            take_sample(w, &s);
+            fprintf(fp, "%d %d", step, s.n);
+            for (int i=0; i<s.n; ++i)
+                fprintf(fp, " %.17g", s.v[i]);
+            fputc('\n', fp);
+        }
+        if (step < p->n_steps) game_iteration(w, p->interval_ms);
+    }
+
+    fclose(fp);
+    free(s.v);
+    trampball_world_destroy(w);
+    printf("recorded %s -> %s\n", world, path);
+    return true;
+}
+
+static bool check_world(const char *const world, const struct regress_params *const p)
+{
+    char path[1024], what[64], precision[16];
+    struct sample s = { 0, 0, NULL };
+    int n_steps, every, step, n, i;
+    float interval_ms;
+    double max_dev = 0, max_conserved_dev = 0;
+    uint64_t allocs = 0, allocs0;
+    bool ok = true;
+    FILE *fp;
+
+    golden_path(p->dir, world, path, sizeof(path));
+    if ((fp = fopen(path, "r")) == NULL) {
+        perror(path);
+        return false;
+    }
+    if (fscanf(fp, "trampball-regress %d %g %d %15s", &n_steps, &interval_ms, &every,
+               precision) != 4) {
+        fprintf(stderr, "%s: not a golden file\n", path);
+        fclose(fp);
+        return false;
+    }
+    if (strcmp(precision, PHYSICS_PRECISION_NAME) != 0) {
+        fprintf(stderr, "%s: warning: recorded with %s precision, this is a %s build\n",
+                path, precision, PHYSICS_PRECISION_NAME);
+    }
+
+    trampball_world *w = load_regress_world(world);
+    if (w == NULL) {
+        fprintf(stderr, "%s: could not load world\n", world);
+        fclose(fp);
+        return false;
+    }
+
+    Uint64 t0 = SDL_GetPerformanceCounter();
+
+    // keep going after the first failure, so that the maximum deviations
+    // cover the whole run
+    for (step=0; step<=n_steps; ++step) {
+        if (step % every == 0 || step == n_steps) {
+            int golden_step;
+            take_sample(w, &s);
+
+            if (fscanf(fp, "%d %d", &golden_step, &n) != 2 || golden_step != step) {
+                fprintf(stderr, "%s: %s is truncated at step %d\n", world, path, step);
+                ok = false;
+                break;
+            }
+            if (n != s.n) {
+                fprintf(stderr, "%s: step %d: expected %d values, got %d "
+                                "(has the world changed?)\n", world, step, n, s.n);
+                ok = false;
+                break;
+            }
+
+            for (i=0; i<n; ++i) {
+                double want;
+                if (fscanf(fp, "%lf", &want) != 1) {
+                    fprintf(stderr, "%s: %s is truncated at step %d\n", world, path, step);
+                    ok = false;
+                    goto done;
+                }
+
+                // relative for large values, absolute for small ones
+                double dev = fabs(s.v[i] - want) / (1 + fabs(want));
+                bool conserved = (i < SAMPLE_HEADER);
+                if (conserved && dev > max_conserved_dev) max_conserved_dev = dev;
+                if (!conserved && dev > max_dev) max_dev = dev;
+
+                if (ok && dev > (conserved ? p->conserved_tolerance : p->tolerance)) {
+                    describe_value(w, i, what, sizeof(what));
+                    fprintf(stderr, "%s: step %d: %s is %.9g, expected %.9g\n",
+                            world, step, what, s.v[i], want);
+                    ok = false;
+                }
+            }
+        }
+        if (step < n_steps) {
+            // once it's loaded, stepping a world shouldn't touch the heap
+            allocs0 = alloc_calls_total();
+            game_iteration(w, interval_ms);
+            allocs += alloc_calls_total() - allocs0;
+        }
+    }
+
+done:;
+    if (allocs > 0) {
+        fprintf(stderr, "%s: %llu heap allocations while stepping\n",
+                world, (unsigned long long) allocs);
+        ok = false;
+    }
+    double elapsed = ((double)(SDL_GetPerformanceCounter() - t0)) / SDL_GetPerformanceFrequency();
+    printf("%-4s %s (%d steps, %.2f s; max deviation %.2e, energy/momentum %.2e)\n",
+           ok ? "ok" : "FAIL", world, n_steps, elapsed, max_dev, max_conserved_dev);
+
+    fclose(fp);
+    free(s.v);
+    trampball_world_destroy(w);
+    return ok;
+}
+
+int regress_main(int argc, char *argv[])
+{
+    char *flags[] = { "help", NULL };
+    char *opts[] = { "dir", "steps", "interval", "every", "tolerance", "energytol", NULL };
+    bool flag_states[1];
+    char *opt_vals[6];
+    char *args[MAX_REGRESS_WORLDS + 2];
+    const char *const *worlds = (const char *const *) &args[1];
+    struct regress_params params = { "goldens", 500, 10, 10, 1e-3, 1e-4 };
+    char *endp;
+    bool record;
+
+    int n_args = parse_args(argc, argv, flags, opts, MAX_REGRESS_WORLDS + 1,
+                            flag_states, opt_vals, args);
+
+    if (n_args < 1 || flag_states[0] ||
+        (strcmp(args[0], "record") != 0 && strcmp(args[0], "check") != 0)) {
+        fprintf(stderr, "trampball-tool regress - compare physics trajectories against goldens\n"
+                        "\n"
+                        "  Usage: trampball-tool regress record [-dir goldens] [-steps 500]\n"
+                        "         [-interval 10] [-every 10] [world.txt ...]\n"
+                        "     or: trampball-tool regress check [-dir goldens] [-tolerance 1e-3]\n"
+                        "         [-energytol 1e-4] [world.txt ...]\n"
+                        "\n"
+                        "  Without any world files, the bundled worlds and a few generated ones\n"
+                        "  (gen:SEED) are used. Record the goldens with a known good build,\n"
+                        "  then check every change against them. Values are compared as\n"
+                        "  |got - expected| / (1 + |expected|). Checking also fails if\n"
+                        "  stepping a world allocates from the heap.\n");
+        return flag_states[0] ? 0 : 2;
+    }
+    record = (strcmp(args[0], "record") == 0);
+
+    if (n_args == 1) worlds = default_worlds;
+    else args[n_args] = NULL;
+
+    if (opt_vals[0] != NULL) params.dir = opt_vals[0];
+    if (opt_vals[1] != NULL) {
+        params.n_steps = strtol(opt_vals[1], &endp, 10);
+        if (*opt_vals[1] == '\0' || *endp != '\0' || params.n_steps < 1) {
+            fprintf(stderr, "not a positive integer: %s\n", opt_vals[1]);
+            return 2;
+        }
+    }
+    if (opt_vals[2] != NULL) {
+        params.interval_ms = strtod(opt_vals[2], &endp);
+        if (*opt_vals[2] == '\0' || *endp != '\0' || params.interval_ms <= 0) {
+            fprintf(stderr, "not a positive number: %s\n", opt_vals[2]);
+            return 2;
+        }
+    }
+    if (opt_vals[3] != NULL) {
+        params.every = strtol(opt_vals[3], &endp, 10);
+        if (*opt_vals[3] == '\0' || *endp != '\0' || params.every < 1) {
+            fprintf(stderr, "not a positive integer: %s\n", opt_vals[3]);
+            return 2;
+        }
+    }
+    if (opt_vals[4] != NULL) {
+        params.tolerance = strtod(opt_vals[4], &endp);
+        if (*opt_vals[4] == '\0' || *endp != '\0' || params.tolerance < 0) {
+            fprintf(stderr, "not a valid tolerance: %s\n", opt_vals[4]);
+            return 2;
+        }
+    }
+    if (opt_vals[5] != NULL) {
+        params.conserved_tolerance = strtod(opt_vals[5], &endp);
+        if (*opt_vals[5] == '\0' || *endp != '\0' || params.conserved_tolerance < 0) {
+            fprintf(stderr, "not a valid tolerance: %s\n", opt_vals[5]);
+            return 2;
+        }
+    }
+
+    int failed = 0;
+    for (int i=0; worlds[i] != NULL; ++i) {
+        if (!(record ? record_world(worlds[i], &params) : check_world(worlds[i], &params)))
+            ++failed;
+    }
+
+    if (failed) fprintf(stderr, "%d of the worlds failed\n", failed);
+    return failed ? 1 : 0;
+}
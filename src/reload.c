@@ -0,0 +1,309 @@
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#  include <unistd.h>
+#  include <sys/inotify.h>
+#endif
+#include <SDL.h>
+
+#include "reload.h"
+#include "alloc.h"
+
+/* a world's objects, in the order the world file lists them */
+struct object_table {
+    trampoline **t;
+    ball **b;
+    wall **w;
+    int n_t, n_b, n_w;
+};
+
+struct world_reloader {
+    struct world *world;
+    char *filename;
+    struct world *last_parse;   /* what the file said last time */
+    struct object_table live;   /* what we made of it */
+#ifdef __linux__
+    int inotify_fd;
+    const char *basename;
+#else
+    time_t mtime;
+    Uint32 last_poll;
+#endif
+};
+
+static void build_object_table(const struct world *const world, struct object_table *const tab)
+{
+    struct trampoline_list *tl;
+    struct ball_list *bl;
+    struct wall_list *wl;
+    int i;
+
+    // the lists are in reverse file order
+    for (tab->n_t = 0, tl = world->trampolines; tl; tl = tl->next) tab->n_t++;
+    tab->t = TB_MALLOC(ALLOC_STREAM, (tab->n_t + 1) * sizeof(trampoline *));
+    for (i = tab->n_t, tl = world->trampolines; tl; tl = tl->next) tab->t[--i] = tl->t;
+
+    for (tab->n_b = 0, bl = world->balls; bl; bl = bl->next) tab->n_b++;
+    tab->b = TB_MALLOC(ALLOC_STREAM, (tab->n_b + 1) * sizeof(ball *));
+    for (i = tab->n_b, bl = world->balls; bl; bl = bl->next) tab->b[--i] = bl->b;
+
+    for (tab->n_w = 0, wl = world->walls; wl; wl = wl->next) tab->n_w++;
+    tab->w = TB_MALLOC(ALLOC_STREAM, (tab->n_w + 1) * sizeof(wall *));
+    for (i = tab->n_w, wl = world->walls; wl; wl = wl->next) tab->w[--i] = wl->w;
+}
+
+static void free_object_table(struct object_table *const tab)
+{
+    TB_FREE(tab->t);
+    TB_FREE(tab->b);
+    TB_FREE(tab->w);
+}
+
+struct world_reloader *new_world_reloader(struct world *const world,
+                                          const char *const filename)
+{
+    struct world_reloader *r = TB_MALLOC(ALLOC_STREAM, sizeof(struct world_reloader));
+
+    r->world = world;
+    r->filename = TB_MALLOC(ALLOC_STREAM, strlen(filename) + 1);
+    strcpy(r->filename, filename);
+
+    r->last_parse = new_world();
+    if (!init_game(r->last_parse, filename)) {
+        free_world(r->last_parse);
+        TB_FREE(r->filename);
+        TB_FREE(r);
+        return NULL;
+    }
+    build_object_table(world, &r->live);
+
+#ifdef __linux__
+    // Watch the directory rather than the file: a lot of editors save by
+    // writing a new file and renaming it over the old one.
+    char *slash = strrchr(r->filename, '/');
+    char *dir = slash ? r->filename : ".";
+    r->basename = slash ? slash + 1 : r->filename;
+    if (slash) *slash = '\0';
+
+    if ((r->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0 ||
+        inotify_add_watch(r->inotify_fd, (slash == r->filename) ? "/" : dir,
+                          IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        perror("Error watching world file");
+        if (slash) *slash = '/';
+        if (r->inotify_fd >= 0) close(r->inotify_fd);
+        r->inotify_fd = -1;
+        free_world_reloader(r);
+        return NULL;
+    }
+    if (slash) *slash = '/';
+#else
+    struct stat st;
+    r->mtime = (stat(filename, &st) == 0) ? st.st_mtime : 0;
+    r->last_poll = SDL_GetTicks();
+#endif
+
+    return r;
+}
+
+void free_world_reloader(struct world_reloader *const r)
+{
+#ifdef __linux__
+    if (r->inotify_fd >= 0) close(r->inotify_fd);
+#endif
+    free_object_table(&r->live);
+    free_world(r->last_parse);
+    TB_FREE(r->filename);
+    TB_FREE(r);
+}
+
+bool world_file_changed(struct world_reloader *const r)
+{
+#ifdef __linux__
+    union {
+        struct inotify_event ev;
+        char buf[4096];
+    } events;
+    const struct inotify_event *ev;
+    bool changed = false;
+    ssize_t len;
+    char *p;
+
+    while ((len = read(r->inotify_fd, events.buf, sizeof(events.buf))) > 0) {
+        for (p = events.buf; p < events.buf + len; p += sizeof(struct inotify_event) + ev->len) {
+            ev = (const struct inotify_event *) p;
+            if (ev->len && strcmp(ev->name, r->basename) == 0)
+                changed = true;
+        }
+    }
+
+    return changed;
+#else
+    struct stat st;
+    Uint32 now = SDL_GetTicks();
+
+    if (now - r->last_poll < RELOAD_POLL_INTERVAL_MS) return false;
+    r->last_poll = now;
+
+    if (stat(r->filename, &st) != 0 || st.st_mtime == r->mtime) return false;
+    r->mtime = st.st_mtime;
+    return true;
+#endif
+}
+
+/* a fresh trampoline (at rest) with the same specification */
+static trampoline *copy_trampoline(const trampoline *const spec)
+{
+    trampoline *t = new_trampoline(spec->n_anchors);
+    t->x = spec->x;
+    t->y = spec->y;
+    t->width = spec->width;
+    t->k = spec->k;
+    t->damping = spec->damping;
+    t->density = spec->density;
+    if (spec->height != 0)
+        set_trampoline_height(t, spec->height);
+    if (spec->mesh != NULL)
+        set_trampoline_refinement(t, spec->mesh->levels);
+    return t;
+}
+
+static ball *copy_ball(const ball *const spec)
+{
+    ball *b = new_ball();
+    b->position = spec->position;
+    b->radius = spec->radius;
+    b->mass = spec->mass;
+    b->bounce = spec->bounce;
+    return b;
+}
+
+static void apply_trampolines(struct world_reloader *const r, const struct object_table *const old,
+                              const struct object_table *const new)
+{
+    struct object_table *live = &r->live;
+    int i;
+
+    for (i=0; i<old->n_t && i<new->n_t; ++i) {
+        const trampoline *o = old->t[i], *n = new->t[i];
+        if (o->n_anchors != n->n_anchors || o->x != n->x || o->y != n->y ||
+            o->width != n->width || o->height != n->height ||
+            (o->mesh ? o->mesh->levels : -1) != (n->mesh ? n->mesh->levels : -1)) {
+            // a different trampoline altogether
+            remove_trampoline(r->world, live->t[i]);
+            discard_trampoline(r->world, live->t[i]);
+            live->t[i] = copy_trampoline(n);
+            add_trampoline(r->world, live->t[i]);
+        } else if (o->k != n->k || o->damping != n->damping || o->density != n->density) {
+            live->t[i]->k = n->k;
+            live->t[i]->damping = n->damping;
+            live->t[i]->density = n->density;
+        }
+    }
+    for (; i<old->n_t; ++i) {
+        remove_trampoline(r->world, live->t[i]);
+        discard_trampoline(r->world, live->t[i]);
+    }
+
+    live->t = TB_REALLOC(ALLOC_STREAM, live->t, (new->n_t + 1) * sizeof(trampoline *));
+    for (i=old->n_t; i<new->n_t; ++i) {
+        live->t[i] = copy_trampoline(new->t[i]);
+        add_trampoline(r->world, live->t[i]);
+    }
+    live->n_t = new->n_t;
+}
+
+static void apply_balls(struct world_reloader *const r, const struct object_table *const old,
+                        const struct object_table *const new)
+{
+    struct object_table *live = &r->live;
+    int i;
+
+    for (i=0; i<old->n_b && i<new->n_b; ++i) {
+        const ball *o = old->b[i], *n = new->b[i];
+        ball *b = live->b[i];
+
+        SDL_LockMutex(b->lock);
+        if (o->position.x != n->position.x || o->position.y != n->position.y) {
+            // it's been moved: start over from there
+            b->position = n->position;
+            b->speed = (vector2f) {0, 0};
+        }
+        b->radius = n->radius;
+        b->mass = n->mass;
+        b->bounce = n->bounce;
+        SDL_UnlockMutex(b->lock);
+    }
+    for (; i<old->n_b; ++i) {
+        remove_ball(r->world, live->b[i]);
+        discard_ball(r->world, live->b[i]);
+    }
+
+    live->b = TB_REALLOC(ALLOC_STREAM, live->b, (new->n_b + 1) * sizeof(ball *));
+    for (i=old->n_b; i<new->n_b; ++i) {
+        live->b[i] = copy_ball(new->b[i]);
+        add_ball(r->world, live->b[i]);
+    }
+    live->n_b = new->n_b;
+}
+
+static void apply_walls(struct world_reloader *const r, const struct object_table *const old,
+                        const struct object_table *const new)
+{
+    struct object_table *live = &r->live;
+    int i;
+
+    // walls don't move, so there's nothing to preserve
+    for (i=0; i<old->n_w && i<new->n_w; ++i)
+        *live->w[i] = *new->w[i];
+    for (; i<old->n_w; ++i) {
+        remove_wall(r->world, live->w[i]);
+        discard_wall(r->world, live->w[i]);
+    }
+
+    live->w = TB_REALLOC(ALLOC_STREAM, live->w, (new->n_w + 1) * sizeof(wall *));
+    for (i=old->n_w; i<new->n_w; ++i) {
+        live->w[i] = new_wall();
+        *live->w[i] = *new->w[i];
+        add_wall(r->world, live->w[i]);
+    }
+    live->n_w = new->n_w;
+}
+
+bool reload_world(struct world_reloader *const r, SDL_mutex *const lock)
+{
+    struct object_table old, new;
+    struct world *parsed = new_world();
+
+    if (!init_game(parsed, r->filename)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Not reloading %s: it doesn't parse\n", r->filename);
+        free_world(parsed);
+        return false;
+    }
+
+    build_object_table(r->last_parse, &old);
+    build_object_table(parsed, &new);
+
+    SDL_LockMutex(lock);
+
+    if (memcmp(&r->last_parse->game_stage, &parsed->game_stage, sizeof(stage)) != 0)
+        r->world->game_stage = parsed->game_stage;
+    if (r->last_parse->gravity.x != parsed->gravity.x ||
+        r->last_parse->gravity.y != parsed->gravity.y)
+        r->world->gravity = parsed->gravity;
+
+    apply_trampolines(r, &old, &new);
+    apply_balls(r, &old, &new);
+    apply_walls(r, &old, &new);
+
+    SDL_UnlockMutex(lock);
+
+    free_object_table(&old);
+    free_object_table(&new);
+    free_world(r->last_parse);
+    r->last_parse = parsed;
+
+    SDL_Log("Reloaded %s\n", r->filename);
+    return true;
+}
@@ -0,0 +1,40 @@
+/*
+    reload.h
+
+    watch the world file, and patch changes into the running world
+*/
+
+#ifndef TRAMPBALL_RELOAD_H
+#define TRAMPBALL_RELOAD_H
+
+#include <stdbool.h>
+#include <SDL.h>
+
+#include "game.h"
+
+/* on systems without inotify, check the file's mtime this often */
+#define RELOAD_POLL_INTERVAL_MS 500
+
+struct world_reloader;
+
+/* world must be freshly loaded from filename: objects are matched up
+   with the file by their order in it */
+struct world_reloader *new_world_reloader(struct world *const world,
+                                          const char *const filename);
+void free_world_reloader(struct world_reloader *const r);
+
+/* doesn't block; true if the file has been written to since the last call */
+bool world_file_changed(struct world_reloader *const r);
+
+/*
+ * Re-parse the file, compare it with what it said last time, and apply
+ * the differences to the world. Objects the file says the same about are
+ * left alone, so they keep their motion; if only the parameters of a
+ * trampoline or ball change, so do they.
+ *
+ * The file is parsed first, then lock is held while the world changes.
+ * If the file doesn't parse, nothing happens and false is returned.
+ */
+bool reload_world(struct world_reloader *const r, SDL_mutex *const lock);
+
+#endif /* TRAMPBALL_RELOAD_H */
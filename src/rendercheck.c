@@ -0,0 +1,390 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <SDL.h>
+
+#include "game.h"
+#include "alloc.h"
+#include "args.h"
+#include "trampball.h"
+#include "config.h"
+
+#define MAX_RENDER_WORLDS 16
+#define RENDER_INTERVAL_MS 10
+
+static const char *default_worlds[] = {
+    ASSET("corner-test.world"),
+    ASSET("multiball-test.world"),
+    ASSET("worldfile.txt"),
+    ASSET("refine-test.world"),
+    NULL
+};
+
+/* a frame is drawn in these parts, in this order */
+enum render_part {
+    PART_EDGES,
+    PART_TRAMPOLINES,
+    PART_BALLS,
+    PART_WALLS,
+    PART_TEXT,
+    PART_GRAVITY,
+    N_RENDER_PARTS
+};
+
+static const char *const part_names[N_RENDER_PARTS] = {
+    "edges", "trampolines", "balls", "walls", "text", "gravity"
+};
+
+/* every glyph the HUD is likely to use */
+static const char *const hud_text[] = {
+    "0123456789 .,:;/%()[]+-=<>_ x",
+    "abcdefghijklmnopqrstuvwxyz",
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZ",
+};
+#define N_HUD_TEXT_LINES ((int)(sizeof(hud_text)/sizeof(hud_text[0])))
+
+struct render_params {
+    const char *dir;
+    int n_steps;        /* stepped before the frame is drawn */
+    int tolerance;      /* per colour channel */
+    int max_pixels;     /* allowed to be further off than that */
+    int reps;           /* bench: draws of each part */
+};
+
+/* the world, some way into the simulation, as the game's current world */
+static struct world *load_world(const char *const filename, int n_steps)
+{
+    struct world *w = new_world();
+
+    if (!init_game(w, filename)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Error loading %s\n", filename);
+        free_world(w);
+        return NULL;
+    }
+    for (int i=0; i<n_steps; ++i)
+        game_iteration(w, RENDER_INTERVAL_MS);
+
+    game_world = w;
+    if (w->balls != NULL)
+        center_ball(w->balls->b);
+    else
+        origin = (SDL_Point) { 0, WINDOW_HEIGHT };
+    return w;
+}
+
+static void unload_world(struct world *const w)
+{
+    free_world(w);
+    game_world = NULL;
+}
+
+/* returns the number of objects drawn */
+static int draw_part(const struct world *const w, enum render_part part)
+{
+    struct trampoline_list *tl;
+    struct ball_list *bl;
+    struct wall_list *wl;
+    int n = 0;
+
+    switch (part) {
+    case PART_EDGES:
+        draw_edges(&w->game_stage);
+        return 1;
+    case PART_TRAMPOLINES:
+        for (tl = w->trampolines; tl; tl = tl->next, ++n)
+            draw_trampoline(tl->t);
+        return n;
+    case PART_BALLS:
+        for (bl = w->balls; bl; bl = bl->next, ++n)
+            draw_ball(bl->b);
+        return n;
+    case PART_WALLS:
+        for (wl = w->walls; wl; wl = wl->next, ++n)
+            draw_wall(wl->w);
+        return n;
+    case PART_TEXT:
+        for (n=0; n<N_HUD_TEXT_LINES; ++n)
+            draw_hud_line(hud_text[n], n);
+        return n;
+    case PART_GRAVITY:
+    default:
+        draw_gravity();
+        return 1;
+    }
+}
+
+static void draw_frame(const struct world *const w)
+{
+    clear_frame();
+    for (int part=0; part<N_RENDER_PARTS; ++part)
+        draw_part(w, part);
+}
+
+/* the offscreen surface as packed RGB */
+static uint8_t *grab_frame()
+{
+    const SDL_Surface *s = get_offscreen_surface();
+    uint8_t *rgb = TB_MALLOC(ALLOC_RENDER, 3 * (size_t) s->w * s->h);
+
+    for (int y=0; y<s->h; ++y) {
+        const uint32_t *src = (const uint32_t *) ((const uint8_t *) s->pixels + y * s->pitch);
+        uint8_t *dst = rgb + 3 * (size_t) s->w * y;
+        for (int x=0; x<s->w; ++x) {
+            dst[3*x] = src[x] >> 16;
+            dst[3*x + 1] = src[x] >> 8;
+            dst[3*x + 2] = src[x];
+        }
+    }
+    return rgb;
+}
+
+static void golden_path(const char *const dir, const char *const world, const char *const suffix,
+                        char *const buf, size_t size)
+{
+    const char *base = strrchr(world, '/');
+    base = base ? base + 1 : world;
+    snprintf(buf, size, "%s/%s%s", dir, base, suffix);
+}
+
+static bool write_ppm(const char *const filename, const uint8_t *const rgb, int w, int h)
+{
+    FILE *fp;
+    bool ok;
+
+    if ((fp = fopen(filename, "wb")) == NULL) {
+        perror(filename);
+        return false;
+    }
+    ok = fprintf(fp, "P6\n%d %d\n255\n", w, h) > 0 &&
+         fwrite(rgb, 3, (size_t) w * h, fp) == (size_t) w * h;
+    if (fclose(fp) != 0) ok = false;
+    if (!ok) perror(filename);
+    return ok;
+}
+
+static uint8_t *read_ppm(const char *const filename, int *const w, int *const h)
+{
+    FILE *fp;
+    uint8_t *rgb;
+
+    if ((fp = fopen(filename, "rb")) == NULL) {
+        perror(filename);
+        return NULL;
+    }
+    if (fscanf(fp, "P6 %d %d 255", w, h) != 2 || fgetc(fp) == EOF || *w < 1 || *h < 1) {
+        fprintf(stderr, "%s: not a PPM file this tool wrote\n", filename);
+        fclose(fp);
+        return NULL;
+    }
+    rgb = TB_MALLOC(ALLOC_RENDER, 3 * (size_t) *w * *h);
+    if (fread(rgb, 3, (size_t) *w * *h, fp) != (size_t) *w * *h) {
+        fprintf(stderr, "%s: truncated\n", filename);
+        TB_FREE(rgb);
+        rgb = NULL;
+    }
+    fclose(fp);
+    return rgb;
+}
+
+static bool record_world(const char *const world, const struct render_params *const p)
+{
+    char path[4096];
+    struct world *w;
+    uint8_t *rgb;
+    bool ok;
+
+    if ((w = load_world(world, p->n_steps)) == NULL) return false;
+    draw_frame(w);
+    rgb = grab_frame();
+
+    golden_path(p->dir, world, ".ppm", path, sizeof(path));
+    ok = write_ppm(path, rgb, WINDOW_WIDTH, WINDOW_HEIGHT);
+    if (ok) printf("recorded %s\n", path);
+
+    TB_FREE(rgb);
+    unload_world(w);
+    return ok;
+}
+
+/*
+ * Differing pixels come out white in the diff image, the rest as a dim
+ * copy of the expected frame, so it's easy to see what moved.
+ */
+static bool check_world(const char *const world, const struct render_params *const p)
+{
+    char path[4096];
+    struct world *w;
+    uint8_t *got, *expected;
+    int gw, gh, bad_pixels = 0, max_off = 0;
+    uint64_t allocs0;
+    bool ok = true;
+
+    golden_path(p->dir, world, ".ppm", path, sizeof(path));
+    if ((expected = read_ppm(path, &gw, &gh)) == NULL) return false;
+    if (gw != WINDOW_WIDTH || gh != WINDOW_HEIGHT) {
+        fprintf(stderr, "%s: golden is %dx%d, rendering at %dx%d\n", world, gw, gh,
+                WINDOW_WIDTH, WINDOW_HEIGHT);
+        TB_FREE(expected);
+        return false;
+    }
+
+    if ((w = load_world(world, p->n_steps)) == NULL) {
+        TB_FREE(expected);
+        return false;
+    }
+
+    // the first frame may grow buffers; after that, drawing shouldn't
+    // touch the heap
+    draw_frame(w);
+    allocs0 = alloc_calls_total();
+    draw_frame(w);
+    uint64_t allocs = alloc_calls_total() - allocs0;
+    if (allocs > 0) {
+        fprintf(stderr, "%s: %llu heap allocations while drawing\n", world,
+                (unsigned long long) allocs);
+        ok = false;
+    }
+
+    got = grab_frame();
+    for (int i=0; i<gw * gh; ++i) {
+        int off = 0;
+        for (int c=0; c<3; ++c) {
+            int d = abs(got[3*i + c] - expected[3*i + c]);
+            if (d > off) off = d;
+        }
+        if (off > max_off) max_off = off;
+        if (off > p->tolerance) {
+            ++bad_pixels;
+            got[3*i] = got[3*i + 1] = got[3*i + 2] = 255;
+        } else {
+            for (int c=0; c<3; ++c) got[3*i + c] = expected[3*i + c] / 4;
+        }
+    }
+    if (bad_pixels > p->max_pixels) {
+        ok = false;
+        golden_path(p->dir, world, ".diff.ppm", path, sizeof(path));
+        if (write_ppm(path, got, gw, gh))
+            fprintf(stderr, "%s: see %s\n", world, path);
+    }
+
+    printf("%-4s %s (%d pixels off, by up to %d)\n", ok ? "ok" : "FAIL", world, bad_pixels,
+           max_off);
+
+    TB_FREE(got);
+    TB_FREE(expected);
+    unload_world(w);
+    return ok;
+}
+
+static bool bench_world(const char *const world, const struct render_params *const p)
+{
+    Uint64 freq = SDL_GetPerformanceFrequency();
+    struct world *w;
+
+    if ((w = load_world(world, p->n_steps)) == NULL) return false;
+    draw_frame(w);
+
+    for (int part=0; part<N_RENDER_PARTS; ++part) {
+        uint64_t allocs0 = alloc_calls_total();
+        Uint64 t0 = SDL_GetPerformanceCounter();
+        int n = 0;
+        for (int i=0; i<p->reps; ++i)
+            n = draw_part(w, part);
+        double us = (double) (SDL_GetPerformanceCounter() - t0) * 1e6 / freq / p->reps;
+
+        printf("%s,%s,%d,%d,%.3f,%.3f,%llu\n", world, part_names[part], n, p->reps, us,
+               n > 0 ? us / n : 0, (unsigned long long) (alloc_calls_total() - allocs0));
+    }
+
+    unload_world(w);
+    return true;
+}
+
+int render_main(int argc, char *argv[])
+{
+    char *flags[] = { "help", NULL };
+    char *opts[] = { "dir", "steps", "tolerance", "maxpixels", "reps", NULL };
+    bool flag_states[1];
+    char *opt_vals[5];
+    char *args[MAX_RENDER_WORLDS + 2];
+    const char *const *worlds = (const char *const *) &args[1];
+    struct render_params params = { "render-goldens", 200, 0, 0, 1000 };
+    bool (*run)(const char *const, const struct render_params *const);
+    char *endp;
+
+    int n_args = parse_args(argc, argv, flags, opts, MAX_RENDER_WORLDS + 1,
+                            flag_states, opt_vals, args);
+
+    if (n_args < 1 || flag_states[0] ||
+        (strcmp(args[0], "record") != 0 && strcmp(args[0], "check") != 0 &&
+         strcmp(args[0], "bench") != 0)) {
+        fprintf(stderr, "trampball render - check and time the drawing code, headless\n"
+                        "\n"
+                        "  Usage: trampball render record [-dir render-goldens] [-steps 200]\n"
+                        "         [world.txt ...]\n"
+                        "     or: trampball render check [-dir render-goldens] [-steps 200]\n"
+                        "         [-tolerance 0] [-maxpixels 0] [world.txt ...]\n"
+                        "     or: trampball render bench [-steps 200] [-reps 1000] [world.txt ...]\n"
+                        "\n"
+                        "  Each world is stepped, then drawn offscreen at the default window\n"
+                        "  size with the software renderer, along with some HUD text. record\n"
+                        "  saves the frames as PPM files; check compares against them, writes\n"
+                        "  a .diff.ppm for any that differ, and fails if drawing a frame\n"
+                        "  allocates from the heap. bench prints CSV: how long each part of\n"
+                        "  the frame takes to draw. Without any world files, the bundled\n"
+                        "  worlds are used.\n");
+        return flag_states[0] ? 0 : 2;
+    }
+    run = (strcmp(args[0], "record") == 0) ? record_world :
+          (strcmp(args[0], "check") == 0) ? check_world : bench_world;
+
+    if (n_args == 1) worlds = default_worlds;
+    else args[n_args] = NULL;
+
+    if (opt_vals[0] != NULL) params.dir = opt_vals[0];
+    if (opt_vals[1] != NULL) {
+        params.n_steps = strtol(opt_vals[1], &endp, 10);
+        if (*opt_vals[1] == '\0' || *endp != '\0' || params.n_steps < 0) {
+            fprintf(stderr, "not a valid step count: %s\n", opt_vals[1]);
+            return 2;
+        }
+    }
+    if (opt_vals[2] != NULL) {
+        params.tolerance = strtol(opt_vals[2], &endp, 10);
+        if (*opt_vals[2] == '\0' || *endp != '\0' || params.tolerance < 0) {
+            fprintf(stderr, "not a valid tolerance: %s\n", opt_vals[2]);
+            return 2;
+        }
+    }
+    if (opt_vals[3] != NULL) {
+        params.max_pixels = strtol(opt_vals[3], &endp, 10);
+        if (*opt_vals[3] == '\0' || *endp != '\0' || params.max_pixels < 0) {
+            fprintf(stderr, "not a valid pixel count: %s\n", opt_vals[3]);
+            return 2;
+        }
+    }
+    if (opt_vals[4] != NULL) {
+        params.reps = strtol(opt_vals[4], &endp, 10);
+        if (*opt_vals[4] == '\0' || *endp != '\0' || params.reps < 1) {
+            fprintf(stderr, "not a positive integer: %s\n", opt_vals[4]);
+            return 2;
+        }
+    }
+
+    if (init_sdl(false, true) != 0) return 1;
+
+    if (run == bench_world)
+        printf("world,part,objects,reps,us_per_draw,us_per_object,allocs\n");
+
+    int failed = 0;
+    for (int i=0; worlds[i] != NULL; ++i) {
+        if (!run(worlds[i], &params))
+            ++failed;
+    }
+
+    cleanup();
+
+    if (failed) fprintf(stderr, "%d of the worlds failed\n", failed);
+    return failed ? 1 : 0;
+}
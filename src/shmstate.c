@@ -0,0 +1,342 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <SDL.h>
+
+#include "shmstate.h"
+#include "alloc.h"
+#include "config.h"
+
+#ifdef ENABLE_SHM_STATE
+#  include <fcntl.h>
+#  include <unistd.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#endif
+
+#define SHM_STATE_ALIGN 64
+
+struct state_publisher {
+    char *name;
+    struct shm_state_header *header;
+    size_t size;
+    uint32_t frames;            /* published so far; wraps */
+    uint64_t step;
+};
+
+struct state_reader {
+    const struct shm_state_header *header;
+    size_t size;
+    uint32_t last_frame;
+};
+
+static size_t align_up(size_t n)
+{
+    return (n + SHM_STATE_ALIGN - 1) / SHM_STATE_ALIGN * SHM_STATE_ALIGN;
+}
+
+/*
+ * The other side may be another process, so these stick to plain loads
+ * and stores and fences: a read-only mapping can't take the locked
+ * read-modify-write some SDL versions use for SDL_AtomicGet().
+ */
+static inline uint32_t load_acquire(const SDL_atomic_t *const a)
+{
+    uint32_t v = *(const volatile int *) &a->value;
+    SDL_MemoryBarrierAcquire();
+    return v;
+}
+
+static inline void store_release(SDL_atomic_t *const a, uint32_t v)
+{
+    SDL_MemoryBarrierRelease();
+    *(volatile int *) &a->value = (int) v;
+}
+
+static struct shm_state_frame *slot(const struct shm_state_header *const h, uint32_t frame_no)
+{
+    return (struct shm_state_frame *) ((char *) h + h->header_size +
+                                       (size_t) (frame_no % h->n_slots) * h->slot_size);
+}
+
+#ifdef ENABLE_SHM_STATE
+
+static void *map_shm(const char *const name, size_t *const size, bool create)
+{
+    int fd;
+    void *mem;
+    struct stat st;
+
+    if (create) {
+        // start from scratch, in case a reader still has an old one mapped
+        shm_unlink(name);
+        fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    } else {
+        fd = shm_open(name, O_RDONLY, 0);
+    }
+    if (fd < 0) {
+        perror(name);
+        return NULL;
+    }
+
+    if (create) {
+        if (ftruncate(fd, *size) != 0) {
+            perror(name);
+            close(fd);
+            shm_unlink(name);
+            return NULL;
+        }
+    } else {
+        if (fstat(fd, &st) != 0) {
+            perror(name);
+            close(fd);
+            return NULL;
+        }
+        *size = st.st_size;
+    }
+
+    mem = mmap(NULL, *size, create ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED) {
+        perror(name);
+        if (create) shm_unlink(name);
+        return NULL;
+    }
+    return mem;
+}
+
+static void unmap_shm(const void *const mem, size_t size)
+{
+    munmap((void *) mem, size);
+}
+
+static void unlink_shm(const char *const name)
+{
+    shm_unlink(name);
+}
+
+static uint32_t this_pid()
+{
+    return (uint32_t) getpid();
+}
+
+#else /* ! ENABLE_SHM_STATE */
+
+static void *map_shm(const char *const name, size_t *const size, bool create)
+{
+    (void) size;
+    (void) create;
+    SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                 "%s: built without shared memory support\n", name);
+    return NULL;
+}
+
+static void unmap_shm(const void *const mem, size_t size)
+{
+    (void) mem;
+    (void) size;
+}
+
+static void unlink_shm(const char *const name)
+{
+    (void) name;
+}
+
+static uint32_t this_pid()
+{
+    return 0;
+}
+
+#endif /* ENABLE_SHM_STATE */
+
+struct state_publisher *new_state_publisher(const char *const name,
+                                            const struct world *const world,
+                                            double interval_ms)
+{
+    struct state_publisher *p;
+    struct shm_state_header *h;
+    uint32_t n_balls = 0, n_trampolines = 0, n_anchors = 0;
+
+    for (const struct ball_list *bl = world->balls; bl; bl = bl->next)
+        ++n_balls;
+    for (const struct trampoline_list *tl = world->trampolines; tl; tl = tl->next) {
+        ++n_trampolines;
+        n_anchors += tl->t->max_anchors;
+    }
+
+    // room to grow, for reloading and streaming
+    n_balls = n_balls < 8 ? 16 : 2 * n_balls;
+    n_trampolines = n_trampolines < 2 ? 4 : 2 * n_trampolines;
+    n_anchors = n_anchors < 128 ? 256 : 2 * n_anchors;
+
+    size_t header_size = align_up(sizeof(struct shm_state_header));
+    size_t slot_size = align_up(sizeof(struct shm_state_frame) +
+                                n_balls * sizeof(struct shm_state_ball) +
+                                n_trampolines * sizeof(struct shm_state_trampoline) +
+                                n_anchors * 2 * sizeof(float));
+    size_t size = header_size + SHM_STATE_SLOTS * slot_size;
+
+    if ((h = map_shm(name, &size, true)) == NULL) return NULL;
+
+    // the new object is all zeroes: no frames yet, and every seq even
+    memcpy(h->magic, SHM_STATE_MAGIC, sizeof(SHM_STATE_MAGIC));
+    h->version = SHM_STATE_VERSION;
+    h->header_size = header_size;
+    h->n_slots = SHM_STATE_SLOTS;
+    h->slot_size = slot_size;
+    h->max_balls = n_balls;
+    h->max_trampolines = n_trampolines;
+    h->max_anchors = n_anchors;
+    h->interval_ms = interval_ms;
+    h->writer_pid = this_pid();
+
+    p = TB_CALLOC(ALLOC_OTHER, 1, sizeof(struct state_publisher));
+    p->name = TB_MALLOC(ALLOC_OTHER, strlen(name) + 1);
+    strcpy(p->name, name);
+    p->header = h;
+    p->size = size;
+    return p;
+}
+
+void free_state_publisher(struct state_publisher *const p)
+{
+    unlink_shm(p->name);
+    unmap_shm(p->header, p->size);
+    TB_FREE(p->name);
+    TB_FREE(p);
+}
+
+void publish_state(struct state_publisher *const p, const struct world *const world)
+{
+    const struct shm_state_header *h = p->header;
+    const uint32_t f = p->frames;
+    struct shm_state_frame *frame = slot(h, f);
+    struct shm_state_ball *balls = (struct shm_state_ball *) (frame + 1);
+    struct shm_state_trampoline *trampolines =
+        (struct shm_state_trampoline *) (balls + h->max_balls);
+    float *anchors = (float *) (trampolines + h->max_trampolines);
+    uint32_t n_balls = 0, n_trampolines = 0, n_anchors = 0, flags = 0;
+
+    store_release(&frame->seq, 2 * f + 1);
+    // nothing below may become visible before the odd seq does
+    SDL_MemoryBarrierRelease();
+
+    for (const struct ball_list *bl = world->balls; bl; bl = bl->next) {
+        const ball *b = bl->b;
+        if (n_balls == h->max_balls) {
+            flags |= SHM_STATE_TRUNCATED;
+            break;
+        }
+        balls[n_balls++] = (struct shm_state_ball) {
+            b->position.x, b->position.y, b->speed.x, b->speed.y, b->radius
+        };
+    }
+
+    for (const struct trampoline_list *tl = world->trampolines; tl; tl = tl->next) {
+        const trampoline *t = tl->t;
+        if (n_trampolines == h->max_trampolines ||
+            t->n_anchors > (int) (h->max_anchors - n_anchors)) {
+            flags |= SHM_STATE_TRUNCATED;
+            break;
+        }
+        trampolines[n_trampolines++] = (struct shm_state_trampoline) {
+            t->x, t->y, t->width, t->height, n_anchors, t->n_anchors
+        };
+        for (int i=0; i<t->n_anchors; ++i, ++n_anchors) {
+            anchors[2 * n_anchors] = t->offsets[i].x;
+            anchors[2 * n_anchors + 1] = t->offsets[i].y;
+        }
+    }
+
+    frame->flags = flags;
+    frame->step = p->step++;
+    frame->n_balls = n_balls;
+    frame->n_trampolines = n_trampolines;
+    frame->n_anchors = n_anchors;
+
+    store_release(&frame->seq, 2 * f + 2);
+    p->frames = f + 1;
+    store_release(&p->header->head, f + 1);
+}
+
+struct state_reader *open_state_reader(const char *const name)
+{
+    struct state_reader *r;
+    const struct shm_state_header *h;
+    size_t size = 0;
+
+    if ((h = map_shm(name, &size, false)) == NULL) return NULL;
+
+    if (size < sizeof(struct shm_state_header) ||
+        memcmp(h->magic, SHM_STATE_MAGIC, sizeof(SHM_STATE_MAGIC)) != 0 ||
+        h->version != SHM_STATE_VERSION || h->n_slots == 0 ||
+        size < h->header_size + (size_t) h->n_slots * h->slot_size) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "%s: not a trampball state of version %d\n", name, SHM_STATE_VERSION);
+        unmap_shm(h, size);
+        return NULL;
+    }
+
+    r = TB_CALLOC(ALLOC_OTHER, 1, sizeof(struct state_reader));
+    r->header = h;
+    r->size = size;
+    // frames from before we came along don't count as missed
+    r->last_frame = load_acquire(&h->head);
+    return r;
+}
+
+void close_state_reader(struct state_reader *const r)
+{
+    unmap_shm(r->header, r->size);
+    TB_FREE(r);
+}
+
+const struct shm_state_header *state_reader_header(const struct state_reader *const r)
+{
+    return r->header;
+}
+
+const struct shm_state_frame *read_latest_state(struct state_reader *const r,
+                                                uint32_t *const frame_no,
+                                                uint64_t *const missed)
+{
+    const uint32_t head = load_acquire(&r->header->head);
+    const struct shm_state_frame *frame;
+
+    if (head == r->last_frame) return NULL;
+    if (missed != NULL) *missed += head - r->last_frame - 1;
+    r->last_frame = head;
+    *frame_no = head - 1;
+
+    frame = slot(r->header, head - 1);
+    // already being overwritten: it'll be a newer one next time
+    if (load_acquire(&frame->seq) != 2 * (head - 1) + 2) return NULL;
+    return frame;
+}
+
+bool state_frame_intact(const struct shm_state_frame *const frame, uint32_t frame_no)
+{
+    // the frame's contents must all have been read before seq is looked at
+    SDL_MemoryBarrierAcquire();
+    return *(const volatile int *) &frame->seq.value == (int) (2 * frame_no + 2);
+}
+
+const struct shm_state_ball *state_frame_balls(const struct state_reader *const r,
+                                               const struct shm_state_frame *const frame)
+{
+    (void) r;
+    return (const struct shm_state_ball *) (frame + 1);
+}
+
+const struct shm_state_trampoline *state_frame_trampolines(
+    const struct state_reader *const r, const struct shm_state_frame *const frame)
+{
+    return (const struct shm_state_trampoline *) (state_frame_balls(r, frame) +
+                                                  r->header->max_balls);
+}
+
+const float *state_frame_anchors(const struct state_reader *const r,
+                                 const struct shm_state_frame *const frame)
+{
+    return (const float *) (state_frame_trampolines(r, frame) + r->header->max_trampolines);
+}
@@ -0,0 +1,137 @@
+/*
+    shmstate.h
+
+    publishing the simulation state to POSIX shared memory, for other
+    processes on the same machine to watch
+
+    After every step, the positions and speeds of the balls and the anchor
+    offsets of the trampolines are written to the next slot in a ring.
+    Each slot is guarded by a sequence lock: the writer never waits for
+    anybody, and readers read the slots in place, then check that what
+    they read wasn't being overwritten at the time. A reader that falls a
+    whole ring behind simply misses frames.
+
+    Configure with -DENABLE_SHM_STATE=OFF where there's no shm_open();
+    new_state_publisher() and open_state_reader() then always fail.
+*/
+
+#ifndef TRAMPBALL_SHMSTATE_H
+#define TRAMPBALL_SHMSTATE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <SDL.h>
+
+#include "game.h"
+
+#define SHM_STATE_MAGIC "TBSTATE"
+#define SHM_STATE_VERSION 1
+/* frames in the ring; readers have this many steps' time to finish with
+   a frame before it's overwritten */
+#define SHM_STATE_SLOTS 64
+
+/*
+ * The layout, in the byte order and alignment of the machine:
+ *
+ *   struct shm_state_header
+ *   n_slots x slot_size bytes, each:
+ *       struct shm_state_frame
+ *       struct shm_state_ball[max_balls]
+ *       struct shm_state_trampoline[max_trampolines]
+ *       float[max_anchors][2]       anchor offsets (x, y), trampoline by
+ *                                   trampoline
+ *
+ * Protocol for readers: frame number f (counting from 0) is in slot
+ * f % n_slots, and it's complete once its seq reads 2 * f + 2 (modulo
+ * 2^32). head is the number of frames that are complete. To read the
+ * newest frame:
+ *
+ *   f = head - 1                    (acquire)
+ *   s = slot(f).seq                 (acquire); give up if s != 2 * f + 2
+ *   ... read the frame in place ...
+ *   acquire fence; if slot(f).seq != s, what was read is garbage.
+ *
+ * The writer marks a slot with an odd seq before it starts writing to it.
+ */
+struct shm_state_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t n_slots;
+    uint32_t slot_size;
+    uint32_t max_balls;
+    uint32_t max_trampolines;
+    uint32_t max_anchors;
+    float interval_ms;          /* simulated time per step */
+    SDL_atomic_t head;
+    uint32_t writer_pid;
+};
+
+struct shm_state_frame {
+    SDL_atomic_t seq;
+    uint32_t flags;
+    uint64_t step;              /* steps published since the start */
+    uint32_t n_balls;
+    uint32_t n_trampolines;
+    uint32_t n_anchors;
+    uint32_t reserved;
+};
+
+/* in flags: there was more in the world than fits the slots */
+#define SHM_STATE_TRUNCATED 1
+
+struct shm_state_ball {
+    float x, y;
+    float vx, vy;               /* per second */
+    float radius;
+};
+
+struct shm_state_trampoline {
+    float x, y;                 /* left end, at rest */
+    float width, height;        /* the right end is this far off the left */
+    uint32_t first_anchor;      /* into the anchor offsets */
+    uint32_t n_anchors;
+};
+
+struct state_publisher;
+
+/*
+ * Creates (or replaces) the shared memory object name, e.g. "/trampball",
+ * with room for twice what the world holds now. NULL on failure.
+ */
+struct state_publisher *new_state_publisher(const char *const name,
+                                            const struct world *const world,
+                                            double interval_ms);
+/* also removes the shared memory object */
+void free_state_publisher(struct state_publisher *const p);
+/* the world mustn't change while this runs; allocates nothing */
+void publish_state(struct state_publisher *const p, const struct world *const world);
+
+struct state_reader;
+
+struct state_reader *open_state_reader(const char *const name);
+void close_state_reader(struct state_reader *const r);
+const struct shm_state_header *state_reader_header(const struct state_reader *const r);
+
+/*
+ * The newest complete frame, in place, if there's been one since the
+ * last call (or since opening); NULL otherwise. *frame_no is set to its
+ * number, for state_frame_intact(). Frames in between that were skipped
+ * are added to *missed, if missed isn't NULL.
+ */
+const struct shm_state_frame *read_latest_state(struct state_reader *const r,
+                                                uint32_t *const frame_no,
+                                                uint64_t *const missed);
+/* whether the frame was left alone while it was being read; anything
+   read from it before this returned false must be thrown away */
+bool state_frame_intact(const struct shm_state_frame *const frame, uint32_t frame_no);
+
+/* what follows a frame in its slot */
+const struct shm_state_ball *state_frame_balls(const struct state_reader *const r,
+                                               const struct shm_state_frame *const frame);
+const struct shm_state_trampoline *state_frame_trampolines(
+    const struct state_reader *const r, const struct shm_state_frame *const frame);
+const float *state_frame_anchors(const struct state_reader *const r,
+                                 const struct shm_state_frame *const frame);
+
+#endif /* TRAMPBALL_SHMSTATE_H */
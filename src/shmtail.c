@@ -0,0 +1,127 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <SDL.h>
+
+#include "shmstate.h"
+#include "args.h"
+#include "tool.h"
+
+/* summed up in place, without copying the frame */
+struct frame_summary {
+    uint64_t step;
+    uint32_t n_balls, n_trampolines;
+    struct shm_state_ball first;
+    double mean_speed;
+    double max_offset;
+};
+
+static void summarize_frame(const struct state_reader *const r,
+                            const struct shm_state_frame *const frame,
+                            struct frame_summary *const s)
+{
+    const struct shm_state_ball *balls = state_frame_balls(r, frame);
+    const float *anchors = state_frame_anchors(r, frame);
+    const struct shm_state_header *h = state_reader_header(r);
+    double speed = 0, offset = 0;
+
+    // a torn frame can have any counts at all: stay inside the slot
+    s->step = frame->step;
+    s->n_balls = frame->n_balls < h->max_balls ? frame->n_balls : h->max_balls;
+    s->n_trampolines = frame->n_trampolines;
+    uint32_t n_anchors = frame->n_anchors < h->max_anchors ? frame->n_anchors : h->max_anchors;
+
+    memset(&s->first, 0, sizeof(s->first));
+    if (s->n_balls > 0) s->first = balls[0];
+    for (uint32_t i=0; i<s->n_balls; ++i)
+        speed += sqrt(balls[i].vx * balls[i].vx + balls[i].vy * balls[i].vy);
+    for (uint32_t i=0; i<n_anchors; ++i) {
+        double d = fabs(anchors[2*i + 1]);
+        if (d > offset) offset = d;
+    }
+    s->mean_speed = s->n_balls > 0 ? speed / s->n_balls : 0;
+    s->max_offset = offset;
+}
+
+int shmtail_main(int argc, char *argv[])
+{
+    char *flags[] = { "help", NULL };
+    char *opts[] = { "frames", "timeout", NULL };
+    bool flag_states[1];
+    char *opt_vals[2];
+    char *name;
+    long max_frames = 0;
+    double timeout_s = 2;
+    char *endp;
+
+    int n_args = parse_args(argc, argv, flags, opts, 1, flag_states, opt_vals, &name);
+
+    if (n_args != 1 || flag_states[0]) {
+        fprintf(stderr, "trampball-tool shmtail - follow a game's state in shared memory\n"
+                        "\n"
+                        "  Usage: trampball-tool shmtail [-frames 0] [-timeout 2] /NAME\n"
+                        "\n"
+                        "  Reads what trampball -shm /NAME publishes, straight from the\n"
+                        "  shared memory, and prints a CSV line per frame it catches: the\n"
+                        "  first ball, the mean ball speed and the largest trampoline\n"
+                        "  offset. Stops after -frames frames (0: no limit), or once there\n"
+                        "  hasn't been a new frame for -timeout seconds. The frames it\n"
+                        "  missed, and those overwritten while it read them, are counted\n"
+                        "  at the end.\n");
+        return flag_states[0] ? 0 : 2;
+    }
+
+    if (opt_vals[0] != NULL) {
+        max_frames = strtol(opt_vals[0], &endp, 10);
+        if (*opt_vals[0] == '\0' || *endp != '\0' || max_frames < 0) {
+            fprintf(stderr, "not a frame count: %s\n", opt_vals[0]);
+            return 2;
+        }
+    }
+    if (opt_vals[1] != NULL) {
+        timeout_s = strtod(opt_vals[1], &endp);
+        if (*opt_vals[1] == '\0' || *endp != '\0' || timeout_s <= 0) {
+            fprintf(stderr, "not a positive number: %s\n", opt_vals[1]);
+            return 2;
+        }
+    }
+
+    struct state_reader *r = open_state_reader(name);
+    if (r == NULL) return 1;
+
+    const Uint64 freq = SDL_GetPerformanceFrequency();
+    Uint64 last_seen = SDL_GetPerformanceCounter();
+    uint64_t missed = 0, torn = 0;
+    long n_frames = 0;
+
+    printf("frame,step,balls,trampolines,x,y,vx,vy,mean_speed,max_offset\n");
+    while (max_frames == 0 || n_frames < max_frames) {
+        struct frame_summary s;
+        uint32_t frame_no;
+        const struct shm_state_frame *frame = read_latest_state(r, &frame_no, &missed);
+
+        if (frame == NULL) {
+            if ((double) (SDL_GetPerformanceCounter() - last_seen) / freq > timeout_s)
+                break;
+            SDL_Delay(1);
+            continue;
+        }
+        last_seen = SDL_GetPerformanceCounter();
+
+        summarize_frame(r, frame, &s);
+        if (!state_frame_intact(frame, frame_no)) {
+            ++torn;
+            continue;
+        }
+        printf("%u,%llu,%u,%u,%.3f,%.3f,%.5f,%.5f,%.5f,%.3f\n", frame_no,
+               (unsigned long long) s.step, s.n_balls, s.n_trampolines,
+               s.first.x, s.first.y, s.first.vx, s.first.vy, s.mean_speed, s.max_offset);
+        ++n_frames;
+    }
+
+    fprintf(stderr, "%ld frames read, %llu missed, %llu overwritten while reading\n",
+            n_frames, (unsigned long long) missed, (unsigned long long) torn);
+    close_state_reader(r);
+    return 0;
+}
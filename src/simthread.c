@@ -0,0 +1,178 @@
+#ifdef __linux__
+#  define _GNU_SOURCE /* for pthread_setaffinity_np */
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <SDL.h>
+
+#ifndef _WIN32
+#  include <errno.h>
+#  include <time.h>
+#  include <pthread.h>
+#  include <sched.h>
+#endif
+
+#include "simthread.h"
+
+static SDL_Thread *sim_thread = NULL;
+static SDL_atomic_t sim_thread_quit;
+static SDL_mutex *pause_lock = NULL;
+static SDL_cond *pause_cond = NULL;
+static SDL_atomic_t sim_thread_paused;
+
+static struct sim_thread_params thread_params;
+static sim_tick_callback tick_callback;
+static void *tick_user_data;
+
+uint64_t sim_thread_now_ns()
+{
+#ifndef _WIN32
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec) * 1000000000u + ts.tv_nsec;
+#else
+    static Uint64 perf_freq = 0;
+    if (!perf_freq) perf_freq = SDL_GetPerformanceFrequency();
+    Uint64 counter = SDL_GetPerformanceCounter();
+    return (counter / perf_freq) * 1000000000u +
+           ((counter % perf_freq) * 1000000000u) / perf_freq;
+#endif
+}
+
+static void sleep_until_ns(uint64_t deadline_ns)
+{
+#if defined(__linux__)
+    struct timespec ts = { deadline_ns / 1000000000u, deadline_ns % 1000000000u };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+#elif !defined(_WIN32)
+    /* no absolute sleeps here, but the schedule itself is still absolute */
+    uint64_t now;
+    while ((now = sim_thread_now_ns()) < deadline_ns) {
+        uint64_t left = deadline_ns - now;
+        struct timespec ts = { left / 1000000000u, left % 1000000000u };
+        nanosleep(&ts, NULL);
+    }
+#else
+    /* SDL_Delay is only good to the millisecond; spin for the rest */
+    uint64_t now;
+    while ((now = sim_thread_now_ns()) + 2000000u < deadline_ns)
+        SDL_Delay((deadline_ns - now) / 1000000u - 1);
+    while (sim_thread_now_ns() < deadline_ns);
+#endif
+}
+
+static void setup_sim_thread(const struct sim_thread_params *const params)
+{
+#ifdef __linux__
+    if (params->cpu >= 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(params->cpu, &cpus);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "Could not pin simulation thread to CPU %d\n", params->cpu);
+        }
+    }
+#else
+    if (params->cpu >= 0) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "CPU pinning is not supported on this platform\n");
+    }
+#endif
+
+    if (params->realtime) {
+#ifndef _WIN32
+        struct sched_param sp;
+        sp.sched_priority = sched_get_priority_max(SCHED_FIFO);
+        if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &sp) == 0)
+            return;
+#endif
+        if (SDL_SetThreadPriority(SDL_THREAD_PRIORITY_TIME_CRITICAL) != 0) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "Could not raise simulation thread priority - %s\n",
+                         SDL_GetError());
+        }
+    }
+}
+
+static int sim_thread_main(void *data)
+{
+    (void) data;
+    uint64_t interval_ns = thread_params.interval_ms * 1e6;
+    uint64_t deadline, now, lateness;
+
+    setup_sim_thread(&thread_params);
+
+    deadline = sim_thread_now_ns();
+
+    while (!SDL_AtomicGet(&sim_thread_quit)) {
+        if (SDL_AtomicGet(&sim_thread_paused)) {
+            SDL_LockMutex(pause_lock);
+            while (SDL_AtomicGet(&sim_thread_paused) && !SDL_AtomicGet(&sim_thread_quit))
+                SDL_CondWait(pause_cond, pause_lock);
+            SDL_UnlockMutex(pause_lock);
+            deadline = sim_thread_now_ns();
+            continue;
+        }
+
+        // The schedule is absolute: deadlines are multiples of the interval,
+        // so sleep inaccuracies don't accumulate.
+        deadline += interval_ns;
+        sleep_until_ns(deadline);
+
+        now = sim_thread_now_ns();
+        lateness = (now > deadline) ? now - deadline : 0;
+        if (lateness > SIM_THREAD_MAX_BACKLOG * interval_ns) {
+            // we're hopelessly behind (suspended? debugger?) - drop the
+            // missed ticks rather than running them back to back.
+            deadline = now;
+        }
+
+        tick_callback(thread_params.interval_ms, lateness, tick_user_data);
+    }
+
+    return 0;
+}
+
+bool start_sim_thread(const struct sim_thread_params *const params,
+                      sim_tick_callback callback, void *user_data)
+{
+    if (sim_thread != NULL || params->interval_ms <= 0) return false;
+
+    thread_params = *params;
+    tick_callback = callback;
+    tick_user_data = user_data;
+    SDL_AtomicSet(&sim_thread_quit, 0);
+
+    if (pause_lock == NULL && (pause_lock = SDL_CreateMutex()) == NULL)
+        return false;
+    if (pause_cond == NULL && (pause_cond = SDL_CreateCond()) == NULL)
+        return false;
+
+    sim_thread = SDL_CreateThread(sim_thread_main, "simulation", NULL);
+    return sim_thread != NULL;
+}
+
+void stop_sim_thread()
+{
+    if (sim_thread == NULL) return;
+
+    SDL_LockMutex(pause_lock);
+    SDL_AtomicSet(&sim_thread_quit, 1);
+    SDL_CondSignal(pause_cond);
+    SDL_UnlockMutex(pause_lock);
+
+    SDL_WaitThread(sim_thread, NULL);
+    sim_thread = NULL;
+}
+
+void pause_sim_thread(bool paused)
+{
+    if (paused == (bool) SDL_AtomicGet(&sim_thread_paused) || pause_lock == NULL) return;
+
+    SDL_LockMutex(pause_lock);
+    SDL_AtomicSet(&sim_thread_paused, paused);
+    SDL_CondSignal(pause_cond);
+    SDL_UnlockMutex(pause_lock);
+}
@@ -0,0 +1,36 @@
+/*
+    simthread.h
+
+    dedicated simulation thread with absolute-deadline scheduling
+*/
+
+#ifndef TRAMPBALL_SIMTHREAD_H
+#define TRAMPBALL_SIMTHREAD_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* if we fall this many intervals behind, give up on catching up and
+   re-anchor the schedule at the current time */
+#define SIM_THREAD_MAX_BACKLOG 4
+
+/* lateness_ns: how long after its deadline this tick started */
+typedef void (*sim_tick_callback)(double interval_ms, uint64_t lateness_ns,
+                                  void *user_data);
+
+struct sim_thread_params {
+    double interval_ms;
+    int cpu;        /* CPU to pin the thread to, or -1 */
+    bool realtime;  /* request real-time scheduling */
+};
+
+bool start_sim_thread(const struct sim_thread_params *const params,
+                      sim_tick_callback callback, void *user_data);
+void stop_sim_thread();
+/* a paused thread sleeps until it's resumed (or stopped), and then picks
+   up its schedule from the time of resumption */
+void pause_sim_thread(bool paused);
+
+uint64_t sim_thread_now_ns();
+
+#endif /* TRAMPBALL_SIMTHREAD_H */
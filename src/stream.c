@@ -0,0 +1,381 @@
+#include <stdlib.h>
+#include <math.h>
+#include <SDL.h>
+
+#include "stream.h"
+#include "alloc.h"
+
+/* for chunks, what we want; for items, what they are */
+enum stream_state { STREAM_UNLOADED, STREAM_FROZEN, STREAM_ACTIVE };
+
+enum stream_item_kind { ITEM_TRAMPOLINE, ITEM_BALL, ITEM_WALL };
+
+/*
+ * Everything in the world, loaded or not. The spec holds what it takes to
+ * (re)create the object: for balls, that includes where they were when
+ * they were unloaded. Trampolines come back in their rest shape.
+ */
+struct stream_item {
+    struct stream_item *next;
+    enum stream_item_kind kind;
+    enum stream_state state;
+    union {
+        trampoline *t;
+        ball *b;
+        wall *w;
+    } live; /* NULL while unloaded */
+    union {
+        struct {
+            int n_anchors, x, y, width, height;
+            int refine_levels; /* -1 if the anchors are evenly spaced */
+            real k, damping, density;
+        } t;
+        ball b; /* no lock, no attachments */
+        wall w;
+    } spec;
+};
+
+struct chunk {
+    enum stream_state state;
+    struct stream_item *items;
+};
+
+struct world_stream {
+    struct world *world;
+    ball *focus;
+    int chunk_size;
+    int left, bottom;
+    int nx, ny;
+    int focus_cx, focus_cy; /* as of the last update, or -1 */
+    struct chunk *chunks;
+    struct world_stream_stats stats;
+};
+
+static void chunk_of(const struct world_stream *const s, vector2f pos,
+                     int *const cx, int *const cy)
+{
+    *cx = (int) floor((pos.x - s->left) / s->chunk_size);
+    *cy = (int) floor((pos.y - s->bottom) / s->chunk_size);
+    if (*cx < 0) *cx = 0;
+    if (*cx >= s->nx) *cx = s->nx - 1;
+    if (*cy < 0) *cy = 0;
+    if (*cy >= s->ny) *cy = s->ny - 1;
+}
+
+static vector2f item_position(const struct stream_item *const item)
+{
+    switch (item->kind) {
+    case ITEM_TRAMPOLINE:
+        return (vector2f) { item->spec.t.x + item->spec.t.width / 2, item->spec.t.y };
+    case ITEM_BALL:
+        return item->live.b ? item->live.b->position : item->spec.b.position;
+    case ITEM_WALL:
+    default:
+        return (vector2f) {
+            item->spec.w.position.x + (item->spec.w.side1.x + item->spec.w.side2.x) / 2,
+            item->spec.w.position.y + (item->spec.w.side1.y + item->spec.w.side2.y) / 2 };
+    }
+}
+
+static enum stream_state chunk_target_state(int cx, int cy, int fx, int fy)
+{
+    int d = abs(cx - fx) > abs(cy - fy) ? abs(cx - fx) : abs(cy - fy);
+    if (d <= STREAM_ACTIVE_RADIUS) return STREAM_ACTIVE;
+    if (d <= STREAM_FROZEN_RADIUS) return STREAM_FROZEN;
+    return STREAM_UNLOADED;
+}
+
+static void save_ball_spec(struct stream_item *const item, const ball *const b)
+{
+    item->spec.b = *b;
+    item->spec.b.lock = NULL;
+    item->spec.b.remote_controlled = false;
+}
+
+static void load_item(struct stream_item *const item)
+{
+    switch (item->kind) {
+    case ITEM_TRAMPOLINE: {
+        trampoline *t = new_trampoline(item->spec.t.n_anchors);
+        t->x = item->spec.t.x;
+        t->y = item->spec.t.y;
+        t->width = item->spec.t.width;
+        t->k = item->spec.t.k;
+        t->damping = item->spec.t.damping;
+        t->density = item->spec.t.density;
+        if (item->spec.t.height != 0)
+            set_trampoline_height(t, item->spec.t.height);
+        if (item->spec.t.refine_levels >= 0)
+            set_trampoline_refinement(t, item->spec.t.refine_levels);
+        item->live.t = t;
+        break;
+    }
+    case ITEM_BALL: {
+        ball *b = new_ball();
+        SDL_mutex *lock = b->lock;
+        *b = item->spec.b;
+        b->lock = lock;
+        item->live.b = b;
+        break;
+    }
+    case ITEM_WALL:
+        item->live.w = new_wall();
+        *item->live.w = item->spec.w;
+        break;
+    }
+}
+
+static void unload_item(struct world *const world, struct stream_item *const item)
+{
+    switch (item->kind) {
+    case ITEM_TRAMPOLINE:
+        discard_trampoline(world, item->live.t);
+        break;
+    case ITEM_BALL:
+        save_ball_spec(item, item->live.b);
+        discard_ball(world, item->live.b);
+        break;
+    case ITEM_WALL:
+        discard_wall(world, item->live.w);
+        break;
+    }
+    item->live.t = NULL;
+}
+
+static void activate_item(struct world *const world, struct stream_item *const item)
+{
+    switch (item->kind) {
+    case ITEM_TRAMPOLINE: add_trampoline(world, item->live.t); break;
+    case ITEM_BALL: add_ball(world, item->live.b); break;
+    case ITEM_WALL: add_wall(world, item->live.w); break;
+    }
+}
+
+static void deactivate_item(struct world *const world, struct stream_item *const item)
+{
+    switch (item->kind) {
+    case ITEM_TRAMPOLINE:
+        remove_trampoline(world, item->live.t);
+        break;
+    case ITEM_BALL:
+        remove_ball(world, item->live.b);
+        break;
+    case ITEM_WALL:
+        remove_wall(world, item->live.w);
+        break;
+    }
+}
+
+static void set_item_state(struct world_stream *const s, struct stream_item *const item,
+                           enum stream_state target)
+{
+    if (item->state == target) return;
+
+    if (item->state == STREAM_ACTIVE) {
+        deactivate_item(s->world, item);
+        item->state = STREAM_FROZEN;
+        s->stats.active_items--;
+    }
+
+    if (target == STREAM_ACTIVE) {
+        if (item->state == STREAM_UNLOADED) {
+            load_item(item);
+            s->stats.loaded_items++;
+        }
+        activate_item(s->world, item);
+        item->state = STREAM_ACTIVE;
+        s->stats.active_items++;
+    } else if (target == STREAM_UNLOADED && item->state == STREAM_FROZEN) {
+        unload_item(s->world, item);
+        item->state = STREAM_UNLOADED;
+        s->stats.loaded_items--;
+    }
+    // frozen chunks don't load anything they don't already have
+}
+
+static void set_chunk_state(struct world_stream *const s, struct chunk *const c,
+                            enum stream_state target)
+{
+    if (c->state == target) return;
+
+    if (c->state == STREAM_ACTIVE) s->stats.active_chunks--;
+    if (target == STREAM_ACTIVE) s->stats.active_chunks++;
+
+    for (struct stream_item *item = c->items; item; item = item->next)
+        set_item_state(s, item, target);
+    c->state = target;
+}
+
+static void add_item(struct world_stream *const s, struct stream_item *const item)
+{
+    int cx, cy;
+    chunk_of(s, item_position(item), &cx, &cy);
+
+    struct chunk *c = &s->chunks[cy * s->nx + cx];
+    item->next = c->items;
+    c->items = item;
+    s->stats.items++;
+    if (item->state != STREAM_UNLOADED) s->stats.loaded_items++;
+}
+
+struct world_stream *new_world_stream(struct world *const world, int chunk_size,
+                                      ball **const focus)
+{
+    struct world_stream *s = TB_MALLOC(ALLOC_STREAM, sizeof(struct world_stream));
+    struct stream_item *item, *focus_item = NULL;
+    const stage *st = &world->game_stage;
+
+    s->world = world;
+    s->focus = *focus;
+    s->chunk_size = chunk_size;
+    s->left = st->left;
+    s->bottom = st->bottom;
+    s->nx = (st->right - st->left + chunk_size - 1) / chunk_size;
+    s->ny = (st->top - st->bottom + chunk_size - 1) / chunk_size;
+    if (s->nx < 1) s->nx = 1;
+    if (s->ny < 1) s->ny = 1;
+    s->focus_cx = s->focus_cy = -1;
+    s->chunks = TB_CALLOC(ALLOC_STREAM, s->nx * s->ny, sizeof(struct chunk));
+    s->stats = (struct world_stream_stats) { s->nx * s->ny, 0, 0, 0, 0 };
+
+    while (world->trampolines != NULL) {
+        trampoline *t = world->trampolines->t;
+        item = TB_CALLOC(ALLOC_STREAM, 1, sizeof(struct stream_item));
+        item->kind = ITEM_TRAMPOLINE;
+        item->spec.t.n_anchors = t->mesh ? t->mesh->n_segments + 1 : t->n_anchors;
+        item->spec.t.refine_levels = t->mesh ? t->mesh->levels : -1;
+        item->spec.t.x = t->x;
+        item->spec.t.y = t->y;
+        item->spec.t.width = t->width;
+        item->spec.t.height = t->height;
+        item->spec.t.k = t->k;
+        item->spec.t.damping = t->damping;
+        item->spec.t.density = t->density;
+        remove_trampoline(world, t);
+        discard_trampoline(world, t);
+        add_item(s, item);
+    }
+
+    while (world->balls != NULL) {
+        ball *b = world->balls->b;
+        item = TB_CALLOC(ALLOC_STREAM, 1, sizeof(struct stream_item));
+        item->kind = ITEM_BALL;
+        save_ball_spec(item, b);
+        remove_ball(world, b);
+        if (b == *focus) {
+            // the one thing that's always loaded
+            item->live.b = b;
+            item->state = STREAM_FROZEN;
+            focus_item = item;
+        } else {
+            discard_ball(world, b);
+        }
+        add_item(s, item);
+    }
+
+    while (world->walls != NULL) {
+        wall *w = world->walls->w;
+        item = TB_CALLOC(ALLOC_STREAM, 1, sizeof(struct stream_item));
+        item->kind = ITEM_WALL;
+        item->spec.w = *w;
+        remove_wall(world, w);
+        discard_wall(world, w);
+        add_item(s, item);
+    }
+
+    // Nothing in the world's arenas is in use now but the focus ball: move
+    // that to the heap, and let the rest go, so that memory only holds
+    // what's loaded. (The list nodes stay, for reuse.)
+    if (focus_item != NULL && arena_owns(&world->arenas[WORLD_ARENA_BALLS], *focus)) {
+        ball *b = new_ball();
+        SDL_mutex *lock = b->lock;
+        *b = **focus;
+        b->lock = lock;
+        cleanup_ball(*focus);
+        focus_item->live.b = s->focus = *focus = b;
+    }
+    free_arena(&world->arenas[WORLD_ARENA_TRAMPOLINES]);
+    free_arena(&world->arenas[WORLD_ARENA_BALLS]);
+    free_arena(&world->arenas[WORLD_ARENA_WALLS]);
+
+    return s;
+}
+
+void free_world_stream(struct world_stream *const s)
+{
+    for (int i=0; i<s->nx * s->ny; ++i) {
+        struct stream_item *item, *next;
+        for (item = s->chunks[i].items; item; item = next) {
+            next = item->next;
+            // active ones belong to the world
+            if (item->state == STREAM_FROZEN) unload_item(s->world, item);
+            TB_FREE(item);
+        }
+    }
+    TB_FREE(s->chunks);
+    TB_FREE(s);
+}
+
+static void update_chunks_around(struct world_stream *const s, int cx, int cy,
+                                 int fx, int fy)
+{
+    for (int y = cy - STREAM_FROZEN_RADIUS; y <= cy + STREAM_FROZEN_RADIUS; ++y) {
+        if (y < 0 || y >= s->ny) continue;
+        for (int x = cx - STREAM_FROZEN_RADIUS; x <= cx + STREAM_FROZEN_RADIUS; ++x) {
+            if (x < 0 || x >= s->nx) continue;
+            set_chunk_state(s, &s->chunks[y * s->nx + x], chunk_target_state(x, y, fx, fy));
+        }
+    }
+}
+
+void update_world_stream(struct world_stream *const s)
+{
+    int fx, fy, cx, cy, x, y;
+
+    chunk_of(s, s->focus->position, &fx, &fy);
+
+    // Balls move. Only active ones can have moved since the last update,
+    // and they can only be in the active chunks around the old focus.
+    if (s->focus_cx >= 0) {
+        for (y = s->focus_cy - STREAM_ACTIVE_RADIUS; y <= s->focus_cy + STREAM_ACTIVE_RADIUS; ++y) {
+            if (y < 0 || y >= s->ny) continue;
+            for (x = s->focus_cx - STREAM_ACTIVE_RADIUS; x <= s->focus_cx + STREAM_ACTIVE_RADIUS; ++x) {
+                if (x < 0 || x >= s->nx) continue;
+                struct chunk *c = &s->chunks[y * s->nx + x];
+                struct stream_item **p = &c->items;
+                while (*p) {
+                    struct stream_item *item = *p;
+                    if (item->kind != ITEM_BALL || item->state != STREAM_ACTIVE) {
+                        p = &item->next;
+                        continue;
+                    }
+                    chunk_of(s, item->live.b->position, &cx, &cy);
+                    if (cx == x && cy == y) {
+                        p = &item->next;
+                        continue;
+                    }
+                    *p = item->next;
+                    item->next = s->chunks[cy * s->nx + cx].items;
+                    s->chunks[cy * s->nx + cx].items = item;
+                    set_item_state(s, item, chunk_target_state(cx, cy, fx, fy));
+                }
+            }
+        }
+    }
+
+    if (fx == s->focus_cx && fy == s->focus_cy) return;
+
+    // everything that changes is near either the old or the new focus
+    if (s->focus_cx >= 0)
+        update_chunks_around(s, s->focus_cx, s->focus_cy, fx, fy);
+    update_chunks_around(s, fx, fy, fx, fy);
+
+    s->focus_cx = fx;
+    s->focus_cy = fy;
+}
+
+void get_world_stream_stats(const struct world_stream *const s,
+                            struct world_stream_stats *const stats)
+{
+    *stats = s->stats;
+}
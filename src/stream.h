@@ -0,0 +1,56 @@
+/*
+    stream.h
+
+    streaming very large worlds: only the chunks of the stage near the
+    focus ball are loaded and simulated
+*/
+
+#ifndef TRAMPBALL_STREAM_H
+#define TRAMPBALL_STREAM_H
+
+#include <stdbool.h>
+
+#include "game.h"
+
+/* chunks up to this many chunks from the focus ball's (in either
+   direction) are simulated */
+#define STREAM_ACTIVE_RADIUS 1
+/* and up to this many are kept in memory, but frozen. Anything further
+   away is unloaded. */
+#define STREAM_FROZEN_RADIUS 2
+
+struct world_stream;
+
+struct world_stream_stats {
+    int chunks;
+    int active_chunks;
+    int items;          /* trampolines, balls and walls */
+    int loaded_items;
+    int active_items;
+};
+
+/*
+ * Takes over everything in world and unloads it, except for the focus ball,
+ * and frees the world's object arenas. *focus is moved out of its arena if
+ * it was in one, so it may point somewhere else afterwards. From then on,
+ * the world only contains what update_world_stream() has activated.
+ *
+ * Chunks should be larger than the largest object in the world, and
+ * large enough that the active ones cover the screen.
+ */
+struct world_stream *new_world_stream(struct world *const world, int chunk_size,
+                                      ball **const focus);
+/* frees everything that isn't in the world */
+void free_world_stream(struct world_stream *const stream);
+
+/*
+ * Loads, activates, freezes and unloads chunks around the focus ball, and
+ * moves balls that left the active region out of the world. This changes
+ * the world's lists, so the simulation must not be running at the time.
+ */
+void update_world_stream(struct world_stream *const stream);
+
+void get_world_stream_stats(const struct world_stream *const stream,
+                            struct world_stream_stats *const stats);
+
+#endif /* TRAMPBALL_STREAM_H */
@@ -0,0 +1,268 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <SDL.h>
+
+#include "game.h"
+#include "libtrampball.h"
+#include "args.h"
+#include "tool.h"
+
+enum { PARAM_K, PARAM_DENSITY, PARAM_DAMPING, PARAM_MASS, PARAM_BOUNCE, N_PARAMS };
+static char *param_names[] = { "k", "density", "damping", "mass", "bounce" };
+
+struct param_range {
+    bool set;
+    double lo;
+    double hi;
+    int n;
+};
+
+struct sweep_result {
+    double values[N_PARAMS];
+    bool ok;
+    double max_height;     /* highest ball position after the first trampoline contact */
+    double energy_ratio;   /* final / initial total energy */
+    double mean_substeps;  /* trampoline substeps per step */
+    int max_substeps;
+};
+
+struct sweep_job {
+    const char *world_buf;
+    size_t world_len;
+    struct param_range ranges[N_PARAMS];
+    long n_configs;
+    int n_steps;
+    float interval_ms;
+    SDL_atomic_t next_config;
+    SDL_atomic_t configs_done;
+    struct sweep_result *results;
+};
+
+/* "lo:hi:n" or a single value */
+static bool parse_range(const char *str, struct param_range *const r)
+{
+    char *endp;
+
+    r->lo = r->hi = strtod(str, &endp);
+    r->n = 1;
+    r->set = true;
+    if (endp == str) return false;
+    if (*endp == '\0') return true;
+    if (*endp != ':') return false;
+
+    str = endp + 1;
+    r->hi = strtod(str, &endp);
+    if (endp == str || *endp != ':') return false;
+
+    str = endp + 1;
+    r->n = strtol(str, &endp, 10);
+    return (endp != str && *endp == '\0' && r->n >= 1);
+}
+
+static double range_value(const struct param_range *const r, int i)
+{
+    return (r->n == 1) ? r->lo : r->lo + (r->hi - r->lo) * i / (r->n - 1);
+}
+
+static void run_config(const struct sweep_job *const job, long idx,
+                       struct sweep_result *const res)
+{
+    struct trampoline_list *tl;
+    struct ball_list *bl;
+    long rest = idx;
+    int p, step;
+
+    for (p=0; p<N_PARAMS; ++p) {
+        const struct param_range *r = &job->ranges[p];
+        res->values[p] = r->set ? range_value(r, rest % r->n) : NAN;
+        if (r->set) rest /= r->n;
+    }
+
+    struct world *w = trampball_world_from_buffer(job->world_buf, job->world_len);
+    if ((res->ok = (w != NULL)) == false) return;
+
+    for (tl = w->trampolines; tl; tl = tl->next) {
+        if (job->ranges[PARAM_K].set) tl->t->k = res->values[PARAM_K];
+        if (job->ranges[PARAM_DENSITY].set) tl->t->density = res->values[PARAM_DENSITY];
+        if (job->ranges[PARAM_DAMPING].set) tl->t->damping = res->values[PARAM_DAMPING];
+    }
+    for (bl = w->balls; bl; bl = bl->next) {
+        if (job->ranges[PARAM_MASS].set) bl->b->mass = res->values[PARAM_MASS];
+        if (job->ranges[PARAM_BOUNCE].set) bl->b->bounce = res->values[PARAM_BOUNCE];
+    }
+
+    double e0 = world_energy(w);
+    long total_substeps = 0;
+    bool touched = false;
+
+    res->max_height = -INFINITY;
+    res->max_substeps = 0;
+
+    for (step=0; step<job->n_steps; ++step) {
+        int substeps = game_iteration(w, job->interval_ms);
+        total_substeps += substeps;
+        if (substeps > res->max_substeps) res->max_substeps = substeps;
+
+        for (bl = w->balls; bl; bl = bl->next) {
+            if (bl->b->remote_controlled) touched = true;
+            else if (touched && bl->b->position.y > res->max_height)
+                res->max_height = bl->b->position.y;
+        }
+    }
+
+    res->energy_ratio = world_energy(w) / e0;
+    res->mean_substeps = ((double) total_substeps) / job->n_steps;
+
+    trampball_world_destroy(w);
+}
+
+static int sweep_worker(void *data)
+{
+    struct sweep_job *job = data;
+    long idx;
+
+    while ((idx = SDL_AtomicAdd(&job->next_config, 1)) < job->n_configs) {
+        run_config(job, idx, &job->results[idx]);
+        SDL_AtomicAdd(&job->configs_done, 1);
+    }
+
+    return 0;
+}
+
+static void write_results(FILE *fp, const struct sweep_job *const job)
+{
+    int p;
+
+    fprintf(fp, "config");
+    for (p=0; p<N_PARAMS; ++p)
+        if (job->ranges[p].set) fprintf(fp, ",%s", param_names[p]);
+    fprintf(fp, ",max_height,energy_ratio,mean_substeps,max_substeps\n");
+
+    for (long i=0; i<job->n_configs; ++i) {
+        const struct sweep_result *res = &job->results[i];
+        fprintf(fp, "%ld", i);
+        for (p=0; p<N_PARAMS; ++p)
+            if (job->ranges[p].set) fprintf(fp, ",%g", res->values[p]);
+        if (res->ok)
+            fprintf(fp, ",%.3f,%.6f,%.3f,%d\n", res->max_height, res->energy_ratio,
+                    res->mean_substeps, res->max_substeps);
+        else
+            fprintf(fp, ",,,,\n");
+    }
+}
+
+int sweep_main(int argc, char *argv[])
+{
+    char *flags[] = { "help", NULL };
+    char *opts[] = { "k", "density", "damping", "mass", "bounce",
+                     "steps", "interval", "threads", "output", NULL };
+    bool flag_states[1];
+    char *opt_vals[9];
+    char *world_fn = NULL;
+    struct sweep_job job;
+    int n_threads = SDL_GetCPUCount();
+    char *endp;
+    int p, i;
+
+    int n_args = parse_args(argc, argv, flags, opts, 1,
+                            flag_states, opt_vals, &world_fn);
+
+    if (n_args != 1 || flag_states[0]) {
+        fprintf(stderr, "trampball-tool sweep - run a world headless for every combination\n"
+                        "                       of trampoline and ball parameters\n"
+                        "\n"
+                        "  Usage: trampball-tool sweep [-k lo:hi:n] [-density lo:hi:n] [-damping lo:hi:n]\n"
+                        "         [-mass lo:hi:n] [-bounce lo:hi:n] [-steps 1000] [-interval 10]\n"
+                        "         [-threads N] [-output results.csv] world.txt\n"
+                        "\n"
+                        "  A range may also be a single value. Parameters that aren't given\n"
+                        "  keep the values from the world file.\n");
+        return flag_states[0] ? 0 : 2;
+    }
+
+    memset(&job, 0, sizeof(job));
+    job.n_steps = 1000;
+    job.interval_ms = 10;
+    job.n_configs = 1;
+
+    for (p=0; p<N_PARAMS; ++p) {
+        if (opt_vals[p] == NULL) continue;
+        if (!parse_range(opt_vals[p], &job.ranges[p])) {
+            fprintf(stderr, "not a range (lo:hi:n): %s\n", opt_vals[p]);
+            return 2;
+        }
+        job.n_configs *= job.ranges[p].n;
+    }
+    if (opt_vals[5] != NULL) {
+        job.n_steps = strtol(opt_vals[5], &endp, 10);
+        if (*opt_vals[5] == '\0' || *endp != '\0' || job.n_steps < 1) {
+            fprintf(stderr, "not a positive integer: %s\n", opt_vals[5]);
+            return 2;
+        }
+    }
+    if (opt_vals[6] != NULL) {
+        job.interval_ms = strtod(opt_vals[6], &endp);
+        if (*opt_vals[6] == '\0' || *endp != '\0' || job.interval_ms <= 0) {
+            fprintf(stderr, "not a positive number: %s\n", opt_vals[6]);
+            return 2;
+        }
+    }
+    if (opt_vals[7] != NULL) {
+        n_threads = strtol(opt_vals[7], &endp, 10);
+        if (*opt_vals[7] == '\0' || *endp != '\0' || n_threads < 1) {
+            fprintf(stderr, "not a positive integer: %s\n", opt_vals[7]);
+            return 2;
+        }
+    }
+
+    if ((job.world_buf = read_whole_file(world_fn, &job.world_len)) == NULL)
+        return 1;
+
+    job.results = calloc(job.n_configs, sizeof(struct sweep_result));
+    SDL_Thread **threads = malloc(n_threads * sizeof(SDL_Thread *));
+
+    Uint64 t0 = SDL_GetPerformanceCounter();
+
+    // the workers share out the configurations, so any number of them will do
+    int n_started = 0;
+    for (i=0; i<n_threads; ++i) {
+        if ((threads[n_started] = SDL_CreateThread(sweep_worker, "sweep", &job)) != NULL)
+            ++n_started;
+    }
+    if (n_started == 0) {
+        fprintf(stderr, "could not start any threads: %s\n", SDL_GetError());
+        free(threads);
+        free(job.results);
+        free((char *) job.world_buf);
+        return 1;
+    }
+
+    // the workers do all the work; we just keep the user posted
+    while (SDL_AtomicGet(&job.configs_done) < job.n_configs) {
+        fprintf(stderr, "\r%d / %ld", SDL_AtomicGet(&job.configs_done), job.n_configs);
+        SDL_Delay(200);
+    }
+
+    for (i=0; i<n_started; ++i)
+        SDL_WaitThread(threads[i], NULL);
+
+    double elapsed = ((double)(SDL_GetPerformanceCounter() - t0)) / SDL_GetPerformanceFrequency();
+    fprintf(stderr, "\r%ld configurations in %.1f s on %d threads\n",
+            job.n_configs, elapsed, n_started);
+
+    FILE *out = stdout;
+    if (opt_vals[8] != NULL && (out = fopen(opt_vals[8], "w")) == NULL) {
+        perror(opt_vals[8]);
+        return 1;
+    }
+    write_results(out, &job);
+    if (out != stdout) fclose(out);
+
+    free(threads);
+    free(job.results);
+    free((char *) job.world_buf);
+
+    return 0;
+}
@@ -0,0 +1,99 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tool.h"
+#include "assets.h"
+#include "config.h"
+
+static const struct {
+    const char *name;
+    int (*main)(int argc, char *argv[]);
+    const char *description;
+} subcommands[] = {
+    { "sweep", sweep_main, "run every combination of a set of parameter ranges" },
+    { "bench", bench_main, "measure energy drift and speed of this physics build" },
+    { "regress", regress_main, "record or check golden physics trajectories" },
+    { "shmtail", shmtail_main, "follow a running game's state in shared memory" },
+    { "trajdump", trajdump_main, "convert a trajectory log to CSV or NumPy files" },
+    { "gen", gen_main, "generate a random world of any size, as text or binary" },
+    { "pack", pack_main, "put the assets in one file, to load them from memory" },
+    { NULL, NULL, NULL }
+};
+
+char *read_whole_file(const char *const filename, size_t *const len)
+{
+    FILE *fp;
+    char *buf;
+    long size;
+
+    if ((fp = fopen(filename, "rb")) == NULL) {
+        perror(filename);
+        return NULL;
+    }
+
+    if (fseek(fp, 0, SEEK_END) != 0 || (size = ftell(fp)) < 0 ||
+        fseek(fp, 0, SEEK_SET) != 0) {
+        perror(filename);
+        fclose(fp);
+        return NULL;
+    }
+
+    buf = malloc(size + 1);
+    if (fread(buf, 1, size, fp) != (size_t) size) {
+        perror(filename);
+        free(buf);
+        fclose(fp);
+        return NULL;
+    }
+    buf[size] = '\0';
+    fclose(fp);
+
+    *len = size;
+    return buf;
+}
+
+unsigned xorshift32(unsigned *const state)
+{
+    unsigned x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return (*state = x);
+}
+
+int random_int(unsigned *const state, int lo, int hi)
+{
+    return lo + (int)(xorshift32(state) % (unsigned)(hi - lo + 1));
+}
+
+double random_unit(unsigned *const state)
+{
+    return xorshift32(state) / 4294967296.0;
+}
+
+int main(int argc, char *argv[])
+{
+    int i;
+
+    // the bundled worlds, for the subcommands that default to them
+    if (ASSET_PACK[0] != '\0' && !open_asset_pack(ASSET_PACK))
+        fprintf(stderr, "using the loose asset files instead\n");
+
+    if (argc >= 2) {
+        for (i=0; subcommands[i].name != NULL; ++i) {
+            if (strcmp(subcommands[i].name, argv[1]) == 0)
+                return subcommands[i].main(argc - 1, argv + 1);
+        }
+        fprintf(stderr, "Unknown subcommand: %s\n\n", argv[1]);
+    }
+
+    fprintf(stderr, "trampball-tool - headless trampball utilities\n"
+                    "\n"
+                    "  Usage: %s SUBCOMMAND [-help] ...\n"
+                    "\n", argv[0]);
+    for (i=0; subcommands[i].name != NULL; ++i)
+        fprintf(stderr, "    %-10s %s\n", subcommands[i].name, subcommands[i].description);
+
+    return 2;
+}
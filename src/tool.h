@@ -0,0 +1,31 @@
+/*
+    tool.h
+
+    headless command line tools, run as trampball-tool SUBCOMMAND ...
+*/
+
+#ifndef TRAMPBALL_TOOL_H
+#define TRAMPBALL_TOOL_H
+
+#include <stddef.h>
+
+/* each subcommand gets argv[0] == its own name */
+int sweep_main(int argc, char *argv[]);
+int bench_main(int argc, char *argv[]);
+int regress_main(int argc, char *argv[]);
+int shmtail_main(int argc, char *argv[]);
+int trajdump_main(int argc, char *argv[]);
+int gen_main(int argc, char *argv[]);
+int pack_main(int argc, char *argv[]);
+
+char *read_whole_file(const char *const filename, size_t *const len);
+
+/* a small, fast PRNG: the same sequence for the same seed everywhere.
+   The state must not be 0. */
+unsigned xorshift32(unsigned *const state);
+/* lo..hi inclusive */
+int random_int(unsigned *const state, int lo, int hi);
+/* [0, 1) */
+double random_unit(unsigned *const state);
+
+#endif /* TRAMPBALL_TOOL_H */
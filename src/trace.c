@@ -0,0 +1,156 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <SDL.h>
+
+#include "trace.h"
+#include "alloc.h"
+
+#ifdef ENABLE_TRACING
+
+#ifdef _MSC_VER
+#  define TRACE_TLS __declspec(thread)
+#else
+#  define TRACE_TLS __thread
+#endif
+
+struct trace_event {
+    const char *name;
+    Uint64 begin;
+    Uint64 end;
+};
+
+struct trace_buffer {
+    struct trace_buffer *next;
+    int tid;
+    const char *thread_name;
+    int depth;
+    struct trace_event open[TRACE_MAX_DEPTH];
+    SDL_atomic_t head; /* total number of events ever written */
+    struct trace_event events[TRACE_BUFFER_EVENTS];
+};
+
+static struct trace_buffer *all_buffers = NULL;
+static SDL_atomic_t next_tid;
+static TRACE_TLS struct trace_buffer *my_buffer = NULL;
+
+static struct trace_buffer *get_buffer()
+{
+    if (my_buffer != NULL) return my_buffer;
+
+    struct trace_buffer *buf = TB_CALLOC(ALLOC_OTHER, 1, sizeof(struct trace_buffer));
+    if (buf == NULL) return NULL;
+    buf->tid = SDL_AtomicAdd(&next_tid, 1) + 1;
+
+    // push onto the global list; buffers are never removed, so
+    // the exporter can walk it without locking.
+    do {
+        buf->next = SDL_AtomicGetPtr((void **) &all_buffers);
+    } while (!SDL_AtomicCASPtr((void **) &all_buffers, buf->next, buf));
+
+    return (my_buffer = buf);
+}
+
+void trace_begin(const char *const name)
+{
+    struct trace_buffer *buf = get_buffer();
+    if (buf == NULL) return;
+
+    if (buf->depth < TRACE_MAX_DEPTH) {
+        buf->open[buf->depth].name = name;
+        buf->open[buf->depth].begin = SDL_GetPerformanceCounter();
+    }
+    buf->depth++;
+}
+
+void trace_end()
+{
+    struct trace_buffer *buf = my_buffer;
+    if (buf == NULL || buf->depth == 0) return;
+
+    if (--buf->depth < TRACE_MAX_DEPTH) {
+        int head = SDL_AtomicGet(&buf->head);
+        struct trace_event *ev = &buf->events[head & (TRACE_BUFFER_EVENTS - 1)];
+        *ev = buf->open[buf->depth];
+        ev->end = SDL_GetPerformanceCounter();
+        SDL_AtomicSet(&buf->head, head + 1);
+    }
+}
+
+void trace_thread_name(const char *const name)
+{
+    struct trace_buffer *buf = get_buffer();
+    if (buf != NULL) buf->thread_name = name;
+}
+
+bool trace_export_chrome(const char *const filename)
+{
+    FILE *fp;
+    struct trace_buffer *buf;
+    double us_per_tick = 1e6 / SDL_GetPerformanceFrequency();
+    Uint64 t0 = UINT64_MAX;
+    bool first = true;
+
+    if ((fp = fopen(filename, "w")) == NULL) {
+        perror("Error opening trace file");
+        return false;
+    }
+
+    // Buffers may still be written to while we export. Events that get
+    // overwritten under our feet come out garbled at worst.
+    // spans are recorded when they end, so the earliest begin can be anywhere
+    for (buf = SDL_AtomicGetPtr((void **) &all_buffers); buf; buf = buf->next) {
+        int head = SDL_AtomicGet(&buf->head);
+        int first_ev = head > TRACE_BUFFER_EVENTS ? head - TRACE_BUFFER_EVENTS : 0;
+        for (int i=first_ev; i<head; ++i) {
+            if (buf->events[i & (TRACE_BUFFER_EVENTS - 1)].begin < t0)
+                t0 = buf->events[i & (TRACE_BUFFER_EVENTS - 1)].begin;
+        }
+    }
+
+    fputs("{\"displayTimeUnit\": \"ms\", \"traceEvents\": [", fp);
+
+    for (buf = SDL_AtomicGetPtr((void **) &all_buffers); buf; buf = buf->next) {
+        int head = SDL_AtomicGet(&buf->head);
+        int first_ev = head > TRACE_BUFFER_EVENTS ? head - TRACE_BUFFER_EVENTS : 0;
+
+        if (buf->thread_name != NULL) {
+            fprintf(fp, "%s\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, "
+                        "\"tid\": %d, \"args\": {\"name\": \"%s\"}}",
+                    first ? "" : ",", buf->tid, buf->thread_name);
+            first = false;
+        }
+
+        for (int i=first_ev; i<head; ++i) {
+            const struct trace_event *ev = &buf->events[i & (TRACE_BUFFER_EVENTS - 1)];
+            if (ev->begin < t0) continue; /* overwritten while we were looking */
+            fprintf(fp, "%s\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, "
+                        "\"ts\": %.3f, \"dur\": %.3f}",
+                    first ? "" : ",", ev->name, buf->tid,
+                    (ev->begin - t0) * us_per_tick,
+                    (ev->end - ev->begin) * us_per_tick);
+            first = false;
+        }
+    }
+
+    fputs("\n]}\n", fp);
+    fclose(fp);
+
+    return true;
+}
+
+#else /* ! ENABLE_TRACING */
+
+void trace_begin(const char *const name) { (void) name; }
+void trace_end() { }
+void trace_thread_name(const char *const name) { (void) name; }
+
+bool trace_export_chrome(const char *const filename)
+{
+    (void) filename;
+    SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                 "Tracing is not compiled in (configure with -DENABLE_TRACING=ON)\n");
+    return false;
+}
+
+#endif /* ENABLE_TRACING */
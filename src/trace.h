@@ -0,0 +1,39 @@
+/*
+    trace.h
+
+    low-overhead span tracing with Chrome trace export
+
+    Spans are recorded into a per-thread ring buffer, so only the most
+    recent TRACE_BUFFER_EVENTS spans of each thread survive. Span names
+    must be string literals (or otherwise live forever).
+    Configure with -DENABLE_TRACING=ON; otherwise the macros compile to
+    nothing.
+*/
+
+#ifndef TRAMPBALL_TRACE_H
+#define TRAMPBALL_TRACE_H
+
+#include <stdbool.h>
+#include "config.h"
+
+#define TRACE_BUFFER_EVENTS 65536 /* per thread, power of two */
+#define TRACE_MAX_DEPTH 32
+
+#ifdef ENABLE_TRACING
+#  define TRACE_BEGIN(name) trace_begin(name)
+#  define TRACE_END() trace_end()
+#  define TRACE_THREAD_NAME(name) trace_thread_name(name)
+#else
+#  define TRACE_BEGIN(name) ((void) 0)
+#  define TRACE_END() ((void) 0)
+#  define TRACE_THREAD_NAME(name) ((void) 0)
+#endif
+
+void trace_begin(const char *const name);
+void trace_end();
+void trace_thread_name(const char *const name);
+
+/* returns false if tracing is compiled out or the file can't be written */
+bool trace_export_chrome(const char *const filename);
+
+#endif /* TRAMPBALL_TRACE_H */
@@ -0,0 +1,255 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trajlog.h"
+#include "args.h"
+#include "tool.h"
+
+enum dump_table { TABLE_STEPS, TABLE_BALLS, TABLE_TRAMPOLINES, TABLE_ANCHORS };
+
+static const char *const table_names[] = { "steps", "balls", "trampolines", "anchors", NULL };
+
+static void print_csv_header(FILE *const out, enum dump_table table)
+{
+    switch (table) {
+    case TABLE_STEPS:
+        fprintf(out, "step,substeps,balls,trampolines,anchors\n");
+        break;
+    case TABLE_BALLS:
+        fprintf(out, "step,ball,x,y,vx,vy\n");
+        break;
+    case TABLE_TRAMPOLINES:
+        fprintf(out, "step,trampoline,contacts\n");
+        break;
+    case TABLE_ANCHORS:
+        fprintf(out, "step,anchor,dx,dy\n");
+        break;
+    }
+}
+
+static void print_csv_chunk(FILE *const out, enum dump_table table,
+                            const struct trajlog_chunk *const c)
+{
+    trajlog_word *const *col = c->columns;
+    uint32_t first = 0;
+
+    for (uint32_t i=0; i<c->n_steps; ++i) {
+        uint32_t step = col[TRAJLOG_STEP][i].u;
+        uint32_t n;
+
+        switch (table) {
+        case TABLE_STEPS:
+            fprintf(out, "%u,%u,%u,%u,%u\n", step, col[TRAJLOG_SUBSTEPS][i].u,
+                    col[TRAJLOG_BALLS][i].u, col[TRAJLOG_TRAMPOLINES][i].u,
+                    col[TRAJLOG_ANCHORS][i].u);
+            break;
+        case TABLE_BALLS:
+            n = col[TRAJLOG_BALLS][i].u;
+            for (uint32_t j=0; j<n; ++j) {
+                fprintf(out, "%u,%u,%.9g,%.9g,%.9g,%.9g\n", step, j,
+                        col[TRAJLOG_BALL_X][first + j].f, col[TRAJLOG_BALL_Y][first + j].f,
+                        col[TRAJLOG_BALL_VX][first + j].f, col[TRAJLOG_BALL_VY][first + j].f);
+            }
+            first += n;
+            break;
+        case TABLE_TRAMPOLINES:
+            n = col[TRAJLOG_TRAMPOLINES][i].u;
+            for (uint32_t j=0; j<n; ++j)
+                fprintf(out, "%u,%u,%u\n", step, j, col[TRAJLOG_CONTACTS][first + j].u);
+            first += n;
+            break;
+        case TABLE_ANCHORS:
+            n = col[TRAJLOG_ANCHORS][i].u;
+            for (uint32_t j=0; j<n; ++j) {
+                fprintf(out, "%u,%u,%.9g,%.9g\n", step, j, col[TRAJLOG_ANCHOR_DX][first + j].f,
+                        col[TRAJLOG_ANCHOR_DY][first + j].f);
+            }
+            first += n;
+            break;
+        }
+    }
+}
+
+static int list_columns(FILE *const fp, const char *const filename, FILE *const out)
+{
+    struct trajlog_chunk c = { 0 };
+    uint64_t values[TRAJLOG_N_COLUMNS] = { 0 }, bytes[TRAJLOG_N_COLUMNS] = { 0 };
+    uint64_t steps = 0;
+    long chunks = 0;
+    int res;
+
+    while ((res = skip_trajlog_chunk(fp, filename, &c)) > 0) {
+        ++chunks;
+        steps += c.n_steps;
+        for (int col=0; col<TRAJLOG_N_COLUMNS; ++col) {
+            values[col] += c.n_values[col];
+            bytes[col] += c.n_bytes[col];
+        }
+    }
+    if (res < 0) return 1;
+
+    fprintf(out, "%llu steps in %ld chunks\n", (unsigned long long) steps, chunks);
+    fprintf(out, "%-12s %-5s %12s %12s %7s\n", "column", "type", "values", "bytes", "ratio");
+    for (int col=0; col<TRAJLOG_N_COLUMNS; ++col) {
+        fprintf(out, "%-12s %-5s %12llu %12llu %7.2f\n", trajlog_columns[col].name,
+                trajlog_columns[col].is_float ? "f4" : "u4", (unsigned long long) values[col],
+                (unsigned long long) bytes[col],
+                bytes[col] > 0 ? 4.0 * values[col] / bytes[col] : 0.0);
+    }
+    return 0;
+}
+
+/* a 1-D array per column, as NumPy's .npy format version 1.0 has it */
+static FILE *open_npy(const char *const dir, int col, uint64_t n_values)
+{
+    char filename[4096], header[128];
+    FILE *fp;
+
+    snprintf(filename, sizeof(filename), "%s/%s.npy", dir, trajlog_columns[col].name);
+    if ((fp = fopen(filename, "wb")) == NULL) {
+        perror(filename);
+        return NULL;
+    }
+
+    int len = snprintf(header, sizeof(header),
+                       "{'descr': '%s', 'fortran_order': False, 'shape': (%llu,), }",
+                       trajlog_columns[col].is_float ? "<f4" : "<u4",
+                       (unsigned long long) n_values);
+    // padded with spaces and a newline, so that the data is 64-byte aligned
+    int padded = (10 + len + 1 + 63) / 64 * 64 - 10;
+    memset(header + len, ' ', padded - len - 1);
+    header[padded - 1] = '\n';
+
+    const unsigned char magic[10] = { 0x93, 'N', 'U', 'M', 'P', 'Y', 1, 0,
+                                      padded & 0xff, padded >> 8 };
+    if (fwrite(magic, 1, 10, fp) != 10 || fwrite(header, 1, padded, fp) != (size_t) padded) {
+        perror(filename);
+        fclose(fp);
+        return NULL;
+    }
+    return fp;
+}
+
+static int write_npy(FILE *const fp, const char *const filename, const char *const dir)
+{
+    struct trajlog_chunk c = { 0 };
+    uint64_t values[TRAJLOG_N_COLUMNS] = { 0 };
+    FILE *out[TRAJLOG_N_COLUMNS] = { NULL };
+    long data_start = ftell(fp);
+    int res, status = 1;
+
+    // the headers need the lengths up front
+    while ((res = skip_trajlog_chunk(fp, filename, &c)) > 0) {
+        for (int col=0; col<TRAJLOG_N_COLUMNS; ++col)
+            values[col] += c.n_values[col];
+    }
+    if (res < 0) return 1;
+    if (fseek(fp, data_start, SEEK_SET) != 0) {
+        perror(filename);
+        return 1;
+    }
+
+    for (int col=0; col<TRAJLOG_N_COLUMNS; ++col) {
+        if ((out[col] = open_npy(dir, col, values[col])) == NULL)
+            goto done;
+    }
+
+    while ((res = read_trajlog_chunk(fp, filename, &c)) > 0) {
+        for (int col=0; col<TRAJLOG_N_COLUMNS; ++col) {
+            for (uint32_t i=0; i<c.n_values[col]; ++i) {
+                uint32_t u = c.columns[col][i].u;
+                unsigned char le[4] = { u, u >> 8, u >> 16, u >> 24 };
+                fwrite(le, 1, 4, out[col]);
+            }
+        }
+    }
+    if (res == 0) status = 0;
+
+done:
+    for (int col=0; col<TRAJLOG_N_COLUMNS; ++col) {
+        if (out[col] != NULL && (ferror(out[col]) | fclose(out[col])) != 0) {
+            fprintf(stderr, "%s/%s.npy: write error\n", dir, trajlog_columns[col].name);
+            status = 1;
+        }
+    }
+    free_trajlog_chunk(&c);
+    if (status == 0)
+        printf("wrote %d columns to %s/\n", TRAJLOG_N_COLUMNS, dir);
+    return status;
+}
+
+int trajdump_main(int argc, char *argv[])
+{
+    char *flags[] = { "help", "list", NULL };
+    char *opts[] = { "table", "output", "npy", NULL };
+    bool flag_states[2];
+    char *opt_vals[3];
+    char *filename;
+    enum dump_table table = TABLE_STEPS;
+    FILE *fp, *out = stdout;
+    int status = 0, res;
+
+    int n_args = parse_args(argc, argv, flags, opts, 1, flag_states, opt_vals, &filename);
+
+    if (n_args != 1 || flag_states[0]) {
+        fprintf(stderr, "trampball-tool trajdump - read a trajectory log written with -trajlog\n"
+                        "\n"
+                        "  Usage: trampball-tool trajdump [-table steps|balls|trampolines|anchors]\n"
+                        "         [-output table.csv] trajectory.tbt\n"
+                        "     or: trampball-tool trajdump -npy DIR trajectory.tbt\n"
+                        "     or: trampball-tool trajdump -list trajectory.tbt\n"
+                        "\n"
+                        "  The first form prints one of the tables as CSV. -npy writes every\n"
+                        "  column to DIR/<column>.npy as a flat array: split the per-ball,\n"
+                        "  per-trampoline and per-anchor ones by the balls, trampolines and\n"
+                        "  anchors counts, e.g. with numpy.split(x, numpy.cumsum(n)[:-1]).\n"
+                        "  -list shows the columns and how well they compressed.\n");
+        return flag_states[0] ? 0 : 2;
+    }
+
+    if (opt_vals[0] != NULL) {
+        int i;
+        for (i=0; table_names[i] != NULL && strcmp(table_names[i], opt_vals[0]) != 0; ++i)
+            ;
+        if (table_names[i] == NULL) {
+            fprintf(stderr, "no such table: %s\n", opt_vals[0]);
+            return 2;
+        }
+        table = i;
+    }
+
+    if ((fp = fopen(filename, "rb")) == NULL) {
+        perror(filename);
+        return 1;
+    }
+    if (!read_trajlog_header(fp, filename)) {
+        fclose(fp);
+        return 1;
+    }
+    if (opt_vals[1] != NULL && (out = fopen(opt_vals[1], "w")) == NULL) {
+        perror(opt_vals[1]);
+        fclose(fp);
+        return 1;
+    }
+
+    if (flag_states[1]) {
+        status = list_columns(fp, filename, out);
+    } else if (opt_vals[2] != NULL) {
+        status = write_npy(fp, filename, opt_vals[2]);
+    } else {
+        struct trajlog_chunk c = { 0 };
+        print_csv_header(out, table);
+        while ((res = read_trajlog_chunk(fp, filename, &c)) > 0)
+            print_csv_chunk(out, table, &c);
+        if (res < 0) status = 1;
+        free_trajlog_chunk(&c);
+    }
+
+    fclose(fp);
+    if (out != stdout && fclose(out) != 0) {
+        perror(opt_vals[1]);
+        status = 1;
+    }
+    return status;
+}
@@ -0,0 +1,541 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <SDL.h>
+
+#include "trajlog.h"
+#include "alloc.h"
+
+const struct trajlog_column_info trajlog_columns[TRAJLOG_N_COLUMNS] = {
+    { "step", false, -1 },
+    { "substeps", false, -1 },
+    { "balls", false, -1 },
+    { "trampolines", false, -1 },
+    { "anchors", false, -1 },
+    { "ball_x", true, TRAJLOG_BALLS },
+    { "ball_y", true, TRAJLOG_BALLS },
+    { "ball_vx", true, TRAJLOG_BALLS },
+    { "ball_vy", true, TRAJLOG_BALLS },
+    { "contacts", false, TRAJLOG_TRAMPOLINES },
+    { "anchor_dx", true, TRAJLOG_ANCHORS },
+    { "anchor_dy", true, TRAJLOG_ANCHORS },
+};
+
+#define FILE_HEADER_BYTES 16
+#define COLUMN_HEADER_WORDS 4
+/* xor+RLE never takes more than a varint and a word per word */
+#define ENCODED_BOUND(n_words) (5 * (size_t) (n_words) + 5)
+
+struct trajectory_log {
+    FILE *fp;
+    char *filename;
+    bool compress;
+    struct trajlog_chunk chunks[2];
+    int filling;                /* the chunk steps are appended to */
+    uint32_t step;
+    uint64_t dropped_steps;     /* both only touched by the stepping thread */
+    uint8_t *encoded;           /* the writer thread's */
+
+    /* protected by lock */
+    struct trajlog_chunk *pending;  /* handed to the writer, or NULL */
+    bool quit, failed;
+
+    SDL_mutex *lock;
+    SDL_cond *changed;          /* pending went, or quit */
+    SDL_Thread *thread;
+};
+
+static void put_le32(uint8_t *const p, uint32_t x)
+{
+    p[0] = x;
+    p[1] = x >> 8;
+    p[2] = x >> 16;
+    p[3] = x >> 24;
+}
+
+static uint32_t get_le32(const uint8_t *const p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static size_t put_varint(uint8_t *const p, uint32_t x)
+{
+    size_t n = 0;
+    for (; x >= 0x80; x >>= 7)
+        p[n++] = (x & 0x7f) | 0x80;
+    p[n++] = x;
+    return n;
+}
+
+static bool get_varint(const uint8_t *const p, size_t len, size_t *const pos, uint32_t *const x)
+{
+    *x = 0;
+    for (int shift = 0; shift < 35 && *pos < len; shift += 7) {
+        uint8_t b = p[(*pos)++];
+        *x |= (uint32_t) (b & 0x7f) << shift;
+        if (!(b & 0x80)) return true;
+    }
+    return false;
+}
+
+static inline uint32_t xored(const trajlog_word *const w, uint32_t i, uint32_t stride)
+{
+    return w[i].u ^ (i >= stride ? w[i - stride].u : 0);
+}
+
+static size_t encode_xor_rle(const trajlog_word *const w, uint32_t n, uint32_t stride,
+                             uint8_t *const out)
+{
+    size_t len = 0;
+
+    for (uint32_t i = 0; i < n; ) {
+        bool zero = xored(w, i, stride) == 0;
+        uint32_t j = i + 1;
+        while (j < n && (xored(w, j, stride) == 0) == zero) ++j;
+
+        len += put_varint(out + len, ((j - i) << 1) | zero);
+        for (; !zero && i < j; ++i, len += 4)
+            put_le32(out + len, xored(w, i, stride));
+        i = j;
+    }
+    return len;
+}
+
+static bool decode_xor_rle(const uint8_t *const in, size_t len, uint32_t n, uint32_t stride,
+                           trajlog_word *const w)
+{
+    size_t pos = 0;
+
+    for (uint32_t i = 0; i < n; ) {
+        uint32_t token, run;
+        if (!get_varint(in, len, &pos, &token)) return false;
+        run = token >> 1;
+        if (run == 0 || run > n - i) return false;
+        if (!(token & 1) && (len - pos) / 4 < run) return false;
+
+        for (uint32_t end = i + run; i < end; ++i) {
+            w[i].u = (i >= stride ? w[i - stride].u : 0);
+            if (!(token & 1)) {
+                w[i].u ^= get_le32(in + pos);
+                pos += 4;
+            }
+        }
+    }
+    return pos == len;
+}
+
+/* the same object one step back, if the chunk's counts allow for it */
+static uint32_t column_stride(const struct trajlog_chunk *const c, int col)
+{
+    int count_col = trajlog_columns[col].count_column;
+    if (count_col < 0 || c->n_steps == 0) return 1;
+
+    uint32_t k = c->columns[count_col][0].u;
+    for (uint32_t i=1; i<c->n_steps; ++i) {
+        if (c->columns[count_col][i].u != k) return 1;
+    }
+    return k > 0 ? k : 1;
+}
+
+static bool write_chunk(struct trajectory_log *const log, const struct trajlog_chunk *const c)
+{
+    uint8_t header[4 + 4 * COLUMN_HEADER_WORDS * TRAJLOG_N_COLUMNS];
+    size_t offsets[TRAJLOG_N_COLUMNS + 1];
+
+    put_le32(header, c->n_steps);
+    offsets[0] = 0;
+    for (int col=0; col<TRAJLOG_N_COLUMNS; ++col) {
+        uint8_t *h = header + 4 + 4 * COLUMN_HEADER_WORDS * col;
+        uint8_t *out = log->encoded + offsets[col];
+        uint32_t stride = 0, n = c->n_values[col];
+        size_t len;
+
+        if (log->compress) {
+            stride = column_stride(c, col);
+            len = encode_xor_rle(c->columns[col], n, stride, out);
+        } else {
+            for (uint32_t i=0; i<n; ++i)
+                put_le32(out + 4*i, c->columns[col][i].u);
+            len = 4 * (size_t) n;
+        }
+        offsets[col + 1] = offsets[col] + len;
+
+        put_le32(h, log->compress ? TRAJLOG_XOR_RLE : TRAJLOG_RAW);
+        put_le32(h + 4, stride);
+        put_le32(h + 8, n);
+        put_le32(h + 12, len);
+    }
+
+    return fwrite(header, 1, sizeof(header), log->fp) == sizeof(header) &&
+           fwrite(log->encoded, 1, offsets[TRAJLOG_N_COLUMNS], log->fp) ==
+               offsets[TRAJLOG_N_COLUMNS];
+}
+
+static void reset_chunk(struct trajlog_chunk *const c)
+{
+    c->n_steps = 0;
+    memset(c->n_values, 0, sizeof(c->n_values));
+}
+
+static int writer_main(void *data)
+{
+    struct trajectory_log *log = data;
+
+    SDL_LockMutex(log->lock);
+    for (;;) {
+        while (log->pending == NULL && !log->quit)
+            SDL_CondWait(log->changed, log->lock);
+        if (log->pending == NULL) break;
+        struct trajlog_chunk *c = log->pending;
+        SDL_UnlockMutex(log->lock);
+
+        bool ok = write_chunk(log, c);
+        reset_chunk(c);
+
+        SDL_LockMutex(log->lock);
+        log->pending = NULL;
+        if (!ok) log->failed = true;
+        SDL_CondBroadcast(log->changed);
+    }
+    SDL_UnlockMutex(log->lock);
+
+    return 0;
+}
+
+/* on to the other chunk, if the writer is done with it */
+static void hand_over_chunk(struct trajectory_log *const log)
+{
+    struct trajlog_chunk *c = &log->chunks[log->filling];
+    bool busy;
+
+    SDL_LockMutex(log->lock);
+    busy = log->pending != NULL;
+    if (!busy) {
+        log->pending = c;
+        SDL_CondBroadcast(log->changed);
+    }
+    SDL_UnlockMutex(log->lock);
+
+    if (busy) {
+        log->dropped_steps += c->n_steps;
+        reset_chunk(c);
+    } else {
+        log->filling ^= 1;
+    }
+}
+
+struct trajectory_log *new_trajectory_log(const char *const filename,
+                                          const struct world *const world, bool compress)
+{
+    struct trajectory_log *log = TB_CALLOC(ALLOC_OTHER, 1, sizeof(struct trajectory_log));
+    uint32_t per_step[TRAJLOG_N_COLUMNS];
+    uint32_t n_balls = 0, n_trampolines = 0, n_anchors = 0;
+    size_t encoded_size = 0;
+    uint8_t header[FILE_HEADER_BYTES] = { 0 };
+
+    for (const struct ball_list *bl = world->balls; bl; bl = bl->next)
+        ++n_balls;
+    for (const struct trampoline_list *tl = world->trampolines; tl; tl = tl->next) {
+        ++n_trampolines;
+        n_anchors += tl->t->max_anchors;
+    }
+
+    // room to grow, for reloading and streaming
+    per_step[TRAJLOG_BALLS] = n_balls < 8 ? 16 : 2 * n_balls;
+    per_step[TRAJLOG_TRAMPOLINES] = n_trampolines < 2 ? 4 : 2 * n_trampolines;
+    per_step[TRAJLOG_ANCHORS] = n_anchors < 128 ? 256 : 2 * n_anchors;
+
+    log->compress = compress;
+    log->filename = TB_MALLOC(ALLOC_OTHER, strlen(filename) + 1);
+    strcpy(log->filename, filename);
+
+    for (int col=0; col<TRAJLOG_N_COLUMNS; ++col) {
+        int count_col = trajlog_columns[col].count_column;
+        uint32_t capacity = TRAJLOG_CHUNK_STEPS * (count_col < 0 ? 1 : per_step[count_col]);
+
+        for (int i=0; i<2; ++i) {
+            log->chunks[i].capacity[col] = capacity;
+            log->chunks[i].columns[col] = TB_MALLOC(ALLOC_OTHER, capacity * sizeof(trajlog_word));
+            if (log->chunks[i].columns[col] == NULL) goto fail;
+        }
+        encoded_size += ENCODED_BOUND(capacity);
+    }
+    if ((log->encoded = TB_MALLOC(ALLOC_OTHER, encoded_size)) == NULL) goto fail;
+
+    if ((log->fp = fopen(filename, "wb")) == NULL) {
+        perror(filename);
+        goto fail;
+    }
+    memcpy(header, TRAJLOG_MAGIC, sizeof(TRAJLOG_MAGIC));
+    put_le32(header + 8, TRAJLOG_VERSION);
+    put_le32(header + 12, TRAJLOG_N_COLUMNS);
+    if (fwrite(header, 1, sizeof(header), log->fp) != sizeof(header)) {
+        perror(filename);
+        goto fail;
+    }
+
+    if ((log->lock = SDL_CreateMutex()) == NULL ||
+        (log->changed = SDL_CreateCond()) == NULL ||
+        (log->thread = SDL_CreateThread(writer_main, "trajlog", log)) == NULL) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Can't start the log writer - %s\n",
+                     SDL_GetError());
+        goto fail;
+    }
+
+    return log;
+
+fail:
+    free_trajectory_log(log);
+    return NULL;
+}
+
+static inline void append(struct trajlog_chunk *const c, int col, uint32_t u)
+{
+    c->columns[col][c->n_values[col]++].u = u;
+}
+
+static inline void append_float(struct trajlog_chunk *const c, int col, float f)
+{
+    c->columns[col][c->n_values[col]++].f = f;
+}
+
+static inline uint32_t room(const struct trajlog_chunk *const c, int col)
+{
+    return c->capacity[col] - c->n_values[col];
+}
+
+void log_trajectory_step(struct trajectory_log *const log, const struct world *const world,
+                         int substeps)
+{
+    struct trajlog_chunk *c = &log->chunks[log->filling];
+    uint32_t n_balls = 0, n_trampolines = 0, n_anchors = 0;
+
+    for (const struct ball_list *bl = world->balls; bl; bl = bl->next)
+        ++n_balls;
+    for (const struct trampoline_list *tl = world->trampolines; tl; tl = tl->next) {
+        ++n_trampolines;
+        n_anchors += tl->t->n_anchors;
+    }
+
+    if (c->n_steps > 0 &&
+        (n_balls > room(c, TRAJLOG_BALL_X) || n_trampolines > room(c, TRAJLOG_CONTACTS) ||
+         n_anchors > room(c, TRAJLOG_ANCHOR_DX))) {
+        hand_over_chunk(log);
+        c = &log->chunks[log->filling];
+    }
+    if (n_balls > room(c, TRAJLOG_BALL_X)) n_balls = room(c, TRAJLOG_BALL_X);
+    if (n_trampolines > room(c, TRAJLOG_CONTACTS)) n_trampolines = room(c, TRAJLOG_CONTACTS);
+    if (n_anchors > room(c, TRAJLOG_ANCHOR_DX)) n_anchors = room(c, TRAJLOG_ANCHOR_DX);
+
+    append(c, TRAJLOG_STEP, log->step++);
+    append(c, TRAJLOG_SUBSTEPS, substeps);
+    append(c, TRAJLOG_BALLS, n_balls);
+    append(c, TRAJLOG_TRAMPOLINES, n_trampolines);
+    append(c, TRAJLOG_ANCHORS, n_anchors);
+
+    const struct ball_list *bl = world->balls;
+    for (uint32_t i=0; i<n_balls; ++i, bl = bl->next) {
+        append_float(c, TRAJLOG_BALL_X, bl->b->position.x);
+        append_float(c, TRAJLOG_BALL_Y, bl->b->position.y);
+        append_float(c, TRAJLOG_BALL_VX, bl->b->speed.x);
+        append_float(c, TRAJLOG_BALL_VY, bl->b->speed.y);
+    }
+
+    const struct trampoline_list *tl = world->trampolines;
+    uint32_t anchors_left = n_anchors;
+    for (uint32_t i=0; i<n_trampolines; ++i, tl = tl->next) {
+        const trampoline *t = tl->t;
+        uint32_t contacts = 0;
+
+        for (const attachment *a = t->attached_objects; a; a = a->next)
+            contacts += a->n_contacts;
+        append(c, TRAJLOG_CONTACTS, contacts);
+
+        for (int j=0; j<t->n_anchors && anchors_left > 0; ++j, --anchors_left) {
+            append_float(c, TRAJLOG_ANCHOR_DX, t->offsets[j].x);
+            append_float(c, TRAJLOG_ANCHOR_DY, t->offsets[j].y);
+        }
+    }
+
+    if (++c->n_steps == TRAJLOG_CHUNK_STEPS)
+        hand_over_chunk(log);
+}
+
+bool free_trajectory_log(struct trajectory_log *const log)
+{
+    bool ok = true;
+
+    if (log->thread != NULL) {
+        struct trajlog_chunk *c = &log->chunks[log->filling];
+
+        SDL_LockMutex(log->lock);
+        // the last, partly filled chunk is worth waiting for
+        while (log->pending != NULL)
+            SDL_CondWait(log->changed, log->lock);
+        if (c->n_steps > 0) log->pending = c;
+        log->quit = true;
+        SDL_CondBroadcast(log->changed);
+        SDL_UnlockMutex(log->lock);
+        SDL_WaitThread(log->thread, NULL);
+        ok = !log->failed;
+    } else {
+        ok = false;
+    }
+
+    if (log->failed)
+        fprintf(stderr, "%s: error writing the trajectory log\n", log->filename);
+    if (log->fp != NULL && fclose(log->fp) != 0) {
+        perror(log->filename);
+        ok = false;
+    }
+    if (log->dropped_steps > 0) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "%s: %llu steps weren't logged, the disk couldn't keep up\n",
+                    log->filename, (unsigned long long) log->dropped_steps);
+    }
+
+    if (log->changed != NULL) SDL_DestroyCond(log->changed);
+    if (log->lock != NULL) SDL_DestroyMutex(log->lock);
+    for (int i=0; i<2; ++i)
+        free_trajlog_chunk(&log->chunks[i]);
+    TB_FREE(log->encoded);
+    TB_FREE(log->filename);
+    TB_FREE(log);
+    return ok;
+}
+
+bool read_trajlog_header(FILE *const fp, const char *const filename)
+{
+    uint8_t header[FILE_HEADER_BYTES];
+
+    if (fread(header, 1, sizeof(header), fp) != sizeof(header) ||
+        memcmp(header, TRAJLOG_MAGIC, sizeof(TRAJLOG_MAGIC)) != 0) {
+        fprintf(stderr, "%s: not a trajectory log\n", filename);
+        return false;
+    }
+    if (get_le32(header + 8) != TRAJLOG_VERSION ||
+        get_le32(header + 12) != TRAJLOG_N_COLUMNS) {
+        fprintf(stderr, "%s: trajectory log version %u with %u columns; this is version "
+                        "%d with %d\n", filename, get_le32(header + 8), get_le32(header + 12),
+                TRAJLOG_VERSION, TRAJLOG_N_COLUMNS);
+        return false;
+    }
+    return true;
+}
+
+static int read_chunk_header(FILE *const fp, const char *const filename,
+                             struct trajlog_chunk *const c, uint32_t *const encodings,
+                             uint32_t *const strides)
+{
+    uint8_t header[4 + 4 * COLUMN_HEADER_WORDS * TRAJLOG_N_COLUMNS];
+    size_t got = fread(header, 1, sizeof(header), fp);
+
+    if (got == 0 && feof(fp)) return 0;
+    if (got != sizeof(header)) {
+        fprintf(stderr, "%s: truncated\n", filename);
+        return -1;
+    }
+
+    c->n_steps = get_le32(header);
+    for (int col=0; col<TRAJLOG_N_COLUMNS; ++col) {
+        const uint8_t *h = header + 4 + 4 * COLUMN_HEADER_WORDS * col;
+        encodings[col] = get_le32(h);
+        strides[col] = get_le32(h + 4);
+        c->n_values[col] = get_le32(h + 8);
+        c->n_bytes[col] = get_le32(h + 12);
+
+        bool ok = (trajlog_columns[col].count_column >= 0 || c->n_values[col] == c->n_steps);
+        if (encodings[col] == TRAJLOG_RAW)
+            ok = ok && c->n_bytes[col] == 4 * (size_t) c->n_values[col];
+        else if (encodings[col] == TRAJLOG_XOR_RLE)
+            ok = ok && strides[col] >= 1 && c->n_bytes[col] <= ENCODED_BOUND(c->n_values[col]);
+        else
+            ok = false;
+        if (!ok) {
+            fprintf(stderr, "%s: bad header for column %s\n", filename,
+                    trajlog_columns[col].name);
+            return -1;
+        }
+    }
+    return 1;
+}
+
+int skip_trajlog_chunk(FILE *const fp, const char *const filename,
+                       struct trajlog_chunk *const chunk)
+{
+    uint32_t encodings[TRAJLOG_N_COLUMNS], strides[TRAJLOG_N_COLUMNS];
+    int res = read_chunk_header(fp, filename, chunk, encodings, strides);
+    long skip = 0;
+
+    if (res <= 0) return res;
+    for (int col=0; col<TRAJLOG_N_COLUMNS; ++col)
+        skip += chunk->n_bytes[col];
+    if (fseek(fp, skip, SEEK_CUR) != 0) {
+        perror(filename);
+        return -1;
+    }
+    return 1;
+}
+
+int read_trajlog_chunk(FILE *const fp, const char *const filename,
+                       struct trajlog_chunk *const chunk)
+{
+    uint32_t encodings[TRAJLOG_N_COLUMNS], strides[TRAJLOG_N_COLUMNS];
+    int res = read_chunk_header(fp, filename, chunk, encodings, strides);
+
+    if (res <= 0) return res;
+
+    for (int col=0; col<TRAJLOG_N_COLUMNS; ++col) {
+        uint32_t n = chunk->n_values[col];
+        size_t len = chunk->n_bytes[col];
+
+        if (n > chunk->capacity[col]) {
+            chunk->columns[col] = TB_REALLOC(ALLOC_OTHER, chunk->columns[col],
+                                             n * sizeof(trajlog_word));
+            chunk->capacity[col] = n;
+        }
+        if (len > chunk->scratch_size) {
+            chunk->scratch = TB_REALLOC(ALLOC_OTHER, chunk->scratch, len);
+            chunk->scratch_size = len;
+        }
+        if (fread(chunk->scratch, 1, len, fp) != len) {
+            fprintf(stderr, "%s: truncated\n", filename);
+            return -1;
+        }
+
+        if (encodings[col] == TRAJLOG_RAW) {
+            for (uint32_t i=0; i<n; ++i)
+                chunk->columns[col][i].u = get_le32(chunk->scratch + 4*i);
+        } else if (!decode_xor_rle(chunk->scratch, len, n, strides[col], chunk->columns[col])) {
+            fprintf(stderr, "%s: column %s is corrupt\n", filename, trajlog_columns[col].name);
+            return -1;
+        }
+    }
+
+    // the counts have to add up
+    for (int col=0; col<TRAJLOG_N_COLUMNS; ++col) {
+        int count_col = trajlog_columns[col].count_column;
+        uint64_t total = 0;
+        if (count_col < 0) continue;
+        for (uint32_t i=0; i<chunk->n_steps; ++i)
+            total += chunk->columns[count_col][i].u;
+        if (total != chunk->n_values[col]) {
+            fprintf(stderr, "%s: column %s doesn't match %s\n", filename,
+                    trajlog_columns[col].name, trajlog_columns[count_col].name);
+            return -1;
+        }
+    }
+    return 1;
+}
+
+void free_trajlog_chunk(struct trajlog_chunk *const chunk)
+{
+    for (int col=0; col<TRAJLOG_N_COLUMNS; ++col) {
+        TB_FREE(chunk->columns[col]);
+        chunk->columns[col] = NULL;
+        chunk->capacity[col] = 0;
+    }
+    TB_FREE(chunk->scratch);
+    chunk->scratch = NULL;
+    chunk->scratch_size = 0;
+}
@@ -0,0 +1,118 @@
+/*
+    trajlog.h
+
+    per-step trajectory logging to a columnar binary file
+
+    Each step's values are appended to in-memory columns, one per field.
+    Every TRAJLOG_CHUNK_STEPS steps the filled chunk is handed to a
+    writer thread, and logging carries on into a second one: the
+    simulation never waits for the disk. If the writer hasn't finished
+    with the other chunk by then, the chunk that just filled up is
+    dropped (and counted) rather than waited for.
+
+    File layout, all little-endian:
+
+        "TBTRAJ\0" version n_columns              (8 bytes, 2 x uint32)
+        chunks, each:
+            n_steps                               (uint32)
+            per column: encoding stride n_values n_bytes (4 x uint32)
+            per column: n_bytes of data
+
+    Columns hold 32-bit words: unsigned integers or floats. The per-step
+    columns have one value per step; the others have one value per ball,
+    trampoline or anchor, in list order, as many as the matching count
+    column says for that step. Encoded columns (TRAJLOG_XOR_RLE) have
+    each word xor'ed with the word stride places before it (the same
+    object one step earlier, if the counts didn't change during the
+    chunk), and runs of zero words replaced by their length.
+*/
+
+#ifndef TRAMPBALL_TRAJLOG_H
+#define TRAMPBALL_TRAJLOG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "game.h"
+
+#define TRAJLOG_MAGIC "TBTRAJ"
+#define TRAJLOG_VERSION 1
+#define TRAJLOG_CHUNK_STEPS 256
+
+enum trajlog_column {
+    /* one per step */
+    TRAJLOG_STEP,
+    TRAJLOG_SUBSTEPS,           /* trampoline substeps taken */
+    TRAJLOG_BALLS,
+    TRAJLOG_TRAMPOLINES,
+    TRAJLOG_ANCHORS,
+    /* one per ball */
+    TRAJLOG_BALL_X,
+    TRAJLOG_BALL_Y,
+    TRAJLOG_BALL_VX,
+    TRAJLOG_BALL_VY,
+    /* one per trampoline: contact points over all its attachments */
+    TRAJLOG_CONTACTS,
+    /* one per anchor */
+    TRAJLOG_ANCHOR_DX,
+    TRAJLOG_ANCHOR_DY,
+    TRAJLOG_N_COLUMNS
+};
+
+enum trajlog_encoding { TRAJLOG_RAW, TRAJLOG_XOR_RLE };
+
+struct trajlog_column_info {
+    const char *name;
+    bool is_float;
+    /* the column with the per-step count of values, or -1 for one per step */
+    int count_column;
+};
+
+extern const struct trajlog_column_info trajlog_columns[TRAJLOG_N_COLUMNS];
+
+typedef union {
+    uint32_t u;
+    float f;
+} trajlog_word;
+
+/* a chunk of steps, decoded */
+struct trajlog_chunk {
+    uint32_t n_steps;
+    uint32_t n_values[TRAJLOG_N_COLUMNS];
+    uint32_t n_bytes[TRAJLOG_N_COLUMNS];    /* as stored */
+    uint32_t capacity[TRAJLOG_N_COLUMNS];
+    trajlog_word *columns[TRAJLOG_N_COLUMNS];
+    uint8_t *scratch;           /* for reading */
+    size_t scratch_size;
+};
+
+struct trajectory_log;
+
+/*
+ * Makes room for twice what the world holds now, for every step of a
+ * chunk. A step that doesn't fit starts a new chunk; one that wouldn't
+ * fit even so is logged in part, and the count columns say how much of
+ * it was. NULL on failure.
+ */
+struct trajectory_log *new_trajectory_log(const char *const filename,
+                                          const struct world *const world, bool compress);
+/* called after each step, on the thread doing the stepping. Allocates
+   nothing and never waits. */
+void log_trajectory_step(struct trajectory_log *const log, const struct world *const world,
+                         int substeps);
+/* writes out what's left; false if anything failed to be written */
+bool free_trajectory_log(struct trajectory_log *const log);
+
+/* reading it back */
+bool read_trajlog_header(FILE *const fp, const char *const filename);
+/* 1 if a chunk was read, 0 at the end of the file, -1 on error. The
+   chunk's columns grow as needed; free them with free_trajlog_chunk() */
+int read_trajlog_chunk(FILE *const fp, const char *const filename,
+                       struct trajlog_chunk *const chunk);
+/* just the sizes; the data is skipped */
+int skip_trajlog_chunk(FILE *const fp, const char *const filename,
+                       struct trajlog_chunk *const chunk);
+void free_trajlog_chunk(struct trajlog_chunk *const chunk);
+
+#endif /* TRAMPBALL_TRAJLOG_H */
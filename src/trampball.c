@@ -7,6 +7,18 @@
 
 #include "game.h"
 #include "font.h"
+#include "simthread.h"
+#include "histogram.h"
+#include "trace.h"
+#include "args.h"
+#include "stream.h"
+#include "reload.h"
+#include "alloc.h"
+#include "workers.h"
+#include "export.h"
+#include "shmstate.h"
+#include "trajlog.h"
+#include "assets.h"
 
 #include "trampball.h"
 
@@ -17,15 +29,37 @@
 #define DEFAULT_MOUSE_SPEED_SCALE 8
 #define DEFAULT_SCALING 1.0
 #define OVER_EDGE_MAX 1
+#define DEFAULT_STATS_PERIOD 1.0
+#define N_HUD_LINES 7
+/* fast-forwarding runs up to this many steps per tick */
+#define FAST_FORWARD_MAX 1024
+/* the share of each tick that fast-forwarding may use up */
+#define FAST_FORWARD_BUDGET 0.8
+#define DEFAULT_TRACE_FILE "trampball-trace.json"
+#define DEFAULT_EXPORT_FPS 30
+#define DEFAULT_EXPORT_FRAMES 300
 
 /* extern variables */
 
 uint8_t game_mode = 0;
+struct world *game_world = NULL;
 SDL_Point origin;
 int WINDOW_WIDTH = DEFAULT_WINDOW_WIDTH;
 int WINDOW_HEIGHT = DEFAULT_WINDOW_HEIGHT;
 double SCALING = DEFAULT_SCALING;
 double UI_SCALING = DEFAULT_SCALING;
+int STREAM_CHUNK_SIZE = 0; /* 0: load the whole world up front */
+bool WATCH_WORLD_FILE = true;
+bool STRICT_ALLOC = false;
+int SIM_THREADS = 1;
+int SOLVER_ITERATIONS = BALL_SOLVER_ITERATIONS;
+const char *ASSET_PACK_FILENAME = ASSET_PACK;
+const char *EXPORT_FILENAME = NULL;
+const char *SHM_STATE_NAME = NULL;
+const char *TRAJECTORY_LOG_FILENAME = NULL;
+bool TRAJECTORY_LOG_COMPRESS = false;
+double EXPORT_FPS = DEFAULT_EXPORT_FPS;
+int EXPORT_FRAMES = DEFAULT_EXPORT_FRAMES;
 
 #ifdef ENABLE_MOUSE
 struct mouse_control_state mouse_control_state;
@@ -41,11 +75,61 @@ static trampballfont_sdl font_perfect16_red;
 static Uint64 perf_freq;
 
 static uint16_t time_dilation = 1;
-
-static double calc_time_us = 0;
+/* steps per tick we'd like to take; read by the simulation thread */
+static SDL_atomic_t fast_forward = { 1 };
+/* steps taken so far, for the HUD */
+static SDL_atomic_t sim_steps_taken = { 0 };
+static double sim_interval_ms = 10;
+
+static histogram frame_time_hist;
+static histogram present_time_hist;
+static histogram step_time_hist;
+static histogram lateness_hist;
+static histogram *const all_hists[] = { &frame_time_hist, &present_time_hist,
+                                        &step_time_hist, &lateness_hist };
+#define N_HISTS ((int)(sizeof(all_hists)/sizeof(all_hists[0])))
+
+static histogram_dump stats_dump = { NULL, false, true };
+static double stats_period_s = DEFAULT_STATS_PERIOD;
+static const char *trace_fn = NULL;
+
+/* the camera follows this ball */
+static ball *focus_ball = NULL;
+/* held by the simulation thread while it steps the world, and by anyone
+   who wants to change what's in it */
+static SDL_mutex *world_lock = NULL;
+static struct world_stream *world_stream = NULL;
+static struct world_reloader *world_reloader = NULL;
+static struct worker_pool *world_workers = NULL;
+/* where each step is published for other processes, or NULL */
+static struct state_publisher *state_publisher = NULL;
+/* every step is logged to this, or NULL */
+static struct trajectory_log *trajectory_log = NULL;
+static bool trajectory_log_failed = false;
+
+/* while paused, we only draw a frame when something may have changed */
+static bool redraw_needed = true;
+static Uint64 last_frame = 0;
+
+/* Allocations made while the world's contents change (streaming,
+   reloading) are expected; any others after the first stats period
+   are steady-state allocations, which there shouldn't be. */
+static uint64_t world_change_allocs = 0;
+static uint64_t steady_state_allocs = 0;
+
+/* rendering offscreen: no window, no simulation thread */
+static SDL_Surface *export_surface = NULL;
+static struct frame_exporter *frame_exporter = NULL;
+static int export_steps_per_frame = 1;
+static int export_frames_done = 0;
+static bool export_failed = false;
 
 void cleanup()
 {
+    stop_sim_thread();
+    close_histogram_dump(&stats_dump);
+    if (trace_fn != NULL) trace_export_chrome(trace_fn);
+
     if (renderer != NULL) {
         SDL_DestroyRenderer(renderer);
         renderer = NULL;
@@ -54,8 +138,50 @@ void cleanup()
         SDL_DestroyWindow(game_window);
         game_window = NULL;
     }
+    if (frame_exporter != NULL) {
+        if (!free_frame_exporter(frame_exporter)) export_failed = true;
+        frame_exporter = NULL;
+    }
+    if (export_surface != NULL) {
+        SDL_FreeSurface(export_surface);
+        export_surface = NULL;
+    }
 
-    cleanup_world();
+    if (world_stream != NULL) {
+        free_world_stream(world_stream);
+        world_stream = NULL;
+    }
+    if (world_reloader != NULL) {
+        free_world_reloader(world_reloader);
+        world_reloader = NULL;
+    }
+    if (game_world != NULL) {
+        free_world(game_world);
+        game_world = NULL;
+    }
+    if (state_publisher != NULL) {
+        free_state_publisher(state_publisher);
+        state_publisher = NULL;
+    }
+    if (trajectory_log != NULL) {
+        if (!free_trajectory_log(trajectory_log)) trajectory_log_failed = true;
+        trajectory_log = NULL;
+    }
+    if (world_workers != NULL) {
+        free_worker_pool(world_workers);
+        world_workers = NULL;
+    }
+    if (world_lock != NULL) {
+        SDL_DestroyMutex(world_lock);
+        world_lock = NULL;
+    }
+    close_asset_pack();
+
+#ifdef ENABLE_ALLOC_STATS
+    print_alloc_stats(stderr);
+    fprintf(stderr, "%llu heap allocations in steady state\n",
+            (unsigned long long) steady_state_allocs);
+#endif
 
     SDL_Quit();
 }
@@ -65,56 +191,77 @@ static inline void print_SDL_error(const char *msg)
     SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "%s - %s\n", msg, SDL_GetError());
 }
 
-void handle_events()
+static void handle_event(const SDL_Event ev)
 {
-    SDL_Event ev;
-    while (SDL_PollEvent(&ev)) {
-        switch (ev.type) {
-        case SDL_KEYDOWN:
-            switch (ev.key.keysym.sym) {
-                case SDLK_q:
-                    game_mode |= MODE_QUITTING;
-                    break;
-                case SDLK_ESCAPE:
-                case SDLK_SPACE:
-                case SDLK_PAUSE:
-                    game_mode ^= MODE_RUNNING;
-                    break;
-            }
-            break;
-        case SDL_WINDOWEVENT:
-            switch(ev.window.event) {
-                case SDL_WINDOWEVENT_HIDDEN:
-                case SDL_WINDOWEVENT_FOCUS_LOST:
-                    game_mode &= ~MODE_RUNNING;
-                    break;
-            }
-            break;
-        case SDL_MOUSEBUTTONDOWN:
-            if (ev.button.button == SDL_BUTTON_LEFT) {
+    // whatever it was, it might show
+    redraw_needed = true;
+
+    switch (ev.type) {
+    case SDL_KEYDOWN:
+        switch (ev.key.keysym.sym) {
+            case SDLK_q:
+                game_mode |= MODE_QUITTING;
+                break;
+            case SDLK_t:
+                trace_export_chrome(trace_fn ? trace_fn : DEFAULT_TRACE_FILE);
+                break;
+            case SDLK_ESCAPE:
+            case SDLK_SPACE:
+            case SDLK_PAUSE:
                 game_mode ^= MODE_RUNNING;
-            }
-            break;
-        case SDL_QUIT:
-            game_mode |= MODE_QUITTING;
-            break;
+                break;
+            case SDLK_PLUS:
+            case SDLK_EQUALS:
+            case SDLK_KP_PLUS:
+                if (SDL_AtomicGet(&fast_forward) < FAST_FORWARD_MAX)
+                    SDL_AtomicSet(&fast_forward, SDL_AtomicGet(&fast_forward) * 2);
+                break;
+            case SDLK_MINUS:
+            case SDLK_KP_MINUS:
+                if (SDL_AtomicGet(&fast_forward) > 1)
+                    SDL_AtomicSet(&fast_forward, SDL_AtomicGet(&fast_forward) / 2);
+                break;
         }
+        break;
+    case SDL_WINDOWEVENT:
+        switch(ev.window.event) {
+            case SDL_WINDOWEVENT_HIDDEN:
+            case SDL_WINDOWEVENT_FOCUS_LOST:
+                game_mode &= ~MODE_RUNNING;
+                break;
+        }
+        break;
+    case SDL_MOUSEBUTTONDOWN:
+        if (ev.button.button == SDL_BUTTON_LEFT) {
+            game_mode ^= MODE_RUNNING;
+        }
+        break;
+    case SDL_QUIT:
+        game_mode |= MODE_QUITTING;
+        break;
     }
 }
 
+void handle_events()
+{
+    SDL_Event ev;
+    while (SDL_PollEvent(&ev))
+        handle_event(ev);
+}
+
 
 #ifdef ENABLE_MOUSE
 
 void init_mouse_support(struct mouse_control_state *mouse_state)
 {
-    mouse_state->original_gravity = gravity_accel;
+    mouse_state->original_gravity = game_world->gravity;
     mouse_state->mouse_captured = false;
 }
 
 void handle_mouse(struct mouse_control_state *mouse_state)
 {
     static int32_t mouse_tick = -1;
-    gravity_accel = mouse_state->original_gravity;
+    game_world->gravity = mouse_state->original_gravity;
     uint32_t now = SDL_GetTicks();
 
     if (mouse_tick < 0) {
@@ -133,8 +280,8 @@ void handle_mouse(struct mouse_control_state *mouse_state)
             v_x = x / dt;
             v_y = y / dt;
 
-            gravity_accel.x += v_x * 1e3 * MOUSE_SPEED_SCALE / dt;
-            gravity_accel.y -= v_y * 1e3 * MOUSE_SPEED_SCALE / dt;
+            game_world->gravity.x += v_x * 1e3 * MOUSE_SPEED_SCALE / dt;
+            game_world->gravity.y -= v_y * 1e3 * MOUSE_SPEED_SCALE / dt;
         } else {
             SDL_SetRelativeMouseMode(SDL_TRUE);
             mouse_state->mouse_captured = true;
@@ -153,39 +300,48 @@ void handle_mouse(struct mouse_control_state *mouse_state)
 
 void draw_trampoline(const trampoline *const t)
 {
-    SDL_Point *points = calloc(t->n_anchors, sizeof(SDL_Point));
+    // kept from frame to frame: it only grows when a bigger trampoline
+    // turns up (with room for all the anchors it could ever have)
+    static SDL_Point *points = NULL;
+    static int points_size = 0;
+
+    if (t->max_anchors > points_size) {
+        points = TB_REALLOC(ALLOC_RENDER, points, t->max_anchors * sizeof(SDL_Point));
+        points_size = t->max_anchors;
+    }
 
     SDL_LockMutex(t->lock);
 
+    // a remesh can change it as soon as the lock is let go
+    const int n = t->n_anchors;
     float x = origin.x + t->x * SCALING;
     int y = origin.y - t->y * SCALING;
-    float delta = ((float)t->width) / (t->n_anchors-1) * SCALING;
+    float delta = ((float)t->width) / (n-1) * SCALING;
 
-    for (int i = 0; i<t->n_anchors; ++i)
+    for (int i = 0; i<n; ++i)
     {
-        points[i].x = (int) (x + t->offsets[i].x * SCALING);
+        float rest = t->mesh ? t->mesh->rest_x[i] * SCALING : 0;
+        points[i].x = (int) (x + rest + t->offsets[i].x * SCALING);
         points[i].y = (int) (y - t->offsets[i].y * SCALING);
-        x += delta;
+        if (!t->mesh) x += delta;
     }
 
     SDL_UnlockMutex(t->lock);
 
     SDL_SetRenderDrawColor(renderer, 255, 255, 255, SDL_ALPHA_OPAQUE);
-    SDL_RenderDrawLines(renderer, points, t->n_anchors);
+    SDL_RenderDrawLines(renderer, points, n);
 
     // definitely the simplest way to draw multi-pixel markers #NOT
     SDL_SetRenderDrawColor(renderer, 255, 0, 0, SDL_ALPHA_OPAQUE);
-    SDL_RenderDrawPoints(renderer, points, t->n_anchors);
-    for (int i = 0; i<t->n_anchors; ++i) points[i] = (SDL_Point) {points[i].x-1, points[i].y};
-    SDL_RenderDrawPoints(renderer, points, t->n_anchors);
-    for (int i = 0; i<t->n_anchors; ++i) points[i] = (SDL_Point) {points[i].x+1, points[i].y-1};
-    SDL_RenderDrawPoints(renderer, points, t->n_anchors);
-    for (int i = 0; i<t->n_anchors; ++i) points[i] = (SDL_Point) {points[i].x, points[i].y+2};
-    SDL_RenderDrawPoints(renderer, points, t->n_anchors);
-    for (int i = 0; i<t->n_anchors; ++i) points[i] = (SDL_Point) {points[i].x+1, points[i].y-1};
-    SDL_RenderDrawPoints(renderer, points, t->n_anchors);
-
-    free(points);
+    SDL_RenderDrawPoints(renderer, points, n);
+    for (int i = 0; i<n; ++i) points[i] = (SDL_Point) {points[i].x-1, points[i].y};
+    SDL_RenderDrawPoints(renderer, points, n);
+    for (int i = 0; i<n; ++i) points[i] = (SDL_Point) {points[i].x+1, points[i].y-1};
+    SDL_RenderDrawPoints(renderer, points, n);
+    for (int i = 0; i<n; ++i) points[i] = (SDL_Point) {points[i].x, points[i].y+2};
+    SDL_RenderDrawPoints(renderer, points, n);
+    for (int i = 0; i<n; ++i) points[i] = (SDL_Point) {points[i].x+1, points[i].y-1};
+    SDL_RenderDrawPoints(renderer, points, n);
 }
 
 void draw_ball(const ball *const b)
@@ -251,8 +407,8 @@ void draw_edges(const stage *const s)
 void draw_gravity()
 {
     SDL_Point start = { WINDOW_WIDTH-50 * UI_SCALING, 50 * UI_SCALING };
-    int dx = gravity_accel.x / 20.0f;
-    int dy = -gravity_accel.y / 20.0f;
+    int dx = game_world->gravity.x / 20.0f;
+    int dy = -game_world->gravity.y / 20.0f;
 
     SDL_Point end = { start.x + dx * UI_SCALING,
                       start.y + dy * UI_SCALING };
@@ -271,6 +427,19 @@ void draw_gravity()
     SDL_RenderDrawLines(renderer, (SDL_Point[]){ tip1, end, tip2 }, 3);
 }
 
+void clear_frame()
+{
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, SDL_ALPHA_OPAQUE);
+    SDL_RenderClear(renderer);
+}
+
+void draw_hud_line(const char *const text, int line)
+{
+    render_string(&font_perfect16_green, renderer, text,
+                  (SDL_Point) {40 * UI_SCALING, (10 + 16 * line) * UI_SCALING},
+                  1 * UI_SCALING, 0);
+}
+
 void center_ball(const ball *const b)
 {
     // origin is defined as the location in window coordinates
@@ -279,13 +448,13 @@ void center_ball(const ball *const b)
     origin.x = (WINDOW_WIDTH/2 - b->position.x * SCALING);
     origin.y = (b->position.y * SCALING + WINDOW_HEIGHT/2);
 
-    int over_left   = origin.x + game_world.game_stage.left * SCALING;
-    int over_top    = origin.y - game_world.game_stage.top * SCALING;
-    int over_right  = WINDOW_WIDTH - origin.x - game_world.game_stage.right * SCALING;
-    int over_bottom = WINDOW_HEIGHT - origin.y + game_world.game_stage.bottom * SCALING;
+    int over_left   = origin.x + game_world->game_stage.left * SCALING;
+    int over_top    = origin.y - game_world->game_stage.top * SCALING;
+    int over_right  = WINDOW_WIDTH - origin.x - game_world->game_stage.right * SCALING;
+    int over_bottom = WINDOW_HEIGHT - origin.y + game_world->game_stage.bottom * SCALING;
 
     // if the stage is too small for our screen, center!
-    if ((game_world.game_stage.right - game_world.game_stage.left) * SCALING < WINDOW_WIDTH) {
+    if ((game_world->game_stage.right - game_world->game_stage.left) * SCALING < WINDOW_WIDTH) {
         origin.x -= over_left - (over_left + over_right) / 2 - OVER_EDGE_MAX;
     } else if (over_left > OVER_EDGE_MAX) {
         origin.x -= (over_left - OVER_EDGE_MAX);
@@ -293,7 +462,7 @@ void center_ball(const ball *const b)
         origin.x += (over_right - OVER_EDGE_MAX);
     }
 
-    if ((game_world.game_stage.top - game_world.game_stage.bottom) * SCALING < WINDOW_HEIGHT) {
+    if ((game_world->game_stage.top - game_world->game_stage.bottom) * SCALING < WINDOW_HEIGHT) {
         origin.y -= over_top - (over_top + over_bottom) / 2 - OVER_EDGE_MAX;
     } else if (over_top > OVER_EDGE_MAX) {
         origin.y -= (over_top - OVER_EDGE_MAX);
@@ -303,56 +472,263 @@ void center_ball(const ball *const b)
 
 }
 
+/* the focus ball may have gone in a reload */
+static void check_focus_ball()
+{
+    for (struct ball_list *bl = game_world->balls; bl; bl = bl->next)
+        if (bl->b == focus_ball) return;
+    focus_ball = game_world->balls ? game_world->balls->b : NULL;
+}
+
+static void check_world_file()
+{
+    if (world_reloader == NULL || !world_file_changed(world_reloader))
+        return;
+
+    TRACE_BEGIN("reload");
+#ifdef ENABLE_MOUSE
+    // don't mistake the mouse's influence for the world's gravity
+    game_world->gravity = mouse_control_state.original_gravity;
+#endif
+    uint64_t allocs0 = alloc_calls_total();
+    if (reload_world(world_reloader, world_lock))
+        check_focus_ball();
+    world_change_allocs += alloc_calls_total() - allocs0;
+#ifdef ENABLE_MOUSE
+    mouse_control_state.original_gravity = game_world->gravity;
+#endif
+    redraw_needed = true;
+    TRACE_END();
+}
+
+/*
+ * Paused with nothing to show: sleep until there is. Only the world file
+ * watcher can't wake us up, so we look at it now and then.
+ */
+static void wait_for_events()
+{
+    SDL_Event ev;
+    int got_event;
+
+    TRACE_BEGIN("idle");
+    if (world_reloader != NULL)
+        got_event = SDL_WaitEventTimeout(&ev, RELOAD_POLL_INTERVAL_MS);
+    else
+        got_event = SDL_WaitEvent(&ev);
+    TRACE_END();
+
+    if (got_event) {
+        handle_event(ev);
+        handle_events();
+    }
+    check_world_file();
+
+    // the time we slept doesn't count as a frame
+    last_frame = 0;
+}
+
+static inline uint64_t perf_to_ns(Uint64 ticks)
+{
+    return (ticks / perf_freq) * 1000000000u +
+           ((ticks % perf_freq) * 1000000000u) / perf_freq;
+}
+
+/* count the allocations since the last stats period */
+static void update_alloc_stats(char hudline[255], double period_s)
+{
+    static uint64_t last_total = 0, last_world_change = 0;
+    static bool warm = false;
+
+    uint64_t total = alloc_calls_total();
+    uint64_t steady = (total - last_total) - (world_change_allocs - last_world_change);
+    double rate = period_s > 0 ? (total - last_total) / period_s : 0;
+    last_total = total;
+    last_world_change = world_change_allocs;
+
+    if (warm && steady > 0) {
+        steady_state_allocs += steady;
+        if (STRICT_ALLOC)
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "%llu heap allocations in steady state\n", (unsigned long long) steady);
+    }
+    warm = true;
+
+#ifdef ENABLE_ALLOC_STATS
+    struct alloc_stats s[N_ALLOC_SUBSYSTEMS];
+    int64_t live = 0;
+
+    get_alloc_stats(s);
+    for (int i=0; i<N_ALLOC_SUBSYSTEMS; ++i) live += s[i].live_bytes;
+    snprintf(hudline, 255, "heap     %.0f allocs/s, %llu in steady state, %lld KiB", rate,
+             (unsigned long long) steady_state_allocs, (long long) live / 1024);
+#else
+    (void) rate;
+    snprintf(hudline, 255, "heap     (not counted)");
+#endif
+}
+
+/* how much faster than real time the simulation has been going */
+static void update_speed(char hudline[255], double period_s)
+{
+    static unsigned last_steps = 0;
+    unsigned steps = SDL_AtomicGet(&sim_steps_taken);
+    double sim_s = (steps - last_steps) * sim_interval_ms * 1e-3;
+
+    last_steps = steps;
+    snprintf(hudline, 255, "speed    x%.2f, aiming for x%g",
+             period_s > 0 ? sim_s / period_s : 0,
+             (double) SDL_AtomicGet(&fast_forward) / time_dilation);
+}
+
+/* summarize (and reset) the histograms once per stats period */
+static void update_stats(char hudlines[N_HUD_LINES][255])
+{
+    static Uint64 t_start = 0, t_last = 0;
+    struct histogram_summary s[N_HISTS];
+    Uint64 now = SDL_GetPerformanceCounter();
+
+    if (t_start == 0) t_start = t_last = now;
+    if (perf_to_ns(now - t_last) < stats_period_s * 1e9 && hudlines[0][0] != '\0')
+        return;
+    update_alloc_stats(hudlines[N_HISTS + 1], perf_to_ns(now - t_last) * 1e-9);
+    update_speed(hudlines[N_HISTS + 2], perf_to_ns(now - t_last) * 1e-9);
+    t_last = now;
+
+    for (int i=0; i<N_HISTS; ++i) {
+        histogram_summarize(all_hists[i], &s[i]);
+        histogram_reset(all_hists[i]);
+    }
+
+    write_histogram_dump(&stats_dump, perf_to_ns(now - t_start) * 1e-9, s, N_HISTS);
+
+    double fps = s[0].p50_us > 0 ? 1e6 / s[0].p50_us : 0;
+    snprintf(hudlines[0], 255, "%.1f fps (p50)     p50/p99/p99.9/max", fps);
+    for (int i=0; i<N_HISTS; ++i) {
+        snprintf(hudlines[i+1], 255, "%-8s %7.0f %7.0f %7.0f %7.0f us",
+                 s[i].name, s[i].p50_us, s[i].p99_us, s[i].p999_us, s[i].max_us);
+    }
+}
+
+/* one step, and whoever's watching; the caller holds world_lock */
+static void step_world(double interval_ms)
+{
+    int substeps = game_iteration(game_world, interval_ms);
+
+    if (state_publisher != NULL) publish_state(state_publisher, game_world);
+    if (trajectory_log != NULL) log_trajectory_step(trajectory_log, game_world, substeps);
+}
+
+/*
+ * Offscreen, the simulation keeps time with the frames rather than with
+ * the clock: each frame is handed to the exporter, then the world moves
+ * on by one frame's worth of steps.
+ */
+static void export_and_step()
+{
+    TRACE_BEGIN("export");
+    bool ok = export_frame(frame_exporter, export_surface);
+    TRACE_END();
+
+    if (!ok) {
+        SDL_LogCritical(SDL_LOG_CATEGORY_APPLICATION, "Error exporting frame %d\n",
+                        export_frames_done);
+        export_failed = true;
+        game_mode |= MODE_QUITTING;
+        return;
+    }
+    if (++export_frames_done == EXPORT_FRAMES) {
+        game_mode |= MODE_QUITTING;
+        return;
+    }
+
+    SDL_LockMutex(world_lock);
+    TRACE_BEGIN("step");
+    for (int i=0; i<export_steps_per_frame; ++i)
+        step_world(sim_interval_ms);
+    TRACE_END();
+    SDL_UnlockMutex(world_lock);
+}
+
 void main_loop_iter()
 {
-    static double fps = 10;
-    static char hudline[255];
-    static uint32_t last_hud = 2000;
+    static char hudlines[N_HUD_LINES][255];
 
     struct trampoline_list *tl;
     struct ball_list *bl;
     struct wall_list *wl;
-    uint64_t t0, t1;
+    Uint64 t0, t_present;
+
+    pause_sim_thread(!(game_mode & MODE_RUNNING));
+    if (!(game_mode & MODE_RUNNING) && !redraw_needed) {
+        wait_for_events();
+        return;
+    }
+    redraw_needed = false;
+
+    TRACE_BEGIN("frame");
 
     t0 = SDL_GetPerformanceCounter();
+    if (last_frame != 0)
+        histogram_record(&frame_time_hist, perf_to_ns(t0 - last_frame));
+    last_frame = t0;
 
     // update window size
-    SDL_GetWindowSize(game_window, &WINDOW_WIDTH, &WINDOW_HEIGHT);
+    if (game_window != NULL)
+        SDL_GetWindowSize(game_window, &WINDOW_WIDTH, &WINDOW_HEIGHT);
+
+    if (world_stream != NULL) {
+        TRACE_BEGIN("stream");
+        SDL_LockMutex(world_lock);
+        uint64_t allocs0 = alloc_calls_total();
+        update_world_stream(world_stream);
+        world_change_allocs += alloc_calls_total() - allocs0;
+        SDL_UnlockMutex(world_lock);
+        TRACE_END();
+    }
 
     // define the origin
-    if (!(game_mode & MODE_EXPLORE) && game_world.balls != NULL) {
-        center_ball(game_world.balls->b);
+    if (!(game_mode & MODE_EXPLORE) && focus_ball != NULL) {
+        center_ball(focus_ball);
     }
 
     // Draw a black background
-    SDL_SetRenderDrawColor(renderer, 0, 0, 0, SDL_ALPHA_OPAQUE);
-    SDL_RenderClear(renderer);
+    TRACE_BEGIN("clear");
+    clear_frame();
+    TRACE_END();
 
-    draw_edges(&game_world.game_stage);
+    TRACE_BEGIN("draw");
+    draw_edges(&game_world->game_stage);
 
     // draw scene
-    for (tl = game_world.trampolines; tl; tl = tl->next) {
+    for (tl = game_world->trampolines; tl; tl = tl->next) {
         draw_trampoline(tl->t);
     }
 
-    for (bl = game_world.balls; bl; bl = bl->next) {
+    for (bl = game_world->balls; bl; bl = bl->next) {
         draw_ball(bl->b);
     }
 
-    for (wl = game_world.walls; wl; wl = wl->next) {
+    for (wl = game_world->walls; wl; wl = wl->next) {
         draw_wall(wl->w);
     }
-
-    if (last_hud >= 40) {
-        snprintf(hudline, 255, "%.1f fps; calc in %.1f us", fps, calc_time_us);
-        last_hud = 0;
-    } else {
-        last_hud += 1e3/fps;
+    TRACE_END();
+
+    TRACE_BEGIN("text");
+    update_stats(hudlines);
+
+    // exported frames are just the scene
+    for (int i=0; i<N_HUD_LINES && frame_exporter == NULL; ++i)
+        draw_hud_line(hudlines[i], i);
+
+    if (world_stream != NULL && frame_exporter == NULL) {
+        struct world_stream_stats ss;
+        char streamline[255];
+        get_world_stream_stats(world_stream, &ss);
+        snprintf(streamline, 255, "chunks %d/%d active, objects %d/%d/%d active/loaded/total",
+                 ss.active_chunks, ss.chunks, ss.active_items, ss.loaded_items, ss.items);
+        draw_hud_line(streamline, N_HUD_LINES);
     }
 
-    render_string(&font_perfect16_green, renderer, hudline,
-                  (SDL_Point) {40 * UI_SCALING, 10 * UI_SCALING}, 1 * UI_SCALING, 0);
-
     if (!(game_mode & MODE_RUNNING)) {
         render_string(&font_perfect16_red, renderer, "PAUSED",
                       (SDL_Point) {WINDOW_WIDTH/2, WINDOW_HEIGHT/2}, 3 * UI_SCALING,
@@ -374,49 +750,80 @@ void main_loop_iter()
                       TEXT_RENDER_FLAG_CENTERED);
         line_y += 16 * UI_SCALING;
     }
+    TRACE_END();
 
     draw_gravity();
 
+    TRACE_BEGIN("present");
+    t_present = SDL_GetPerformanceCounter();
     SDL_RenderPresent(renderer);
+    histogram_record(&present_time_hist,
+                     perf_to_ns(SDL_GetPerformanceCounter() - t_present));
+    TRACE_END();
+
+    if (frame_exporter != NULL)
+        export_and_step();
 
+    TRACE_BEGIN("events");
     handle_events();
 
+    check_world_file();
+
 #ifdef ENABLE_MOUSE
-    handle_mouse(&mouse_control_state);
+    if (frame_exporter == NULL)
+        handle_mouse(&mouse_control_state);
 #endif
+    TRACE_END();
 
-    t1 = SDL_GetPerformanceCounter();
-
-    long dt_ms = (t1 - t0) / (perf_freq / 1000);
-
-    fps = 1e3 / dt_ms;
+    TRACE_END(); /* frame */
 }
 
-static uint32_t game_timer_callback(uint32_t interval_ms, void *user_data)
+static void game_tick_callback(double interval_ms, uint64_t lateness_ns,
+                               void *user_data)
 {
     static int calc_counter = 0;
 
-    double *last_time_taken_us = (double*) user_data;
+    (void) user_data;
+
+    TRACE_THREAD_NAME("simulation");
 
     if ((game_mode & MODE_RUNNING) && ++calc_counter >= time_dilation) {
-        calc_counter = 0;
+        int target = SDL_AtomicGet(&fast_forward);
+        uint64_t budget_ns = interval_ms * FAST_FORWARD_BUDGET * 1e6;
+        uint64_t busy_ns = 0;
+        int steps = 0;
 
-        Uint64 t0_calc = SDL_GetPerformanceCounter();
-        game_iteration(interval_ms);
-        Uint64 t1_calc = SDL_GetPerformanceCounter();
+        calc_counter = 0;
 
-        if (last_time_taken_us != NULL) {
-            *last_time_taken_us = (1.0e6 * (t1_calc - t0_calc)) / perf_freq;
-        }
+        histogram_record(&lateness_hist, lateness_ns);
+
+        // Fast-forwarding, take as many steps as we're asked for, back to
+        // back - or as many as fit in the tick, if that's fewer: a machine
+        // that can't keep up just goes less fast, rather than falling
+        // behind. The lock is let go between steps, so that the rest of
+        // the game still gets a look in.
+        do {
+            SDL_LockMutex(world_lock);
+            TRACE_BEGIN("step");
+            Uint64 t0_calc = SDL_GetPerformanceCounter();
+            step_world(interval_ms);
+            Uint64 t1_calc = SDL_GetPerformanceCounter();
+            TRACE_END();
+            SDL_UnlockMutex(world_lock);
+
+            histogram_record(&step_time_hist, perf_to_ns(t1_calc - t0_calc));
+            busy_ns += perf_to_ns(t1_calc - t0_calc);
+            ++steps;
+        } while (steps < target && busy_ns + busy_ns / steps <= budget_ns);
+
+        SDL_AtomicAdd(&sim_steps_taken, steps);
     }
-
-    return interval_ms;
 }
 
 
-static int init_sdl(bool fullscreen)
+static int init_window(bool fullscreen)
 {
-    if (SDL_Init(SDL_INIT_VIDEO|SDL_INIT_TIMER) != 0) {
+    if (SDL_Init(SDL_INIT_VIDEO) != 0) {
         print_SDL_error("SDL_Init");
         return 1;
     }
@@ -439,6 +846,46 @@ static int init_sdl(bool fullscreen)
         return 1;
     }
 
+    return 0;
+}
+
+SDL_Surface *get_offscreen_surface()
+{
+    return export_surface;
+}
+
+/* headless: the software renderer draws straight into a surface */
+static int init_offscreen()
+{
+    if (SDL_Init(0) != 0) {
+        print_SDL_error("SDL_Init");
+        return 1;
+    }
+
+    if (!(export_surface = SDL_CreateRGBSurfaceWithFormat(0, WINDOW_WIDTH, WINDOW_HEIGHT, 32,
+                                                          SDL_PIXELFORMAT_ARGB8888))) {
+        print_SDL_error("SDL_CreateRGBSurfaceWithFormat");
+        cleanup();
+        return 1;
+    }
+
+    if (!(renderer = SDL_CreateSoftwareRenderer(export_surface))) {
+        print_SDL_error("SDL_CreateSoftwareRenderer");
+        cleanup();
+        return 1;
+    }
+
+    return 0;
+}
+
+int init_sdl(bool fullscreen, bool offscreen)
+{
+    if (offscreen) {
+        if (init_offscreen() != 0) return 1;
+    } else if (init_window(fullscreen) != 0) {
+        return 1;
+    }
+
     if (!init_trampballfont(renderer, ASSET("perfect16.tbf"),
                             0x11aa11ff, 0x00000000, &font_perfect16_green)) {
         SDL_LogCritical(SDL_LOG_CATEGORY_APPLICATION, "Error loading font\n");
@@ -453,7 +900,8 @@ static int init_sdl(bool fullscreen)
         return 1;
     }
 
-    SDL_GetWindowSize(game_window, &WINDOW_WIDTH, &WINDOW_HEIGHT);
+    if (game_window != NULL)
+        SDL_GetWindowSize(game_window, &WINDOW_WIDTH, &WINDOW_HEIGHT);
 
     origin = (SDL_Point) { 0, WINDOW_HEIGHT };
 
@@ -462,93 +910,25 @@ static int init_sdl(bool fullscreen)
 
 #ifndef LIBRARY_BUILD
 
-static int parse_args(int argc, char *argv[],
-                      char *flags[],
-                      char *opts_arg[],
-                      int max_args,
-                      bool out_flags[],
-                      char *out_opt_values[],
-                      char *out_args[])
-{
-    int i;
-
-    int n_args_so_far = 0;
-    int hungry_opt = -1;
-
-    for (int i=0; flags[i] != NULL; ++i) {
-        out_flags[i] = false;
-    }
-
-    for (int i=0; opts_arg[i] != NULL; ++i) {
-        out_opt_values[i] = NULL;
-    }
-
-    while (argc-- > 1) {
-        ++argv;
-
-        if (argv[0][0] == '-' && hungry_opt == -1) {
-            // this is an option/a flag
-            int candidates = 0;
-            int cand_flag = -1;
-            int cand_opt = -1;
-            int len = strlen(argv[0]);
-
-            for (i=0; flags[i] != NULL; ++i) {
-                if (strncmp(flags[i], &argv[0][1], len-1) == 0) {
-                    cand_flag = i;
-                    ++candidates;
-                }
-            }
-
-            for (i=0; opts_arg[i] != NULL; ++i) {
-                if (strncmp(opts_arg[i], &argv[0][1], len-1) == 0) {
-                    cand_opt = i;
-                    ++candidates;
-                }
-            }
-
-            if (candidates == 0) {
-                fprintf(stderr, "Unrecognized option: %s\n", &argv[0][1]);
-                return -1;
-            } else if (candidates == 1) {
-                if (cand_flag >= 0) {
-                    out_flags[cand_flag] = true;
-                } else  {
-                    hungry_opt = cand_opt;
-                }
-            } else {
-                fprintf(stderr, "Ambigious option: %s\n", &argv[0][1]);
-                return -1;
-            }
-        } else if (hungry_opt >= 0) {
-            // option value
-            out_opt_values[hungry_opt] = argv[0];
-            hungry_opt = -1;
-        } else {
-            // regular argument
-            if (n_args_so_far >= max_args) {
-                fprintf(stderr, "Too many arguments!\n");
-                return -1;
-            }
-            out_args[n_args_so_far++] = argv[0];
-        }
-    }
-
-    return n_args_so_far;
-}
-
 int main(int argc, char *argv[])
 {
-    char *flags[] = { "help", "fullscreen", NULL };
+    char *flags[] = { "help", "fullscreen", "realtime", "noreload", "strictalloc",
+                      "trajcompress", NULL };
     char *opts[] = { "width", "height", "scaling", "interval", "slomo", "uiscaling",
+                     "cpu", "stats", "statsperiod", "trace", "stream", "threads",
+                     "fastforward", "export", "exportfps", "frames", "shm", "trajlog",
+                     "solveriters", "assets",
 #ifdef ENABLE_MOUSE
                      "mouse",
 #endif
                      NULL };
-    bool flag_states[2];
-    char *opt_vals[7];
+    bool flag_states[6];
+    char *opt_vals[21];
     char *world_fn = ASSET("worldfile.txt");
-    uint32_t calc_interval = 10;
+    struct sim_thread_params sim_params = { 10, -1, false };
+
+    if (argc > 1 && strcmp(argv[1], "render") == 0)
+        return render_main(argc - 1, argv + 1);
 
     int n_args = parse_args(argc, argv, flags, opts, 1,
                             flag_states, opt_vals, &world_fn);
@@ -557,8 +937,16 @@ int main(int argc, char *argv[])
         fprintf(stderr, "trampball - balls bouncing on trampolines\n"
                         "\n"
                         "  Usage: %s [-help] [-fullscreen] [-width 480] [-height 640]\n"
-                        "         [-scaling 1] [-uiscaling 1] [-interval 10] [-slomo 1] [-mouse 8] res/worldfile.txt\n",
-                        argv[0]);
+                        "         [-scaling 1] [-uiscaling 1] [-interval 10] [-slomo 1] [-mouse 8]\n"
+                        "         [-cpu N] [-realtime] [-stats stats.csv|stats.json] [-statsperiod 1]\n"
+                        "         [-trace trace.json] [-stream CHUNK_SIZE] [-noreload]\n"
+                        "         [-strictalloc] [-threads 1] [-fastforward 1]\n"
+                        "         [-export frames/%%05d.png|video.y4m|-] [-exportfps 30] [-frames 300]\n"
+                        "         [-shm /trampball] [-trajlog trajectory.tbt] [-trajcompress]\n"
+                        "         [-solveriters %d] [-assets assets.tbp]\n"
+                        "         res/worldfile.txt\n"
+                        "     or: %s render record|check|bench [-help] ...\n",
+                        argv[0], BALL_SOLVER_ITERATIONS, argv[0]);
         if (flag_states[0]) return 0;
         else return 2;
     }
@@ -586,9 +974,9 @@ int main(int argc, char *argv[])
         }
     }
     if (opt_vals[3] != NULL) {
-        calc_interval = strtol(opt_vals[3], &endp, 10);
-        if (*opt_vals[3] == '\0' || *endp != '\0') {
-            fprintf(stderr, "not an integer: %s\n", opt_vals[3]);
+        sim_params.interval_ms = strtod(opt_vals[3], &endp);
+        if (*opt_vals[3] == '\0' || *endp != '\0' || sim_params.interval_ms <= 0) {
+            fprintf(stderr, "not a positive number: %s\n", opt_vals[3]);
             return 2;
         }
     }
@@ -606,17 +994,87 @@ int main(int argc, char *argv[])
             return 2;
         }
     }
-#ifdef ENABLE_MOUSE
     if (opt_vals[6] != NULL) {
-        MOUSE_SPEED_SCALE = strtod(opt_vals[6], &endp);
+        sim_params.cpu = strtol(opt_vals[6], &endp, 10);
         if (*opt_vals[6] == '\0' || *endp != '\0') {
-            fprintf(stderr, "not a number: %s\n", opt_vals[6]);
+            fprintf(stderr, "not an integer: %s\n", opt_vals[6]);
+            return 2;
+        }
+    }
+    if (opt_vals[8] != NULL) {
+        stats_period_s = strtod(opt_vals[8], &endp);
+        if (*opt_vals[8] == '\0' || *endp != '\0' || stats_period_s <= 0) {
+            fprintf(stderr, "not a positive number: %s\n", opt_vals[8]);
+            return 2;
+        }
+    }
+    trace_fn = opt_vals[9];
+    if (opt_vals[10] != NULL) {
+        STREAM_CHUNK_SIZE = strtol(opt_vals[10], &endp, 10);
+        if (*opt_vals[10] == '\0' || *endp != '\0' || STREAM_CHUNK_SIZE < 0) {
+            fprintf(stderr, "not a valid chunk size: %s\n", opt_vals[10]);
+            return 2;
+        }
+    }
+    if (opt_vals[11] != NULL) {
+        SIM_THREADS = strtol(opt_vals[11], &endp, 10);
+        if (*opt_vals[11] == '\0' || *endp != '\0' || SIM_THREADS < 1) {
+            fprintf(stderr, "not a positive integer: %s\n", opt_vals[11]);
+            return 2;
+        }
+    }
+    if (opt_vals[12] != NULL) {
+        int steps = strtol(opt_vals[12], &endp, 10);
+        if (*opt_vals[12] == '\0' || *endp != '\0' || steps < 1 || steps > FAST_FORWARD_MAX) {
+            fprintf(stderr, "not a speed-up between 1 and %d: %s\n", FAST_FORWARD_MAX,
+                    opt_vals[12]);
+            return 2;
+        }
+        SDL_AtomicSet(&fast_forward, steps);
+    }
+    EXPORT_FILENAME = opt_vals[13];
+    SHM_STATE_NAME = opt_vals[16];
+    TRAJECTORY_LOG_FILENAME = opt_vals[17];
+    if (opt_vals[14] != NULL) {
+        EXPORT_FPS = strtod(opt_vals[14], &endp);
+        if (*opt_vals[14] == '\0' || *endp != '\0' || EXPORT_FPS <= 0) {
+            fprintf(stderr, "not a positive number: %s\n", opt_vals[14]);
+            return 2;
+        }
+    }
+    if (opt_vals[15] != NULL) {
+        EXPORT_FRAMES = strtol(opt_vals[15], &endp, 10);
+        if (*opt_vals[15] == '\0' || *endp != '\0' || EXPORT_FRAMES < 1) {
+            fprintf(stderr, "not a positive integer: %s\n", opt_vals[15]);
+            return 2;
+        }
+    }
+    if (opt_vals[18] != NULL) {
+        SOLVER_ITERATIONS = strtol(opt_vals[18], &endp, 10);
+        if (*opt_vals[18] == '\0' || *endp != '\0' || SOLVER_ITERATIONS < 1) {
+            fprintf(stderr, "not a positive integer: %s\n", opt_vals[18]);
+            return 2;
+        }
+    }
+    if (opt_vals[19] != NULL) ASSET_PACK_FILENAME = opt_vals[19];
+#ifdef ENABLE_MOUSE
+    if (opt_vals[20] != NULL) {
+        MOUSE_SPEED_SCALE = strtod(opt_vals[20], &endp);
+        if (*opt_vals[20] == '\0' || *endp != '\0') {
+            fprintf(stderr, "not a number: %s\n", opt_vals[20]);
             return 2;
         }
     }
 #endif
+    if (opt_vals[7] != NULL && !open_histogram_dump(&stats_dump, opt_vals[7])) {
+        return 1;
+    }
+    sim_params.realtime = flag_states[2];
+    WATCH_WORLD_FILE = !flag_states[3];
+    STRICT_ALLOC = flag_states[4];
+    TRAJECTORY_LOG_COMPRESS = flag_states[5];
 
-    if(startup(flag_states[1], world_fn, calc_interval) != 0) {
+    if(startup(flag_states[1], world_fn, &sim_params) != 0) {
         cleanup();
         return 1;
     }
@@ -626,35 +1084,95 @@ int main(int argc, char *argv[])
     }
 
     cleanup();
-    return 0;
+    return ((STRICT_ALLOC && steady_state_allocs > 0) || export_failed ||
+            trajectory_log_failed) ? 1 : 0;
 }
 
 #endif /* ! LIBRARY_BUILD */
 
-int startup(bool fullscreen, const char *world_fn, uint32_t calc_interval)
+int startup(bool fullscreen, const char *world_fn,
+            const struct sim_thread_params *const sim_params)
 {
-    SDL_TimerID calc_timer;
-
-    if (init_sdl(fullscreen) != 0) return 1;
+    if (ASSET_PACK_FILENAME[0] != '\0' && !open_asset_pack(ASSET_PACK_FILENAME)) {
+        // only the one that was asked for is missed
+        if (strcmp(ASSET_PACK_FILENAME, ASSET_PACK) != 0) return 1;
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION, "Using the loose asset files instead\n");
+    }
+    if (init_sdl(fullscreen, EXPORT_FILENAME != NULL) != 0) return 1;
 
-    if (!init_game(world_fn)) {
+    game_world = new_world();
+    if (!init_game(game_world, world_fn)) {
         SDL_LogCritical(SDL_LOG_CATEGORY_APPLICATION, "Error loading %s\n",
                         world_fn);
         return 1;
     }
 
+    game_world->solver_iterations = SOLVER_ITERATIONS;
+    if (game_world->balls != NULL)
+        focus_ball = game_world->balls->b;
+    if ((world_lock = SDL_CreateMutex()) == NULL) {
+        print_SDL_error("SDL_CreateMutex");
+        return 1;
+    }
+    if (SIM_THREADS > 1) {
+        if ((world_workers = new_worker_pool(SIM_THREADS)) == NULL) {
+            print_SDL_error("new_worker_pool");
+            return 1;
+        }
+        game_world->workers = world_workers;
+    }
+    if (STREAM_CHUNK_SIZE > 0 && focus_ball != NULL) {
+        world_stream = new_world_stream(game_world, STREAM_CHUNK_SIZE, &focus_ball);
+        update_world_stream(world_stream);
+    } else if (WATCH_WORLD_FILE && !is_packed_asset(world_fn)) {
+        // (a streamed world isn't all there, so there's nothing to diff against,
+        // and a packed one doesn't change)
+        world_reloader = new_world_reloader(game_world, world_fn);
+    }
+
     perf_freq = SDL_GetPerformanceFrequency();
+    sim_interval_ms = sim_params->interval_ms;
+
+    if (SHM_STATE_NAME != NULL &&
+        (state_publisher = new_state_publisher(SHM_STATE_NAME, game_world,
+                                               sim_interval_ms)) == NULL) {
+        SDL_LogCritical(SDL_LOG_CATEGORY_APPLICATION, "Can't publish the state to %s\n",
+                        SHM_STATE_NAME);
+        return 1;
+    }
+    if (TRAJECTORY_LOG_FILENAME != NULL &&
+        (trajectory_log = new_trajectory_log(TRAJECTORY_LOG_FILENAME, game_world,
+                                             TRAJECTORY_LOG_COMPRESS)) == NULL) {
+        SDL_LogCritical(SDL_LOG_CATEGORY_APPLICATION, "Can't log to %s\n",
+                        TRAJECTORY_LOG_FILENAME);
+        return 1;
+    }
 
 #ifdef ENABLE_MOUSE
     init_mouse_support(&mouse_control_state);
 #endif
 
-    game_mode = 0;
-    calc_timer = SDL_AddTimer(calc_interval, game_timer_callback,
-                              (void*)(&calc_time_us));
+    TRACE_THREAD_NAME("main");
 
-    if (!calc_timer) {
-        print_SDL_error("SDL_AddTimer");
+    game_mode = 0;
+    histogram_init(&frame_time_hist, "frame");
+    histogram_init(&present_time_hist, "present");
+    histogram_init(&step_time_hist, "step");
+    histogram_init(&lateness_hist, "late");
+
+    if (EXPORT_FILENAME != NULL) {
+        // as many steps per frame as come closest to the frame rate
+        // asked for; the video gets the frame rate that works out to
+        export_steps_per_frame = (int) (1000 / EXPORT_FPS / sim_interval_ms + 0.5);
+        if (export_steps_per_frame < 1) export_steps_per_frame = 1;
+        int frame_us = (int) (export_steps_per_frame * sim_interval_ms * 1000 + 0.5);
+
+        frame_exporter = new_frame_exporter(EXPORT_FILENAME, WINDOW_WIDTH, WINDOW_HEIGHT,
+                                            1000000, frame_us);
+        if (frame_exporter == NULL) return 1;
+        game_mode = MODE_RUNNING;
+    } else if (!start_sim_thread(sim_params, game_tick_callback, NULL)) {
+        print_SDL_error("start_sim_thread");
         return 1;
     }
 
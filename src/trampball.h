@@ -8,6 +8,7 @@
 #include "trampoline.h"
 #include "interaction.h"
 #include "physics.h"
+#include "simthread.h"
 #include "config.h"
 
 #define MODE_RUNNING 0x01
@@ -16,6 +17,7 @@
 #define MODE_QUITTING 0x10
 
 extern uint8_t game_mode;
+extern struct world *game_world;
 
 #ifdef ENABLE_MOUSE
 extern struct mouse_control_state {
@@ -31,6 +33,23 @@ extern int WINDOW_WIDTH;
 extern int WINDOW_HEIGHT;
 extern double SCALING;
 extern double UI_SCALING;
+extern int STREAM_CHUNK_SIZE;
+extern bool WATCH_WORLD_FILE;
+/* complain about any heap allocation once the game is warmed up */
+extern bool STRICT_ALLOC;
+/* threads to share big trampolines between */
+extern int SIM_THREADS;
+/* ball-ball contact solver passes per step */
+extern int SOLVER_ITERATIONS;
+/* an asset pack to take the fonts and worlds from (see assets.h) */
+extern const char *ASSET_PACK_FILENAME;
+/* render offscreen to this file (see export.h) rather than to a window */
+extern const char *EXPORT_FILENAME;
+extern const char *SHM_STATE_NAME;
+extern const char *TRAJECTORY_LOG_FILENAME;
+extern bool TRAJECTORY_LOG_COMPRESS;
+extern double EXPORT_FPS;
+extern int EXPORT_FRAMES;
 
 void cleanup();
 void handle_events();
@@ -40,16 +59,29 @@ void init_mouse_support(struct mouse_control_state *mouse_state);
 void handle_mouse(struct mouse_control_state *mouse_state);
 #endif
 
+/* to black */
+void clear_frame();
+void draw_trampoline(const trampoline *const t);
 void draw_ball(const ball *const b);
 void draw_wall(const wall *const w);
 void draw_edges(const stage *const s);
 void draw_gravity();
+/* the top left is line 0 */
+void draw_hud_line(const char *const text, int line);
 
 void center_ball(const ball *const b);
 
 void main_loop_iter();
 
-int startup(bool fullscreen, const char *world_fn, uint32_t calc_interval);
+int startup(bool fullscreen, const char *world_fn,
+            const struct sim_thread_params *const sim_params);
+/* offscreen, everything is drawn into the surface, ARGB8888 at
+   WINDOW_WIDTH x WINDOW_HEIGHT */
+int init_sdl(bool fullscreen, bool offscreen);
+SDL_Surface *get_offscreen_surface();
+
+/* trampball render ... (see rendercheck.c) */
+int render_main(int argc, char *argv[]);
 
 
 #endif /* TRAMPBALL_TRAMPBALL_H */
@@ -1,42 +1,251 @@
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
 #include <math.h>
 
 #include "trampoline.h"
 #include "interaction.h"
+#include "alloc.h"
+#include "config.h"
+
+#if defined(__GNUC__)
+#  define ALWAYS_INLINE inline __attribute__((always_inline))
+#elif defined(_MSC_VER)
+#  define ALWAYS_INLINE __forceinline
+#else
+#  define ALWAYS_INLINE inline
+#endif
+
+static trampoline_kernel select_trampoline_kernel(int n_anchors);
+static int iterate_trampoline_generic(trampoline *const t, const real dt_ms,
+                                      const vector2f gravity);
+static int iterate_trampoline_adaptive(trampoline *const t, const real dt_ms,
+                                       const vector2f gravity);
+
+/* attachments are kept 16-byte aligned, so that they can be packed */
+static size_t attachment_size(int max_contacts)
+{
+    return (sizeof(attachment) + max_contacts * sizeof(int) + 15) & ~(size_t) 15;
+}
 
-trampoline *new_trampoline(int anchors)
+/* the trampoline, its arrays and its spare attachments, in one block */
+size_t trampoline_size(int anchors)
+{
+    bool generic = (select_trampoline_kernel(anchors) == iterate_trampoline_generic);
+    size_t size = sizeof(trampoline) +
+                  (generic ? 12 : 2) * anchors * sizeof(vector2f) +
+                  (generic ? anchors * sizeof(real) : 0) +
+                  anchors * sizeof(int);
+    size = (size + 15) & ~(size_t) 15;
+    return size + TRAMPOLINE_SPARE_ATTACHMENTS * attachment_size(anchors);
+}
+
+trampoline *init_trampoline(void *const mem, int anchors)
 {
-    trampoline *t = malloc(sizeof(trampoline) +
-                           2 * anchors * sizeof(vector2f));
-    t->offsets = (vector2f *)(((char *) t) + sizeof(trampoline));
+    trampoline *t = mem;
+    trampoline_kernel kernel = select_trampoline_kernel(anchors);
+    char *p = ((char *) t) + sizeof(trampoline);
+
+    t->offsets = (vector2f *) p;
     t->speed = t->offsets + anchors;
+    p = (char *) (t->speed + anchors);
+    if (kernel == iterate_trampoline_generic) {
+        t->scratch_v_a = (vector2f *) p;
+        t->scratch_mass = (real *) (t->scratch_v_a + 10 * anchors);
+        p = (char *) (t->scratch_mass + anchors);
+    } else {
+        t->scratch_v_a = NULL;
+        t->scratch_mass = NULL;
+    }
+    t->contact_scratch = (int *) p;
+    p = (char *) (t->contact_scratch + anchors);
     t->attached_objects = NULL;
     t->lock = SDL_CreateMutex();
 
     t->n_anchors = anchors;
+    t->max_anchors = anchors;
+    t->mesh = NULL;
+    t->kernel = kernel;
     t->k = TRAMPOLINE_SPRING_CONSTANT;
     t->damping = TRAMPOLINE_DAMPING;
     t->density = TRAMPOLINE_DENSITY;
-    t->x = t->y = t-> width = 0;
+    t->x = t->y = t-> width = t->height = 0;
     for (int i = 0; i < anchors; ++i) {
         t->offsets[i] = (vector2f) {0, 0};
         t->speed[i] = (vector2f) {0, 0};
     }
+
+    // a ball can only touch as many anchors as there are
+    p = (char *) t + ((p - (char *) t + 15) & ~(ptrdiff_t) 15);
+    t->spare_attachments = NULL;
+    for (int i = 0; i < TRAMPOLINE_SPARE_ATTACHMENTS; ++i) {
+        attachment *a = (attachment *) (p + i * attachment_size(anchors));
+        a->max_contacts = anchors;
+        a->embedded = true;
+        a->next = t->spare_attachments;
+        t->spare_attachments = a;
+    }
+
     return t;
 }
 
-void free_trampoline(trampoline *const t)
+trampoline *new_trampoline(int anchors)
+{
+    return init_trampoline(TB_MALLOC(ALLOC_TRAMPOLINE, trampoline_size(anchors)), anchors);
+}
+
+void cleanup_trampoline(trampoline *const t)
 {
     while (t->attached_objects)
         remove_attachment(t, t->attached_objects);
+    while (t->spare_attachments) {
+        attachment *a = t->spare_attachments;
+        t->spare_attachments = a->next;
+        if (!a->embedded) TB_FREE(a);
+    }
+    TB_FREE(t->mesh);
     SDL_DestroyMutex(t->lock);
-    free(t);
+}
+
+void free_trampoline(trampoline *const t)
+{
+    cleanup_trampoline(t);
+    TB_FREE(t);
+}
+
+/* puts the trampoline in its (straight) rest shape */
+void set_trampoline_height(trampoline *const t, int height)
+{
+    const struct trampoline_mesh *const m = t->mesh;
+    double delta_y = ((double) height) / (m ? m->n_segments + 1 : t->n_anchors);
+
+    t->height = height;
+    for (int i=0; i<t->n_anchors; ++i) {
+        // the same straight line through the load-time anchors
+        double steps = m ? m->rest_x[i] / m->segment_width : i;
+        t->offsets[i] = (vector2f) {0, steps * delta_y};
+        t->speed[i] = (vector2f) {0, 0};
+    }
+}
+
+/* where the anchors are at rest for the given levels, how much each
+   carries and how stiff the segments are; returns how many anchors */
+static int mesh_layout(const trampoline *const t, const unsigned char *const level,
+                       real *const rest_x, real *const length, real *const stiffness)
+{
+    struct trampoline_mesh *const m = t->mesh;
+    const int fine = 1 << m->levels;
+    const double total = (double) m->n_segments * fine;
+    real h_before = 0;
+    int n = 0, pos = 0;
+
+    m->finest = m->segment_width;
+    for (int s=0; s<m->n_segments; ++s) {
+        const int step = fine >> level[s];
+        const real h = m->segment_width / (1 << level[s]);
+        if (h < m->finest) m->finest = h;
+        for (int j=0; j < (1 << level[s]); ++j, ++n, pos += step) {
+            rest_x[n] = t->width * (pos / total);
+            length[n] = (h_before + h) / 2;
+            stiffness[n] = 1 << level[s];
+            h_before = h;
+        }
+    }
+    rest_x[n] = t->width;
+    length[n] = h_before / 2;
+    stiffness[n] = 0;
+    return n + 1;
+}
+
+bool set_trampoline_refinement(trampoline *const t, int levels)
+{
+    if (levels < 0 || levels > TRAMPOLINE_MAX_REFINE_LEVELS || t->mesh != NULL ||
+        t->n_anchors < 2 || t->width <= 0)
+        return false;
+
+    const int n_segments = t->n_anchors - 1;
+    const int max_anchors = (n_segments << levels) + 1;
+    const size_t n = max_anchors;
+    // everything in one block: two sets of anchors (so the old ones are
+    // still there to build the new ones from), the RK4 work space, and
+    // the index maps. vectors first, so that everything stays aligned.
+    size_t size = (sizeof(struct trampoline_mesh) + 15) & ~(size_t) 15;
+    size += 14 * n * sizeof(vector2f) + 7 * n * sizeof(real) +
+            2 * n * sizeof(int) + 2 * n_segments;
+    char *p = TB_MALLOC(ALLOC_TRAMPOLINE, size);
+    if (p == NULL) return false;
+
+    struct trampoline_mesh *m = (struct trampoline_mesh *) p;
+    p += (sizeof(struct trampoline_mesh) + 15) & ~(size_t) 15;
+    vector2f *offsets = (vector2f *) p, *speed = offsets + n;
+    m->spare_offsets = speed + n;
+    m->spare_speed = m->spare_offsets + n;
+    vector2f *scratch_v_a = m->spare_speed + n;
+    real *rest_x = (real *) (scratch_v_a + 10 * n), *length = rest_x + n,
+         *stiffness = length + n;
+    m->spare_rest_x = stiffness + n;
+    m->spare_length = m->spare_rest_x + n;
+    m->spare_stiffness = m->spare_length + n;
+    real *scratch_mass = m->spare_stiffness + n;
+    m->index_map = (int *) (scratch_mass + n);
+    m->contact_scratch = m->index_map + n;
+    m->level = (unsigned char *) (m->contact_scratch + n);
+    m->target = m->level + n_segments;
+
+    m->levels = levels;
+    m->n_segments = n_segments;
+    m->segment_width = ((real) t->width) / n_segments;
+    memset(m->level, 0, n_segments);
+    // the load-time anchors, as they are
+    memcpy(offsets, t->offsets, t->n_anchors * sizeof(vector2f));
+    memcpy(speed, t->speed, t->n_anchors * sizeof(vector2f));
+
+    t->mesh = m;
+    t->offsets = offsets;
+    t->speed = speed;
+    m->rest_x = rest_x;
+    m->length = length;
+    m->stiffness = stiffness;
+    t->n_anchors = mesh_layout(t, m->level, rest_x, length, stiffness);
+    t->max_anchors = max_anchors;
+    t->scratch_v_a = scratch_v_a;
+    t->scratch_mass = scratch_mass;
+    // (collisions are over before the mesh changes, so they can share)
+    t->contact_scratch = m->contact_scratch;
+    t->kernel = iterate_trampoline_adaptive;
+
+    // a ball can touch as many anchors as there may be: the built-in
+    // spares are too small now (but they go with the trampoline's block)
+    attachment **q = &(t->spare_attachments);
+    while (*q != NULL) {
+        if ((*q)->embedded) *q = (*q)->next;
+        else q = &((*q)->next);
+    }
+    for (int i = 0; i < TRAMPOLINE_SPARE_ATTACHMENTS; ++i) {
+        attachment *a = TB_MALLOC(ALLOC_ATTACHMENT, attachment_size(max_anchors));
+        a->max_contacts = max_anchors;
+        a->embedded = false;
+        a->next = t->spare_attachments;
+        t->spare_attachments = a;
+    }
+
+    return true;
 }
 
 attachment *new_attachment(trampoline *const t, int max_contacts)
 {
-    attachment *a = malloc(sizeof(attachment) + max_contacts * sizeof(int));
+    attachment **p = &(t->spare_attachments), *a;
+    while (*p != NULL && (*p)->max_contacts < max_contacts)
+        p = &((*p)->next);
+
+    if ((a = *p) != NULL) {
+        *p = a->next;
+    } else {
+        a = TB_MALLOC(ALLOC_ATTACHMENT, attachment_size(max_contacts));
+        a->max_contacts = max_contacts;
+        a->embedded = false;
+    }
+
     a->n_contacts = 0;
     a->next = t->attached_objects;
     a->b = NULL;
@@ -54,7 +263,8 @@ bool remove_attachment(trampoline *const t, attachment *a)
     while ((*p) != NULL) {
         if (*p == a) {
             *p = a->next;
-            free(a);
+            a->next = t->spare_attachments;
+            t->spare_attachments = a;
             return true;
         }
         p = &((*p)->next);
@@ -69,7 +279,8 @@ bool detach_ball(trampoline *const t, const ball *const b)
         if ((*p)->b == b) {
             attachment *a = *p;
             *p = a->next;
-            free(a);
+            a->next = t->spare_attachments;
+            t->spare_attachments = a;
             return true;
         }
         p = &((*p)->next);
@@ -89,69 +300,438 @@ attachment *find_ball_attached(trampoline *const t, const ball *const b)
     return NULL;
 }
 
-static void trampoline_advance(const vector2f *const restrict speed_in,
-                               const vector2f *const restrict offset_in,
-                               const float *const restrict attached_mass,
-                               vector2f *const restrict speed_out,
-                               vector2f *const restrict accel_out,
-                               const int n_anchors, const float dx,
-                               const float dt, const float k,
-                               const float dm,
-                               const float damping)
+/*
+ * What coarsening segment s (its anchors starting at first) by one level
+ * would cost: the spring energy of the kinks at the anchors that would go,
+ * and the kinetic energy of them moving apart from their neighbours.
+ */
+static real coarsening_loss(const trampoline *const t, int s, int first)
 {
-    int i;
-
-    accel_out[0] = (vector2f) {0, 0};
-    for (i=1; i<(n_anchors-1); ++i) {
-        float dx1 = dx + offset_in[i].x - offset_in[i-1].x;
-        float dx2 = dx + offset_in[i+1].x - offset_in[i].x;
-        float dy1 = offset_in[i].y - offset_in[i-1].y;
-        float dy2 = offset_in[i+1].y - offset_in[i].y;
+    const struct trampoline_mesh *const m = t->mesh;
+    const int n = 1 << m->level[s];
+    real loss = 0;
+
+    for (int i = first + 1; i < first + n; i += 2) {
+        vector2f kink = { t->offsets[i+1].x - 2 * t->offsets[i].x + t->offsets[i-1].x,
+                          t->offsets[i+1].y - 2 * t->offsets[i].y + t->offsets[i-1].y };
+        vector2f dv = { t->speed[i].x - (t->speed[i-1].x + t->speed[i+1].x) / 2,
+                        t->speed[i].y - (t->speed[i-1].y + t->speed[i+1].y) / 2 };
+        loss += t->k * m->stiffness[i] / 4 * (kink.x * kink.x + kink.y * kink.y);
+        loss += t->density * m->length[i] / 2 * (dv.x * dv.x + dv.y * dv.y);
+    }
+    return loss;
+}
 
-        float m = (dm + attached_mass[i]);
-        float k_over_m = k / m;
-        float this_accel_x = k_over_m * (dx2 - dx1);
-        float this_accel_y = k_over_m * (dy2 - dy1);
+void refine_trampoline_under(trampoline *const t, real left, real right)
+{
+    struct trampoline_mesh *const m = t->mesh;
+    const int n_segments = m->n_segments, levels = m->levels;
+    int s;
+
+    left = (left - t->x) / m->segment_width;
+    right = (right - t->x) / m->segment_width;
+    // (clamped first, so that a ball far away can't overflow)
+    if (left < -levels) left = -levels;
+    if (right > n_segments + levels) right = n_segments + levels;
+    if (left > right) return;
+    int s_lo = real_floor(left), s_hi = real_floor(right);
+    int from = s_lo - (levels - 1), to = s_hi + (levels - 1);
+    if (from < 0) from = 0;
+    if (to > n_segments - 1) to = n_segments - 1;
+    for (s = from; s <= to; ++s) {
+        int distance = s < s_lo ? s_lo - s : (s > s_hi ? s - s_hi : 0);
+        if (levels - distance > m->target[s]) m->target[s] = levels - distance;
+    }
+}
 
-        accel_out[i].x = this_accel_x - speed_in[i].x * damping + gravity_accel.x;
-        accel_out[i].y = this_accel_y - speed_in[i].y * damping + gravity_accel.y;
+/* sets m->target to the levels the segments should have now, on top of
+   what's been asked for already; returns whether any of them are
+   different */
+static bool plan_remesh(trampoline *const t)
+{
+    const struct trampoline_mesh *const m = t->mesh;
+    const real tolerance = TRAMPOLINE_COARSEN_TOLERANCE * t->k / 2 *
+                           m->segment_width * m->segment_width;
+    int s, first;
+    bool changed = false;
+
+    for (const attachment *a = t->attached_objects; a != NULL; a = a->next)
+        refine_trampoline_under(t, a->b->position.x - a->b->radius,
+                                a->b->position.x + a->b->radius);
+
+    for (s=0, first=0; s<m->n_segments; first += 1 << m->level[s++]) {
+        // refine at once, but coarsen a level at a time, and only if
+        // it's (as good as) free
+        if (m->target[s] < m->level[s])
+            m->target[s] = coarsening_loss(t, s, first) <= tolerance ?
+                           m->level[s] - 1 : m->level[s];
+        if (m->target[s] != m->level[s]) changed = true;
     }
+    return changed;
+}
 
-    accel_out[0] = (vector2f) {0, 0};
-    accel_out[n_anchors-1] = (vector2f) {0, 0};
+/* the contact points of a after the anchors have moved: where the old
+   ones went, and any new anchors in between them */
+static void remap_contacts(const trampoline *const t, attachment *const a)
+{
+    const struct trampoline_mesh *const m = t->mesh;
+    int *const c = m->contact_scratch;
+    int n = 0;
+
+    for (int j=0; j<a->n_contacts; ++j) {
+        int i = a->contact_points[j], k = m->index_map[i];
+        if (k < 0) continue;
+        c[n++] = k;
+        if (j + 1 < a->n_contacts && a->contact_points[j+1] == i + 1)
+            for (int new_k = m->index_map[i+1]; ++k < new_k; )
+                c[n++] = k;
+    }
+    if (n > a->max_contacts) n = a->max_contacts;
+    memcpy(a->contact_points, c, n * sizeof(int));
+    a->n_contacts = n;
+}
 
-    if (dt == 0) {
-        memcpy(speed_out, speed_in, n_anchors*sizeof(vector2f));
-        speed_out[0] = (vector2f) {0, 0};
-        speed_out[n_anchors-1] = (vector2f) {0, 0};
-        return;
+/*
+ * Refine and coarsen the segments of an adaptive trampoline. New anchors
+ * are put on the straight line between the old ones, moving at speeds in
+ * between theirs: that splits each spring into stiffer ones holding
+ * exactly the same energy, and keeps the mass and momentum where they
+ * were. Anchors that go hand their mass and momentum on to the ones
+ * either side of them, in proportion to how close they are.
+ */
+static void rebuild_mesh(trampoline *const t)
+{
+    struct trampoline_mesh *const m = t->mesh;
+    const vector2f *const old_offsets = t->offsets, *const old_speed = t->speed;
+    vector2f *const offsets = m->spare_offsets, *const speed = m->spare_speed;
+    // momentum per unit density, until the new anchors' lengths are known
+    vector2f *const p = t->scratch_v_a;
+    vector2f carry = {0, 0};  /* for the next anchor, from the segment before it */
+    int s, j, q, i = 0, o = 0;
+
+    for (s=0; s<m->n_segments; ++s) {
+        const int old_level = m->level[s], new_level = m->target[s];
+        const real h_old = m->segment_width / (1 << old_level);
+
+        if (new_level >= old_level) {
+            const int r = 1 << (new_level - old_level);
+            const real h = h_old / r;
+            for (j=0; j < (1 << old_level); ++j, ++i) {
+                m->index_map[i] = o;
+                offsets[o] = old_offsets[i];
+                p[o].x = carry.x + old_speed[i].x * h/2;
+                p[o].y = carry.y + old_speed[i].y * h/2;
+                ++o;
+                for (q=1; q<r; ++q, ++o) {
+                    real f = ((real) q) / r;
+                    offsets[o].x = old_offsets[i].x + f * (old_offsets[i+1].x - old_offsets[i].x);
+                    offsets[o].y = old_offsets[i].y + f * (old_offsets[i+1].y - old_offsets[i].y);
+                    p[o].x = h * (old_speed[i].x + f * (old_speed[i+1].x - old_speed[i].x));
+                    p[o].y = h * (old_speed[i].y + f * (old_speed[i+1].y - old_speed[i].y));
+                }
+                carry = (vector2f) { old_speed[i+1].x * h/2, old_speed[i+1].y * h/2 };
+            }
+        } else {
+            const int r = 1 << (old_level - new_level);
+            for (j=0; j < (1 << new_level); ++j, i += r, ++o) {
+                vector2f here = { carry.x + old_speed[i].x * h_old/2,
+                                  carry.y + old_speed[i].y * h_old/2 };
+                carry = (vector2f) { old_speed[i+r].x * h_old/2, old_speed[i+r].y * h_old/2 };
+                for (q=1; q<r; ++q) {
+                    real f = ((real) q) / r;
+                    here.x += (1 - f) * h_old * old_speed[i+q].x;
+                    here.y += (1 - f) * h_old * old_speed[i+q].y;
+                    carry.x += f * h_old * old_speed[i+q].x;
+                    carry.y += f * h_old * old_speed[i+q].y;
+                    m->index_map[i+q] = -1;
+                }
+                m->index_map[i] = o;
+                offsets[o] = old_offsets[i];
+                p[o] = here;
+            }
+        }
+    }
+    m->index_map[i] = o;
+    offsets[o] = old_offsets[i];
+    p[o] = carry;
+
+    int n_anchors = mesh_layout(t, m->target, m->spare_rest_x, m->spare_length,
+                                m->spare_stiffness);
+    for (o=1; o<n_anchors-1; ++o) {
+        speed[o].x = p[o].x / m->spare_length[o];
+        speed[o].y = p[o].y / m->spare_length[o];
     }
+    // the ends stay put
+    speed[0] = speed[n_anchors-1] = (vector2f) {0, 0};
+
+    SDL_LockMutex(t->lock);
+    m->spare_offsets = t->offsets;
+    m->spare_speed = t->speed;
+    t->offsets = offsets;
+    t->speed = speed;
+#define SWAP_MESH_ARRAY(name) \
+    do { real *tmp = m->name; m->name = m->spare_##name; m->spare_##name = tmp; } while (0)
+    SWAP_MESH_ARRAY(rest_x);
+    SWAP_MESH_ARRAY(length);
+    SWAP_MESH_ARRAY(stiffness);
+#undef SWAP_MESH_ARRAY
+    memcpy(m->level, m->target, m->n_segments);
+    t->n_anchors = n_anchors;
+    for (attachment *a = t->attached_objects; a != NULL; a = a->next)
+        remap_contacts(t, a);
+    SDL_UnlockMutex(t->lock);
+}
 
-    for (i=0; i<n_anchors; ++i) {
-        speed_out[i].x = speed_in[i].x + accel_out[i].x * dt;
-        speed_out[i].y = speed_in[i].y + accel_out[i].y * dt;
+static void remesh_trampoline(trampoline *const t)
+{
+    if (plan_remesh(t)) rebuild_mesh(t);
+    // and start again on what the next step wants
+    memset(t->mesh->target, 0, t->mesh->n_segments);
+}
+
+static ALWAYS_INLINE void trampoline_advance(const vector2f *const restrict speed_in,
+                                             const vector2f *const restrict offset_in,
+                                             const real *const restrict attached_mass,
+                                             vector2f *const restrict speed_out,
+                                             vector2f *const restrict accel_out,
+                                             const int n_anchors,
+                                             const int lo, const int hi,
+                                             const real dx, const real k,
+                                             const real dm,
+                                             const real damping,
+                                             const vector2f gravity,
+                                             const struct trampoline_mesh *const mesh,
+                                             const real density)
+{
+    int i;
+    // only anchors lo..hi-1 are written; the ends are fixed
+    const int first = lo > 1 ? lo : 1;
+    const int last = hi < n_anchors - 1 ? hi : n_anchors - 1;
+
+    // (mesh is a constant NULL in the specialised kernels, so this
+    // disappears from them)
+    if (mesh != NULL) {
+        const real *const restrict rest_x = mesh->rest_x;
+        const real *const restrict length = mesh->length;
+        const real *const restrict stiffness = mesh->stiffness;
+
+        for (i=first; i<last; ++i) {
+            real dx1 = rest_x[i] - rest_x[i-1] + offset_in[i].x - offset_in[i-1].x;
+            real dx2 = rest_x[i+1] - rest_x[i] + offset_in[i+1].x - offset_in[i].x;
+            real dy1 = offset_in[i].y - offset_in[i-1].y;
+            real dy2 = offset_in[i+1].y - offset_in[i].y;
+            real k1 = k * stiffness[i-1], k2 = k * stiffness[i];
+
+            real m = (density * length[i] + attached_mass[i]);
+            real this_accel_x = (k2 * dx2 - k1 * dx1) / m;
+            real this_accel_y = (k2 * dy2 - k1 * dy1) / m;
+
+            accel_out[i].x = this_accel_x - speed_in[i].x * damping + gravity.x;
+            accel_out[i].y = this_accel_y - speed_in[i].y * damping + gravity.y;
+        }
+    } else {
+        for (i=first; i<last; ++i) {
+            real dx1 = dx + offset_in[i].x - offset_in[i-1].x;
+            real dx2 = dx + offset_in[i+1].x - offset_in[i].x;
+            real dy1 = offset_in[i].y - offset_in[i-1].y;
+            real dy2 = offset_in[i+1].y - offset_in[i].y;
+
+            real m = (dm + attached_mass[i]);
+            real k_over_m = k / m;
+            real this_accel_x = k_over_m * (dx2 - dx1);
+            real this_accel_y = k_over_m * (dy2 - dy1);
+
+            accel_out[i].x = this_accel_x - speed_in[i].x * damping + gravity.x;
+            accel_out[i].y = this_accel_y - speed_in[i].y * damping + gravity.y;
+        }
     }
 
-    speed_out[0] = (vector2f) {0, 0};
-    speed_out[n_anchors-1] = (vector2f) {0, 0};
+    if (lo == 0) accel_out[0] = (vector2f) {0, 0};
+    if (hi == n_anchors) accel_out[n_anchors-1] = (vector2f) {0, 0};
+
+    // the stage's velocity is just the speed it was given
+    memcpy(speed_out + lo, speed_in + lo, (hi-lo)*sizeof(vector2f));
+
+    if (lo == 0) speed_out[0] = (vector2f) {0, 0};
+    if (hi == n_anchors) speed_out[n_anchors-1] = (vector2f) {0, 0};
 }
 
-void iterate_trampoline(trampoline *const t, const float dt_ms)
+/* the masses of the balls resting on anchors lo..hi-1 */
+static ALWAYS_INLINE void attached_masses(const trampoline *const t,
+                                          real *const restrict attached_mass,
+                                          const int lo, const int hi)
 {
     int i, j;
+
+    for (i=lo; i<hi; ++i)
+        attached_mass[i] = 0;
+
+    for (const attachment *a = t->attached_objects; a != NULL; a = a->next) {
+        real extra_dm = a->b->mass / a->n_contacts;
+        for (j=0; j<a->n_contacts; ++j) {
+            i = a->contact_points[j];
+            if (i >= lo && i < hi)
+                attached_mass[i] += extra_dm;
+        }
+    }
+}
+
+/* carry the balls resting on the trampoline along with it.
+   old_offsets: where the anchors were before this (sub)step */
+static void move_attached_balls(trampoline *const t, const vector2f *const old_offsets,
+                                const real dt, const vector2f gravity)
+{
     attachment *a;
-    int n_anchors = t->n_anchors;
-    float dt = dt_ms / 1000.0f;
-    float dx = ((float) t->width) / n_anchors;
-    float k = t->k;
-    float dm = (t->density * dx);
-    float tau_ms = 2e3f * sqrtf(dm/k);
+    int i, j;
+
+    for (a = t->attached_objects; a != NULL; a = a->next) {
+        vector2f dx = {0, 0};
+        vector2f new_speed = {0, 0};
+        real new_speed_sq = 0;
+        for (j=0; j<a->n_contacts; ++j) {
+            i = a->contact_points[j];
+
+            real my_dx = (t->offsets[i].x - old_offsets[i].x) * real_fabs(a->direction_n.x);
+            real my_dy = (t->offsets[i].y - old_offsets[i].y) * real_fabs(a->direction_n.y);
+            real my_vx = t->speed[i].x * real_fabs(a->direction_n.x);
+            real my_vy = t->speed[i].y * real_fabs(a->direction_n.y);
+
+            real my_speed_sq = my_vx*my_vx + my_vy*my_vy;
+            if (my_speed_sq > new_speed_sq) {
+                dx = (vector2f) {my_dx, my_dy};
+                new_speed = (vector2f) {my_vx, my_vy};
+                new_speed_sq = my_speed_sq;
+            }
+        }
+
+        real gravity_norm = gravity.x * a->direction_n.y -
+                             gravity.y * a->direction_n.x;
+        vector2f gravity_slip = {+ dt * gravity_norm * a->direction_n.y,
+                                 - dt * gravity_norm * a->direction_n.x};
+
+        a->b->speed.x += gravity_slip.x;
+        a->b->speed.y += gravity_slip.y;
+
+        real orthogal_speed = (a->b->speed.y * a->direction_n.x) -
+                               (a->b->speed.x * a->direction_n.y);
+        vector2f orthogal_velocity = {orthogal_speed * a->direction_n.y,
+                                    - orthogal_speed * a->direction_n.x};
+
+        new_speed.x += orthogal_velocity.x;
+        new_speed.y += orthogal_velocity.y;
+
+        vector2f speed_change = {new_speed.x - a->b->speed.x,
+                                 new_speed.y - a->b->speed.y};
+
+        // can only push, not pull.
+        if (((a->direction_n.x > 0) && (speed_change.x > 0)) ||
+            ((a->direction_n.x < 0) && (speed_change.x < 0))) {
+            new_speed.x = a->b->speed.x;
+            if (((a->direction_n.x > 0) && (dx.x < 0)) ||
+                ((a->direction_n.x < 0) && (dx.x > 0))) {
+                dx.x = new_speed.x * dt;
+            }
+        }
+        if (((a->direction_n.y > 0) && (speed_change.y > 0)) ||
+            ((a->direction_n.y < 0) && (speed_change.y < 0))) {
+            new_speed.y = a->b->speed.y;
+            if (((a->direction_n.y > 0) && (dx.y < 0)) ||
+                ((a->direction_n.y < 0) && (dx.y > 0))) {
+                dx.y = new_speed.y * dt;
+            }
+        }
+
+        dx.x += orthogal_velocity.x * dt;
+        dx.y += orthogal_velocity.y * dt;
+
+        force_advance_ball(a->b, new_speed, dx);
+    }
+}
+
+/* the state a step of h along (v, a) from where the trampoline is now */
+static ALWAYS_INLINE void rk4_stage_state(const trampoline *const t,
+                                          const vector2f *const restrict v,
+                                          const vector2f *const restrict a, const real h,
+                                          vector2f *const restrict x_tmp,
+                                          vector2f *const restrict v_tmp,
+                                          const int lo, const int hi)
+{
+    for (int i=lo; i<hi; ++i) {
+        x_tmp[i].x = t->offsets[i].x + v[i].x * h;
+        x_tmp[i].y = t->offsets[i].y + v[i].y * h;
+        v_tmp[i].x = t->speed[i].x + a[i].x * h;
+        v_tmp[i].y = t->speed[i].y + a[i].y * h;
+    }
+}
+
+/* the RK4 step proper, from the four stages' derivatives, weighted 1, 2, 2, 1 */
+static ALWAYS_INLINE void rk4_combine(trampoline *const t, const vector2f *const restrict buf_v_a,
+                                      const int n_anchors, const real dt,
+                                      const int lo, const int hi)
+{
+    const vector2f *restrict v0 = buf_v_a;
+    const vector2f *restrict v1 = buf_v_a + 2 * n_anchors;
+    const vector2f *restrict v2 = buf_v_a + 4 * n_anchors;
+    const vector2f *restrict v3 = buf_v_a + 6 * n_anchors;
+    const vector2f *restrict a0 = buf_v_a + n_anchors;
+    const vector2f *restrict a1 = buf_v_a + 3 * n_anchors;
+    const vector2f *restrict a2 = buf_v_a + 5 * n_anchors;
+    const vector2f *restrict a3 = buf_v_a + 7 * n_anchors;
+
+    // in a mixed precision build, the weighted sums are done in double
+    // and only rounded once, when they're stored.
+    for (int i=lo; i<hi; ++i) {
+        t->offsets[i].x = t->offsets[i].x + dt * ((real_acc) v0[i].x + 2*v1[i].x + 2*v2[i].x + v3[i].x)/6;
+        t->offsets[i].y = t->offsets[i].y + dt * ((real_acc) v0[i].y + 2*v1[i].y + 2*v2[i].y + v3[i].y)/6;
+        t->speed[i].x = t->speed[i].x + dt * ((real_acc) a0[i].x + 2*a1[i].x + 2*a2[i].x + a3[i].x)/6;
+        t->speed[i].y = t->speed[i].y + dt * ((real_acc) a0[i].y + 2*a1[i].y + 2*a2[i].y + a3[i].y)/6;
+    }
+}
+
+/* how many substeps a step of dt_ms needs, given the fastest anchor */
+static ALWAYS_INLINE int rk4_substeps(const real v_max, const real dt, const real dt_ms,
+                                      const real tau_ms)
+{
+    // the tau term is a heuristic term to prevent numerical fluctuations
+    // from inducing aphysical resonances
+    int iters = real_ceil(v_max * dt + REAL(2.1) * dt_ms/tau_ms);
+    if (dt / iters < REAL(1e-4)) iters = dt / REAL(1e-4);
+    return iters;
+}
+
+/* the time scale of the stiffest segment, for rk4_substeps() */
+static ALWAYS_INLINE real rk4_tau_ms(const trampoline *const t,
+                                     const struct trampoline_mesh *const mesh, const real dm)
+{
+    if (mesh == NULL) return REAL(2e3) * real_sqrt(dm/t->k);
+    // the shortest segment is the lightest and the stiffest
+    return REAL(2e3) * mesh->finest * real_sqrt(t->density / (t->k * mesh->segment_width));
+}
+
+/*
+ * The RK4 integrator proper. It is always inlined, so each caller gets a
+ * copy specialised for its n_anchors: the kernels below pass a compile-time
+ * constant, which lets the compiler unroll and vectorise without remainder
+ * loops, and keep the scratch buffers on the stack. Only the adaptive
+ * kernel has a mesh.
+ */
+static ALWAYS_INLINE int trampoline_rk4(trampoline *const t, const real dt_ms,
+                                        const vector2f gravity, const int n_anchors,
+                                        vector2f *const buf_v_a,
+                                        real *const restrict attached_mass,
+                                        const struct trampoline_mesh *const mesh)
+{
+    int i;
+    real dt = dt_ms / REAL(1000.0);
+    real dx = ((real) t->width) / n_anchors;
+    real k = t->k;
+    real dm = (t->density * dx);
+    real tau_ms = rk4_tau_ms(t, mesh, dm);
     int iters_left, iters_total;
 
     // Try a standard (4th order) Runge-Kutta integration.
     // See: https://math.stackexchange.com/questions/721076/help-with-using-the-runge-kutta-4th-order-method-on-a-system-of-2-first-order-od
     // This kind of code makes you wish you were using FORTRAN really...
-    vector2f *buf_v_a = malloc(10 * n_anchors * sizeof(vector2f));
     vector2f *restrict v0 = buf_v_a;
     vector2f *restrict v1 = buf_v_a + 2 * n_anchors;
     vector2f *restrict v2 = buf_v_a + 4 * n_anchors;
@@ -163,45 +743,28 @@ void iterate_trampoline(trampoline *const t, const float dt_ms)
     vector2f *restrict x_tmp = buf_v_a + 8 * n_anchors;
     vector2f *restrict v_tmp = buf_v_a + 9 * n_anchors;
 
-    float *restrict attached_mass = malloc(n_anchors * sizeof(float));
-
     for (iters_left = 1, iters_total = 1; iters_left; --iters_left) {
-        for (i=0; i<n_anchors; ++i)
-            attached_mass[i] = 0;
-
-        attachment *next = NULL;
-        for (a = t->attached_objects; a != NULL; a = next) {
-            next = a->next;
-            //if (collide_ball_trampoline(a->b, t)) {
-                float extra_dm = a->b->mass / a->n_contacts;
-                for (j=0; j<a->n_contacts; ++j) {
-                    i = a->contact_points[j];
-                    attached_mass[i] += extra_dm;
-                }
-            //}
-        }
+        attached_masses(t, attached_mass, 0, n_anchors);
 
         trampoline_advance(t->speed, t->offsets, attached_mass, v0, a0,
-                           n_anchors, dx, 0, k, dm, t->damping);
+                           n_anchors, 0, n_anchors, dx, k, dm, t->damping, gravity,
+                           mesh, t->density);
 
-        float v_max = 0;
+        real v_max = 0;
         for (i=0; i<n_anchors; ++i) {
             x_tmp[i].x = t->offsets[i].x + v0[i].x * dt/2;
             x_tmp[i].y = t->offsets[i].y + v0[i].y * dt/2;
             v_tmp[i].x = t->speed[i].x + a0[i].x * dt/2;
             v_tmp[i].y = t->speed[i].y + a0[i].y * dt/2;
             if (iters_total == 1) {
-                float v_y_abs = fabsf(v_tmp[i].y);
+                real v_y_abs = real_fabs(v_tmp[i].y);
                 if (v_y_abs > v_max) v_max = v_y_abs;
             }
         }
 
         if (iters_total == 1) {
             // we might have to increase the number of iterations!
-            // the tau term is a heuristic term to prevent numerical fluctuations
-            // from inducing aphysical resonances
-            iters_total = ceilf(v_max * dt + 2.1f * dt_ms/tau_ms);
-            if (dt / iters_total < 1e-4f) iters_total = dt / 1e-4f;
+            iters_total = rk4_substeps(v_max, dt, dt_ms, tau_ms);
             if (iters_total > 1) {
                 iters_left = iters_total;
                 dt /= iters_total;
@@ -210,106 +773,209 @@ void iterate_trampoline(trampoline *const t, const float dt_ms)
         }
 
         trampoline_advance(v_tmp, x_tmp, attached_mass, v1, a1, n_anchors,
-                           dx, dt/2, k, dm, t->damping);
+                           0, n_anchors, dx, k, dm, t->damping, gravity,
+                           mesh, t->density);
 
-        for (i=0; i<n_anchors; ++i) {
-            x_tmp[i].x = t->offsets[i].x + v1[i].x * dt/2;
-            x_tmp[i].y = t->offsets[i].y + v1[i].y * dt/2;
-            v_tmp[i].x = t->speed[i].x + a1[i].x * dt/2;
-            v_tmp[i].y = t->speed[i].y + a1[i].y * dt/2;
-        }
+        rk4_stage_state(t, v1, a1, dt/2, x_tmp, v_tmp, 0, n_anchors);
         trampoline_advance(v_tmp, x_tmp, attached_mass, v2, a2, n_anchors,
-                           dx, dt/2, k, dm, t->damping);
+                           0, n_anchors, dx, k, dm, t->damping, gravity,
+                           mesh, t->density);
 
-        for (i=0; i<n_anchors; ++i) {
-            x_tmp[i].x = t->offsets[i].x + v2[i].x * dt;
-            x_tmp[i].y = t->offsets[i].y + v2[i].y * dt;
-            v_tmp[i].x = t->speed[i].x + a2[i].x * dt;
-            v_tmp[i].y = t->speed[i].y + a2[i].y * dt;
-        }
+        rk4_stage_state(t, v2, a2, dt, x_tmp, v_tmp, 0, n_anchors);
         trampoline_advance(v_tmp, x_tmp, attached_mass, v3, a3, n_anchors,
-                           dx, dt, k, dm, t->damping);
+                           0, n_anchors, dx, k, dm, t->damping, gravity,
+                           mesh, t->density);
 
         /* save the old positions in x_tmp.
            we'll need them to move the ball(s)! */
         memcpy(x_tmp, t->offsets, n_anchors * sizeof(vector2f));
 
         SDL_LockMutex(t->lock);
+        rk4_combine(t, buf_v_a, n_anchors, dt, 0, n_anchors);
+        SDL_UnlockMutex(t->lock);
 
-        for (i=0; i<n_anchors; ++i) {
-            t->offsets[i].x = t->offsets[i].x + dt * (v0[i].x + v1[i].x + v2[i].x + v3[i].x)/6;
-            t->offsets[i].y = t->offsets[i].y + dt * (v0[i].y + v1[i].y + v2[i].y + v3[i].y)/6;
-            t->speed[i].x = t->speed[i].x + dt * (a0[i].x + a1[i].x + a2[i].x + a3[i].x)/6;
-            t->speed[i].y = t->speed[i].y + dt * (a0[i].y + a1[i].y + a2[i].y + a3[i].y)/6;
-        }
+        move_attached_balls(t, x_tmp, dt, gravity);
+    }
 
-        SDL_UnlockMutex(t->lock);
+    return iters_total;
+}
 
-        for (a = t->attached_objects; a != NULL; a = a->next) {
-            vector2f dx = {0, 0};
-            vector2f new_speed = {0, 0};
-            float new_speed_sq = 0;
-            for (j=0; j<a->n_contacts; ++j) {
-                i = a->contact_points[j];
-
-                float my_dx = (t->offsets[i].x - x_tmp[i].x) * fabsf(a->direction_n.x);
-                float my_dy = (t->offsets[i].y - x_tmp[i].y) * fabsf(a->direction_n.y);
-                float my_vx = t->speed[i].x * fabsf(a->direction_n.x);
-                float my_vy = t->speed[i].y * fabsf(a->direction_n.y);
-
-                float my_speed_sq = my_vx*my_vx + my_vy*my_vy;
-                if (my_speed_sq > new_speed_sq) {
-                    dx = (vector2f) {my_dx, my_dy};
-                    new_speed = (vector2f) {my_vx, my_vy};
-                    new_speed_sq = my_speed_sq;
-                }
-            }
+static int iterate_trampoline_generic(trampoline *const t, const real dt_ms,
+                                      const vector2f gravity)
+{
+    return trampoline_rk4(t, dt_ms, gravity, t->n_anchors, t->scratch_v_a, t->scratch_mass,
+                          NULL);
+}
 
-            float gravity_norm = gravity_accel.x * a->direction_n.y -
-                                 gravity_accel.y * a->direction_n.x;
-            vector2f gravity_slip = {+ dt * gravity_norm * a->direction_n.y,
-                                     - dt * gravity_norm * a->direction_n.x};
+static int iterate_trampoline_adaptive(trampoline *const t, const real dt_ms,
+                                       const vector2f gravity)
+{
+    remesh_trampoline(t);
+    return trampoline_rk4(t, dt_ms, gravity, t->n_anchors, t->scratch_v_a, t->scratch_mass,
+                          t->mesh);
+}
+
+#define DEFINE_TRAMPOLINE_KERNEL(N) \
+    static int iterate_trampoline_##N(trampoline *const t, const real dt_ms, \
+                                      const vector2f gravity) \
+    { \
+        vector2f buf_v_a[10 * N]; \
+        real attached_mass[N]; \
+        return trampoline_rk4(t, dt_ms, gravity, N, buf_v_a, attached_mass, NULL); \
+    }
+
+TRAMPOLINE_KERNEL_SIZES(DEFINE_TRAMPOLINE_KERNEL)
+
+struct parallel_rk4_job {
+    trampoline *t;
+    real dt_ms;
+    vector2f gravity;
+    real v_max[WORKER_POOL_MAX];
+    int iters_total;
+};
+
+/*
+ * One worker's share of trampoline_rk4(): a contiguous block of anchors.
+ * Every stage reads one anchor either side of the block from the
+ * neighbouring blocks, so the workers meet at a barrier whenever a
+ * stage's state has been written, and again before it's overwritten.
+ * Worker 0 moves the balls once all the blocks are done. Everything is
+ * computed in the same order as in the serial integrator.
+ */
+static void trampoline_rk4_worker(struct worker_pool *const pool, int worker, int n_workers,
+                                  void *arg)
+{
+    struct parallel_rk4_job *job = arg;
+    trampoline *const t = job->t;
+    const struct trampoline_mesh *const mesh = t->mesh;
+    const int n_anchors = t->n_anchors;
+    const vector2f gravity = job->gravity;
+    const real dt_ms = job->dt_ms;
+    int i, lo, hi;
+    real dt = dt_ms / REAL(1000.0);
+    real dx = ((real) t->width) / n_anchors;
+    real k = t->k;
+    real dm = (t->density * dx);
+    real tau_ms = rk4_tau_ms(t, mesh, dm);
+    int iters_left, iters_total;
 
-            a->b->speed.x += gravity_slip.x;
-            a->b->speed.y += gravity_slip.y;
+    vector2f *const buf_v_a = t->scratch_v_a;
+    real *const restrict attached_mass = t->scratch_mass;
+    vector2f *restrict v0 = buf_v_a;
+    vector2f *restrict v1 = buf_v_a + 2 * n_anchors;
+    vector2f *restrict v2 = buf_v_a + 4 * n_anchors;
+    vector2f *restrict v3 = buf_v_a + 6 * n_anchors;
+    vector2f *restrict a0 = buf_v_a + n_anchors;
+    vector2f *restrict a1 = buf_v_a + 3 * n_anchors;
+    vector2f *restrict a2 = buf_v_a + 5 * n_anchors;
+    vector2f *restrict a3 = buf_v_a + 7 * n_anchors;
+    vector2f *restrict x_tmp = buf_v_a + 8 * n_anchors;
+    vector2f *restrict v_tmp = buf_v_a + 9 * n_anchors;
 
-            float orthogal_speed = (a->b->speed.y * a->direction_n.x) -
-                                   (a->b->speed.x * a->direction_n.y);
-            vector2f orthogal_velocity = {orthogal_speed * a->direction_n.y,
-                                        - orthogal_speed * a->direction_n.x};
+    worker_range(n_anchors, worker, n_workers, &lo, &hi);
 
-            new_speed.x += orthogal_velocity.x;
-            new_speed.y += orthogal_velocity.y;
+    for (iters_left = 1, iters_total = 1; iters_left; --iters_left) {
+        attached_masses(t, attached_mass, lo, hi);
 
-            vector2f speed_change = {new_speed.x - a->b->speed.x,
-                                     new_speed.y - a->b->speed.y};
+        trampoline_advance(t->speed, t->offsets, attached_mass, v0, a0,
+                           n_anchors, lo, hi, dx, k, dm, t->damping, gravity,
+                           mesh, t->density);
 
-            // can only push, not pull.
-            if (((a->direction_n.x > 0) && (speed_change.x > 0)) ||
-                ((a->direction_n.x < 0) && (speed_change.x < 0))) {
-                new_speed.x = a->b->speed.x;
-                if (((a->direction_n.x > 0) && (dx.x < 0)) ||
-                    ((a->direction_n.x < 0) && (dx.x > 0))) {
-                    dx.x = new_speed.x * dt;
-                }
+        real v_max = 0;
+        for (i=lo; i<hi; ++i) {
+            x_tmp[i].x = t->offsets[i].x + v0[i].x * dt/2;
+            x_tmp[i].y = t->offsets[i].y + v0[i].y * dt/2;
+            v_tmp[i].x = t->speed[i].x + a0[i].x * dt/2;
+            v_tmp[i].y = t->speed[i].y + a0[i].y * dt/2;
+            if (iters_total == 1) {
+                real v_y_abs = real_fabs(v_tmp[i].y);
+                if (v_y_abs > v_max) v_max = v_y_abs;
             }
-            if (((a->direction_n.y > 0) && (speed_change.y > 0)) ||
-                ((a->direction_n.y < 0) && (speed_change.y < 0))) {
-                new_speed.y = a->b->speed.y;
-                if (((a->direction_n.y > 0) && (dx.y < 0)) ||
-                    ((a->direction_n.y < 0) && (dx.y > 0))) {
-                    dx.y = new_speed.y * dt;
-                }
+        }
+
+        if (iters_total == 1) {
+            job->v_max[worker] = v_max;
+            worker_barrier(pool);
+            for (i=0; i<n_workers; ++i)
+                if (job->v_max[i] > v_max) v_max = job->v_max[i];
+
+            iters_total = rk4_substeps(v_max, dt, dt_ms, tau_ms);
+            if (iters_total > 1) {
+                iters_left = iters_total;
+                dt /= iters_total;
+                continue;
             }
+        }
+
+        worker_barrier(pool);
+        trampoline_advance(v_tmp, x_tmp, attached_mass, v1, a1, n_anchors,
+                           lo, hi, dx, k, dm, t->damping, gravity,
+                           mesh, t->density);
+        worker_barrier(pool);
+
+        rk4_stage_state(t, v1, a1, dt/2, x_tmp, v_tmp, lo, hi);
+        worker_barrier(pool);
+        trampoline_advance(v_tmp, x_tmp, attached_mass, v2, a2, n_anchors,
+                           lo, hi, dx, k, dm, t->damping, gravity,
+                           mesh, t->density);
+        worker_barrier(pool);
 
-            dx.x += orthogal_velocity.x * dt;
-            dx.y += orthogal_velocity.y * dt;
+        rk4_stage_state(t, v2, a2, dt, x_tmp, v_tmp, lo, hi);
+        worker_barrier(pool);
+        trampoline_advance(v_tmp, x_tmp, attached_mass, v3, a3, n_anchors,
+                           lo, hi, dx, k, dm, t->damping, gravity,
+                           mesh, t->density);
+
+        if (worker == 0) SDL_LockMutex(t->lock);
+        worker_barrier(pool);
+
+        memcpy(x_tmp + lo, t->offsets + lo, (hi - lo) * sizeof(vector2f));
+        rk4_combine(t, buf_v_a, n_anchors, dt, lo, hi);
+        worker_barrier(pool);
 
-            force_advance_ball(a->b, new_speed, dx);
+        if (worker == 0) {
+            SDL_UnlockMutex(t->lock);
+            move_attached_balls(t, x_tmp, dt, gravity);
+            job->iters_total = iters_total;
         }
+        // the balls need the old positions in x_tmp; the end of the
+        // run waits for them anyway
+        if (iters_left > 1) worker_barrier(pool);
+    }
+}
 
+int iterate_trampoline_parallel(trampoline *const t, const real dt_ms,
+                                const vector2f gravity, struct worker_pool *const pool)
+{
+    // the specialised kernels are for small trampolines, and have
+    // no scratch buffers for the workers to share
+    if (pool == NULL || worker_pool_size(pool) == 1 || t->scratch_v_a == NULL ||
+        t->n_anchors < TRAMPOLINE_PARALLEL_MIN_ANCHORS)
+        return iterate_trampoline(t, dt_ms, gravity);
+
+    if (t->mesh != NULL) remesh_trampoline(t);
+
+    struct parallel_rk4_job job;
+    job.t = t;
+    job.dt_ms = dt_ms;
+    job.gravity = gravity;
+    job.iters_total = 0;
+    run_on_workers(pool, trampoline_rk4_worker, &job);
+    return job.iters_total;
+}
+
+static trampoline_kernel select_trampoline_kernel(int n_anchors)
+{
+#define TRAMPOLINE_KERNEL_CASE(N) case N: return iterate_trampoline_##N;
+    switch (n_anchors) {
+        TRAMPOLINE_KERNEL_SIZES(TRAMPOLINE_KERNEL_CASE)
+        default: return iterate_trampoline_generic;
     }
+#undef TRAMPOLINE_KERNEL_CASE
+}
 
-    free(buf_v_a);
-    free(attached_mass);
+int iterate_trampoline(trampoline *const t, const real dt_ms,
+                       const vector2f gravity)
+{
+    return t->kernel(t, dt_ms, gravity);
 }
@@ -8,45 +8,129 @@
 #define TRAMPBALL_TRAMPOLINE_H
 #include "physics.h"
 #include "ball.h"
+#include "workers.h"
 
 #include <stdlib.h>
 #include <stdbool.h>
 #include <SDL.h>
 
 #define TRAMPOLINE_SPRING_CONSTANT 80000
-#define TRAMPOLINE_DAMPING 2.0f
-#define TRAMPOLINE_DENSITY 0.1f /* per pixel */
+#define TRAMPOLINE_DAMPING REAL(2.0)
+#define TRAMPOLINE_DENSITY REAL(0.1) /* per pixel */
+/* trampolines with this many anchors or more are split between the
+   workers of a pool, if there is one */
+#define TRAMPOLINE_PARALLEL_MIN_ANCHORS 16384
+/* attachments made up front, so that balls landing don't allocate */
+#define TRAMPOLINE_SPARE_ATTACHMENTS 4
+/* an adaptive trampoline splits each of its load-time segments into as
+   many as 2^levels around the balls on it */
+#define TRAMPOLINE_MAX_REFINE_LEVELS 6
+/* how far ahead (in seconds of the ball's speed) collisions look for
+   balls about to land on adaptive trampolines */
+#define TRAMPOLINE_REFINE_LOOKAHEAD REAL(0.05)
+/* a segment is only coarsened again once that would lose at most this
+   share of a load-time segment's rest spring energy */
+#define TRAMPOLINE_COARSEN_TOLERANCE REAL(1e-6)
 
 typedef struct _attachment {
     struct _attachment *next;
     ball *b;
     vector2f direction_n;
     int n_contacts;
+    int max_contacts;
+    bool embedded;  /* in the trampoline's own block, rather than malloc()ed */
     int contact_points[];
 } attachment;
 
+/*
+ * The anchors of an adaptive trampoline. Load-time segment s is split
+ * evenly into 2^level[s] segments: all the way under the balls attached
+ * to it, one level less for each segment further away, and none at all
+ * once the string there has calmed down. The anchors are spaced as they
+ * are drawn and collided with, from one end of the width to the other;
+ * each carries half of the segments either side of it, and a segment's
+ * spring constant goes up as it gets shorter, so the tension at rest is
+ * the same everywhere.
+ */
+struct trampoline_mesh {
+    int levels;
+    int n_segments;         /* load-time segments */
+    real segment_width;     /* of a load-time segment */
+    real finest;            /* the shortest segment now */
+    unsigned char *level;   /* per load-time segment */
+    unsigned char *target;  /* the levels asked for, and then being changed to */
+    real *rest_x;           /* per anchor: how far along it is, at rest */
+    real *length;           /* per anchor: how much of the width (and mass) it carries */
+    real *stiffness;        /* per segment, from anchor i to i+1: k times this */
+    /* swapped with the trampoline's when the anchors change */
+    vector2f *spare_offsets;
+    vector2f *spare_speed;
+    real *spare_rest_x;
+    real *spare_length;
+    real *spare_stiffness;
+    int *index_map;         /* old anchor to new, or -1 */
+    int *contact_scratch;
+};
+
+struct _trampoline;
+typedef int (*trampoline_kernel)(struct _trampoline *const t, const real dt_ms,
+                                 const vector2f gravity);
+
 typedef struct _trampoline {
     int x;
     int y;
     int width;
+    int height;     /* of the rest shape: the right end is this much higher */
     int n_anchors;
-    float k;
-    float damping;
-    float density;
+    int max_anchors;    /* n_anchors can change up to this, if there's a mesh */
+    real k;
+    real damping;
+    real density;
     SDL_mutex *lock;
     attachment *attached_objects;
+    attachment *spare_attachments; /* removed ones, for reuse */
     vector2f *offsets;
     vector2f *speed;
+    trampoline_kernel kernel; /* specialised for n_anchors, if possible */
+    /* RK4 work space for the generic kernel; NULL for the specialised
+       ones, which keep theirs on the stack */
+    vector2f *scratch_v_a;
+    real *scratch_mass;
+    int *contact_scratch;   /* max_anchors of them, for collide_ball_trampoline() */
+    struct trampoline_mesh *mesh; /* NULL while the anchors are evenly spaced */
 } trampoline;
 
 trampoline *new_trampoline(int anchors);
 void free_trampoline(trampoline *const t);
+/* for putting trampolines in memory of one's own: init_trampoline() needs
+   trampoline_size() bytes, and cleanup_trampoline() frees everything but
+   those */
+size_t trampoline_size(int anchors);
+trampoline *init_trampoline(void *const mem, int anchors);
+void cleanup_trampoline(trampoline *const t);
+void set_trampoline_height(trampoline *const t, int height);
+/* Make the anchors adaptive, with up to levels of refinement (0 keeps
+   the load-time anchors, but evenly spaced over the whole width). Set
+   the width and height first. Changes n_anchors as balls come and go,
+   and moves the attachments' contact points along with the anchors. */
+bool set_trampoline_refinement(trampoline *const t, int levels);
+/* ask an adaptive trampoline for its finest anchors from left to right
+   (in world x) in its next step: for a ball that's about to land */
+void refine_trampoline_under(trampoline *const t, real left, real right);
 
+/* reuses a spare attachment if there is one big enough */
 attachment *new_attachment(trampoline *const t, int max_contacts);
 bool remove_attachment(trampoline *const t, attachment *a);
 bool detach_ball(trampoline *const t, const ball *const b);
 attachment *find_ball_attached(trampoline *const t, const ball *const b);
 
-void iterate_trampoline(trampoline *const t, const float dt_ms);
+/* returns the number of RK4 substeps taken */
+int iterate_trampoline(trampoline *const t, const real dt_ms,
+                       const vector2f gravity);
+/* the same, with each worker of pool (which may be NULL) taking a block
+   of anchors, if the trampoline is big enough to be worth it. The result
+   is identical either way. */
+int iterate_trampoline_parallel(trampoline *const t, const real dt_ms,
+                                const vector2f gravity, struct worker_pool *const pool);
 
 #endif /* TRAMPBALL_TRAMPOLINE_H */
@@ -0,0 +1,162 @@
+#include <stdlib.h>
+#include <SDL.h>
+
+#include "workers.h"
+#include "alloc.h"
+
+struct worker_pool {
+    int n_workers;
+    SDL_Thread **threads;   /* n_workers - 1 of them */
+
+    SDL_mutex *lock;
+    SDL_cond *start;
+    int run;                /* incremented for each run_on_workers() */
+    bool quitting;
+    worker_fn fn;
+    void *arg;
+
+    SDL_atomic_t barrier_waiting;
+    SDL_atomic_t barrier_round;
+    SDL_cond *barrier_done;
+};
+
+struct worker_start {
+    struct worker_pool *pool;
+    int worker;
+};
+
+static int worker_main(void *data)
+{
+    struct worker_start *start = data;
+    struct worker_pool *pool = start->pool;
+    int worker = start->worker;
+    int last_run = 0;
+
+    TB_FREE(start);
+
+    for (;;) {
+        SDL_LockMutex(pool->lock);
+        while (pool->run == last_run && !pool->quitting)
+            SDL_CondWait(pool->start, pool->lock);
+        if (pool->quitting) {
+            SDL_UnlockMutex(pool->lock);
+            return 0;
+        }
+        last_run = pool->run;
+        SDL_UnlockMutex(pool->lock);
+
+        pool->fn(pool, worker, pool->n_workers, pool->arg);
+        worker_barrier(pool);
+    }
+}
+
+struct worker_pool *new_worker_pool(int n_workers)
+{
+    struct worker_pool *pool = TB_CALLOC(ALLOC_OTHER, 1, sizeof(struct worker_pool));
+    if (pool == NULL) return NULL;
+
+    pool->n_workers = n_workers < 1 ? 1 :
+                      n_workers > WORKER_POOL_MAX ? WORKER_POOL_MAX : n_workers;
+    pool->lock = SDL_CreateMutex();
+    pool->start = SDL_CreateCond();
+    pool->barrier_done = SDL_CreateCond();
+    pool->threads = TB_CALLOC(ALLOC_OTHER, pool->n_workers, sizeof(SDL_Thread *));
+    if (pool->lock == NULL || pool->start == NULL || pool->barrier_done == NULL ||
+        pool->threads == NULL) {
+        free_worker_pool(pool);
+        return NULL;
+    }
+
+    for (int i=1; i<pool->n_workers; ++i) {
+        struct worker_start *start = TB_MALLOC(ALLOC_OTHER, sizeof(struct worker_start));
+        start->pool = pool;
+        start->worker = i;
+        if ((pool->threads[i-1] = SDL_CreateThread(worker_main, "worker", start)) == NULL) {
+            TB_FREE(start);
+            pool->n_workers = i;
+            free_worker_pool(pool);
+            return NULL;
+        }
+    }
+
+    return pool;
+}
+
+void free_worker_pool(struct worker_pool *const pool)
+{
+    if (pool->lock != NULL) {
+        SDL_LockMutex(pool->lock);
+        pool->quitting = true;
+        SDL_CondBroadcast(pool->start);
+        SDL_UnlockMutex(pool->lock);
+    }
+    if (pool->threads != NULL) {
+        for (int i=1; i<pool->n_workers; ++i)
+            SDL_WaitThread(pool->threads[i-1], NULL);
+    }
+
+    TB_FREE(pool->threads);
+    if (pool->barrier_done != NULL) SDL_DestroyCond(pool->barrier_done);
+    if (pool->start != NULL) SDL_DestroyCond(pool->start);
+    if (pool->lock != NULL) SDL_DestroyMutex(pool->lock);
+    TB_FREE(pool);
+}
+
+int worker_pool_size(const struct worker_pool *const pool)
+{
+    return pool->n_workers;
+}
+
+void run_on_workers(struct worker_pool *const pool, worker_fn fn, void *arg)
+{
+    if (pool->n_workers == 1) {
+        fn(pool, 0, 1, arg);
+        return;
+    }
+
+    SDL_LockMutex(pool->lock);
+    pool->fn = fn;
+    pool->arg = arg;
+    pool->run++;
+    SDL_CondBroadcast(pool->start);
+    SDL_UnlockMutex(pool->lock);
+
+    fn(pool, 0, pool->n_workers, arg);
+    worker_barrier(pool);
+}
+
+/*
+ * Spin for a while, since the others are usually about to arrive; if they
+ * aren't, sleep. The last to arrive releases the rest with the mutex held,
+ * so that no sleeper can miss it.
+ */
+void worker_barrier(struct worker_pool *const pool)
+{
+    if (pool->n_workers == 1) return;
+
+    int round = SDL_AtomicGet(&pool->barrier_round);
+
+    if (SDL_AtomicAdd(&pool->barrier_waiting, 1) == pool->n_workers - 1) {
+        SDL_AtomicSet(&pool->barrier_waiting, 0);
+        SDL_LockMutex(pool->lock);
+        SDL_AtomicAdd(&pool->barrier_round, 1);
+        SDL_CondBroadcast(pool->barrier_done);
+        SDL_UnlockMutex(pool->lock);
+        return;
+    }
+
+    for (int i=0; i<WORKER_BARRIER_SPINS; ++i) {
+        if (SDL_AtomicGet(&pool->barrier_round) != round) return;
+    }
+
+    SDL_LockMutex(pool->lock);
+    while (SDL_AtomicGet(&pool->barrier_round) == round)
+        SDL_CondWait(pool->barrier_done, pool->lock);
+    SDL_UnlockMutex(pool->lock);
+}
+
+void worker_range(int n, int worker, int n_workers, int *const lo, int *const hi)
+{
+    *lo = (int) ((long long) n * worker / n_workers);
+    *hi = (int) ((long long) n * (worker + 1) / n_workers);
+}
@@ -0,0 +1,40 @@
+/*
+    workers.h
+
+    a fixed pool of threads that run one function together, in lock-step
+
+    The thread calling run_on_workers() takes part as worker 0, so a pool
+    of one worker starts no threads at all. Inside the function, the
+    workers can wait for each other with worker_barrier().
+*/
+
+#ifndef TRAMPBALL_WORKERS_H
+#define TRAMPBALL_WORKERS_H
+
+#include <stdbool.h>
+
+/* pools are clamped to this many workers */
+#define WORKER_POOL_MAX 64
+/* how often a worker checks the barrier before going to sleep on it */
+#define WORKER_BARRIER_SPINS 4000
+
+struct worker_pool;
+
+typedef void (*worker_fn)(struct worker_pool *const pool, int worker, int n_workers,
+                          void *arg);
+
+/* n_workers counts the calling thread; NULL on failure */
+struct worker_pool *new_worker_pool(int n_workers);
+void free_worker_pool(struct worker_pool *const pool);
+int worker_pool_size(const struct worker_pool *const pool);
+
+/* runs fn on every worker, and returns when they've all finished. Not
+   reentrant: one run per pool at a time. */
+void run_on_workers(struct worker_pool *const pool, worker_fn fn, void *arg);
+/* returns once every worker has called it */
+void worker_barrier(struct worker_pool *const pool);
+
+/* worker's share of [0, n): [*lo, *hi) */
+void worker_range(int n, int worker, int n_workers, int *const lo, int *const hi);
+
+#endif /* TRAMPBALL_WORKERS_H */
@@ -0,0 +1,253 @@
+#include <string.h>
+#include <SDL.h>
+
+#include "worldbin.h"
+#include "arena.h"
+
+#define HEADER_BYTES 40     /* after the magic */
+#define TRAMPOLINE_RECORD_BYTES 32
+#define BALL_RECORD_BYTES 20
+#define WALL_RECORD_BYTES 24
+#define RECORDS_PER_BLOCK 256
+/* anything more would be a corrupt file, not a big trampoline */
+#define MAX_BINARY_ANCHORS (1 << 24)
+
+typedef union {
+    uint32_t u;
+    int32_t i;
+    float f;
+} word32;
+
+static void put_le32(uint8_t *const p, uint32_t x)
+{
+    p[0] = x;
+    p[1] = x >> 8;
+    p[2] = x >> 16;
+    p[3] = x >> 24;
+}
+
+static word32 get_le32(const uint8_t *const p)
+{
+    word32 w;
+    w.u = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+    return w;
+}
+
+static void put_float(uint8_t *const p, float f)
+{
+    word32 w;
+    w.f = f;
+    put_le32(p, w.u);
+}
+
+static bool read_fully(SDL_RWops *const fp, void *const buf, size_t len)
+{
+    for (size_t got = 0, n; got < len; got += n) {
+        if ((n = SDL_RWread(fp, (uint8_t *) buf + got, 1, len - got)) == 0)
+            return false;
+    }
+    return true;
+}
+
+bool is_binary_world(const void *const magic)
+{
+    return memcmp(magic, WORLD_BINARY_MAGIC, WORLD_BINARY_MAGIC_LEN) == 0;
+}
+
+static bool load_trampolines(struct world *const world, SDL_RWops *const fp, uint32_t n)
+{
+    uint8_t buf[RECORDS_PER_BLOCK * TRAMPOLINE_RECORD_BYTES];
+
+    while (n > 0) {
+        uint32_t block = n < RECORDS_PER_BLOCK ? n : RECORDS_PER_BLOCK;
+        if (!read_fully(fp, buf, block * TRAMPOLINE_RECORD_BYTES)) return false;
+
+        for (uint32_t i=0; i<block; ++i) {
+            const uint8_t *r = buf + i * TRAMPOLINE_RECORD_BYTES;
+            int32_t anchors = get_le32(r).i;
+            if (anchors < 2 || anchors > MAX_BINARY_ANCHORS || get_le32(r + 12).i <= 0) {
+                SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                             "binary world: bad trampoline (%d anchors)\n", anchors);
+                return false;
+            }
+
+            void *mem = arena_alloc(&world->arenas[WORLD_ARENA_TRAMPOLINES],
+                                    trampoline_size(anchors));
+            if (mem == NULL) return false;
+            trampoline *t = init_trampoline(mem, anchors);
+            t->x = get_le32(r + 4).i;
+            t->y = get_le32(r + 8).i;
+            t->width = get_le32(r + 12).i;
+            if (get_le32(r + 16).i != 0)
+                set_trampoline_height(t, get_le32(r + 16).i);
+            t->k = get_le32(r + 20).f;
+            t->density = get_le32(r + 24).f;
+            t->damping = get_le32(r + 28).f;
+            add_trampoline(world, t);
+        }
+        n -= block;
+    }
+    return true;
+}
+
+static bool load_balls(struct world *const world, SDL_RWops *const fp, uint32_t n)
+{
+    uint8_t buf[RECORDS_PER_BLOCK * BALL_RECORD_BYTES];
+
+    while (n > 0) {
+        uint32_t block = n < RECORDS_PER_BLOCK ? n : RECORDS_PER_BLOCK;
+        if (!read_fully(fp, buf, block * BALL_RECORD_BYTES)) return false;
+
+        for (uint32_t i=0; i<block; ++i) {
+            const uint8_t *r = buf + i * BALL_RECORD_BYTES;
+            void *mem = arena_alloc(&world->arenas[WORLD_ARENA_BALLS], sizeof(ball));
+            if (mem == NULL) return false;
+            ball *b = init_ball(mem);
+            b->position = (vector2f) { get_le32(r).f, get_le32(r + 4).f };
+            b->radius = get_le32(r + 8).f;
+            b->mass = get_le32(r + 12).f;
+            b->bounce = get_le32(r + 16).f;
+            add_ball(world, b);
+        }
+        n -= block;
+    }
+    return true;
+}
+
+static bool load_walls(struct world *const world, SDL_RWops *const fp, uint32_t n)
+{
+    uint8_t buf[RECORDS_PER_BLOCK * WALL_RECORD_BYTES];
+
+    while (n > 0) {
+        uint32_t block = n < RECORDS_PER_BLOCK ? n : RECORDS_PER_BLOCK;
+        if (!read_fully(fp, buf, block * WALL_RECORD_BYTES)) return false;
+
+        for (uint32_t i=0; i<block; ++i) {
+            const uint8_t *r = buf + i * WALL_RECORD_BYTES;
+            wall *w = arena_alloc(&world->arenas[WORLD_ARENA_WALLS], sizeof(wall));
+            if (w == NULL) return false;
+            w->position = (vector2i) { get_le32(r).i, get_le32(r + 4).i };
+            w->side1 = (vector2i) { get_le32(r + 8).i, get_le32(r + 12).i };
+            w->side2 = (vector2i) { get_le32(r + 16).i, get_le32(r + 20).i };
+            add_wall(world, w);
+        }
+        n -= block;
+    }
+    return true;
+}
+
+bool load_binary_world(struct world *const world, SDL_RWops *const fp)
+{
+    uint8_t h[HEADER_BYTES];
+
+    if (!read_fully(fp, h, HEADER_BYTES)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "binary world: truncated header\n");
+        return false;
+    }
+    if (get_le32(h).u != WORLD_BINARY_VERSION) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "binary world: version %u, not %d\n",
+                     get_le32(h).u, WORLD_BINARY_VERSION);
+        return false;
+    }
+
+    world->game_stage.top = get_le32(h + 16).i;
+    world->game_stage.left = get_le32(h + 20).i;
+    world->game_stage.bottom = get_le32(h + 24).i;
+    world->game_stage.right = get_le32(h + 28).i;
+    world->gravity = (vector2f) { get_le32(h + 32).f, get_le32(h + 36).f };
+
+    if (!load_trampolines(world, fp, get_le32(h + 4).u) ||
+        !load_balls(world, fp, get_le32(h + 8).u) ||
+        !load_walls(world, fp, get_le32(h + 12).u)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "binary world: truncated or corrupt\n");
+        return false;
+    }
+    return true;
+}
+
+bool write_binary_world_header(FILE *const fp, const struct world_spec *const spec)
+{
+    uint8_t h[WORLD_BINARY_MAGIC_LEN + HEADER_BYTES] = { 0 };
+    uint8_t *p = h + WORLD_BINARY_MAGIC_LEN;
+
+    memcpy(h, WORLD_BINARY_MAGIC, sizeof(WORLD_BINARY_MAGIC));
+    put_le32(p, WORLD_BINARY_VERSION);
+    put_le32(p + 4, spec->n_trampolines);
+    put_le32(p + 8, spec->n_balls);
+    put_le32(p + 12, spec->n_walls);
+    put_le32(p + 16, spec->top);
+    put_le32(p + 20, spec->left);
+    put_le32(p + 24, spec->bottom);
+    put_le32(p + 28, spec->right);
+    put_float(p + 32, spec->gravity_x);
+    put_float(p + 36, spec->gravity_y);
+    return fwrite(h, 1, sizeof(h), fp) == sizeof(h);
+}
+
+bool write_binary_trampolines(FILE *const fp, const struct world_spec_trampoline *const t,
+                              size_t n)
+{
+    uint8_t buf[RECORDS_PER_BLOCK * TRAMPOLINE_RECORD_BYTES];
+
+    for (size_t done = 0; done < n; ) {
+        size_t block = n - done < RECORDS_PER_BLOCK ? n - done : RECORDS_PER_BLOCK;
+        for (size_t i=0; i<block; ++i) {
+            const struct world_spec_trampoline *s = &t[done + i];
+            uint8_t *r = buf + i * TRAMPOLINE_RECORD_BYTES;
+            put_le32(r, s->anchors);
+            put_le32(r + 4, s->x);
+            put_le32(r + 8, s->y);
+            put_le32(r + 12, s->width);
+            put_le32(r + 16, s->height);
+            put_float(r + 20, s->k);
+            put_float(r + 24, s->density);
+            put_float(r + 28, s->damping);
+        }
+        if (fwrite(buf, TRAMPOLINE_RECORD_BYTES, block, fp) != block) return false;
+        done += block;
+    }
+    return true;
+}
+
+bool write_binary_balls(FILE *const fp, const struct world_spec_ball *const b, size_t n)
+{
+    uint8_t buf[RECORDS_PER_BLOCK * BALL_RECORD_BYTES];
+
+    for (size_t done = 0; done < n; ) {
+        size_t block = n - done < RECORDS_PER_BLOCK ? n - done : RECORDS_PER_BLOCK;
+        for (size_t i=0; i<block; ++i) {
+            const struct world_spec_ball *s = &b[done + i];
+            uint8_t *r = buf + i * BALL_RECORD_BYTES;
+            put_float(r, s->x);
+            put_float(r + 4, s->y);
+            put_float(r + 8, s->radius);
+            put_float(r + 12, s->mass);
+            put_float(r + 16, s->bounce);
+        }
+        if (fwrite(buf, BALL_RECORD_BYTES, block, fp) != block) return false;
+        done += block;
+    }
+    return true;
+}
+
+bool write_binary_walls(FILE *const fp, const struct world_spec_wall *const w, size_t n)
+{
+    uint8_t buf[RECORDS_PER_BLOCK * WALL_RECORD_BYTES];
+
+    for (size_t done = 0; done < n; ) {
+        size_t block = n - done < RECORDS_PER_BLOCK ? n - done : RECORDS_PER_BLOCK;
+        for (size_t i=0; i<block; ++i) {
+            const struct world_spec_wall *s = &w[done + i];
+            uint8_t *r = buf + i * WALL_RECORD_BYTES;
+            put_le32(r, s->x);
+            put_le32(r + 4, s->y);
+            put_le32(r + 8, s->dx1);
+            put_le32(r + 12, s->dy1);
+            put_le32(r + 16, s->dx2);
+            put_le32(r + 20, s->dy2);
+        }
+        if (fwrite(buf, WALL_RECORD_BYTES, block, fp) != block) return false;
+        done += block;
+    }
+    return true;
+}
@@ -0,0 +1,71 @@
+/*
+    worldbin.h
+
+    binary world files: the same contents as a text world file, as
+    fixed-size records that load without any parsing
+
+    All little-endian:
+
+        "TBWORLD\0"                                         8 bytes
+        version n_trampolines n_balls n_walls               uint32
+        stage top left bottom right                         int32
+        gravity x y                                         float32
+        n_trampolines x
+            anchors x y width height                        int32
+            k density damping                               float32
+        n_balls x
+            x y radius mass bounce                          float32
+        n_walls x
+            x y dx1 dy1 dx2 dy2                             int32
+
+    init_game() and init_game_sdlrw() tell binary worlds from text ones
+    by the magic, so they go wherever a world file does.
+*/
+
+#ifndef TRAMPBALL_WORLDBIN_H
+#define TRAMPBALL_WORLDBIN_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <SDL.h>
+
+#include "game.h"
+
+#define WORLD_BINARY_MAGIC "TBWORLD"
+#define WORLD_BINARY_MAGIC_LEN 8
+#define WORLD_BINARY_VERSION 1
+
+struct world_spec {
+    uint32_t n_trampolines, n_balls, n_walls;
+    int32_t top, left, bottom, right;
+    float gravity_x, gravity_y;
+};
+
+struct world_spec_trampoline {
+    int32_t anchors, x, y, width, height;
+    float k, density, damping;
+};
+
+struct world_spec_ball {
+    float x, y, radius, mass, bounce;
+};
+
+struct world_spec_wall {
+    int32_t x, y, dx1, dy1, dx2, dy2;
+};
+
+/* the first WORLD_BINARY_MAGIC_LEN bytes of a file */
+bool is_binary_world(const void *const magic);
+/* loads the rest of a binary world: fp must be just past the magic */
+bool load_binary_world(struct world *const world, SDL_RWops *const fp);
+
+/* the header, then the trampolines, balls and walls, in that order and
+   as many as the header says */
+bool write_binary_world_header(FILE *const fp, const struct world_spec *const spec);
+bool write_binary_trampolines(FILE *const fp, const struct world_spec_trampoline *const t,
+                              size_t n);
+bool write_binary_balls(FILE *const fp, const struct world_spec_ball *const b, size_t n);
+bool write_binary_walls(FILE *const fp, const struct world_spec_wall *const w, size_t n);
+
+#endif /* TRAMPBALL_WORLDBIN_H */
@@ -0,0 +1,316 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdint.h>
+
+#include "worldbin.h"
+#include "ball.h"
+#include "trampoline.h"
+#include "args.h"
+#include "tool.h"
+
+#define DEFAULT_CELL_SIZE 320
+#define DEFAULT_BALLS 60
+#define DEFAULT_TRAMPOLINES 10
+#define GEN_GRAVITY -700
+/* share of the grid cells that balls and trampolines take up, when the
+   stage size is worked out from them */
+#define GEN_FILL 0.35
+/* walls per cell, by default: with GEN_FILL, the stage ends up half full */
+#define GEN_WALLS_PER_CELL 0.15
+/* -entities N: how N is split up (the rest are walls) */
+#define GEN_BALL_SHARE 0.6
+#define GEN_TRAMPOLINE_SHARE 0.1
+
+struct gen_params {
+    unsigned seed;
+    long n_balls, n_trampolines;
+    double wall_density;        /* per million square pixels */
+    double radius_min, radius_max;
+    bool log_radius;            /* log-uniform radii: lots of small balls, few big ones */
+    double anchor_density;      /* per 10 pixels of trampoline width */
+    int cell;
+    long stage_width, stage_height;     /* 0: big enough for everything */
+};
+
+struct generated_world {
+    struct world_spec spec;
+    struct world_spec_trampoline *trampolines;
+    struct world_spec_ball *balls;
+    struct world_spec_wall *walls;
+    long anchors;
+};
+
+/* to a quarter of a pixel, so that text and binary worlds load the same */
+static float quantize(double x)
+{
+    return floor(x * 4 + 0.5) / 4;
+}
+
+/*
+ * The stage is divided into square cells, and each object gets a cell
+ * of its own, picked at random: nothing overlaps to begin with, however
+ * many objects there are.
+ */
+static bool generate(const struct gen_params *const p, struct generated_world *const g)
+{
+    const int s = p->cell;
+    unsigned state = p->seed * 2654435761u + 1;
+    long cols, rows, n_walls;
+
+    if (p->stage_width > 0) {
+        cols = p->stage_width / s;
+        rows = p->stage_height / s;
+    } else {
+        double cells = ceil((p->n_balls + p->n_trampolines) / GEN_FILL);
+        cols = (long) ceil(sqrt(cells * 4 / 3));
+        rows = (long) ceil(cells / cols);
+    }
+    if (cols < 1) cols = 1;
+    if (rows < 1) rows = 1;
+    n_walls = (long) (p->wall_density * cols * s * rows * s / 1e6 + 0.5);
+
+    long n_objects = p->n_balls + p->n_trampolines + n_walls;
+    if (cols * rows < n_objects || (double) cols * s > INT32_MAX ||
+        (double) rows * s > INT32_MAX) {
+        fprintf(stderr, "%ld objects don't fit on a %ldx%ld stage of %d pixel cells\n",
+                n_objects, cols * s, rows * s, s);
+        return false;
+    }
+
+    g->spec = (struct world_spec) {
+        p->n_trampolines, p->n_balls, n_walls,
+        rows * s, 0, 0, cols * s,
+        0, GEN_GRAVITY
+    };
+    g->trampolines = malloc(p->n_trampolines * sizeof(struct world_spec_trampoline) + 1);
+    g->balls = malloc(p->n_balls * sizeof(struct world_spec_ball) + 1);
+    g->walls = malloc(n_walls * sizeof(struct world_spec_wall) + 1);
+    g->anchors = 0;
+
+    // the first n_objects of a shuffle of all the cells
+    uint32_t *cells = malloc(cols * rows * sizeof(uint32_t));
+    if (g->trampolines == NULL || g->balls == NULL || g->walls == NULL || cells == NULL) {
+        fprintf(stderr, "out of memory\n");
+        free(cells);
+        return false;
+    }
+    for (long i=0; i<cols * rows; ++i) cells[i] = i;
+    for (long i=0; i<n_objects; ++i) {
+        long j = i + xorshift32(&state) % (unsigned) (cols * rows - i);
+        uint32_t c = cells[i];
+        cells[i] = cells[j];
+        cells[j] = c;
+    }
+
+    long next = 0;
+    for (long i=0; i<p->n_trampolines; ++i, ++next) {
+        int x0 = cells[next] % cols * s, y0 = cells[next] / cols * s;
+        int width = random_int(&state, s / 2, s * 9 / 10);
+        int anchors = (int) (width * p->anchor_density / 10 + 0.5);
+        if (anchors < 3) anchors = 3;
+        g->trampolines[i] = (struct world_spec_trampoline) {
+            anchors,
+            x0 + random_int(&state, 0, s - width),
+            y0 + random_int(&state, s / 8, s / 3),
+            width,
+            random_int(&state, -s / 8, s / 8),
+            random_int(&state, 40000, 120000),
+            TRAMPOLINE_DENSITY, TRAMPOLINE_DAMPING
+        };
+        g->anchors += anchors;
+    }
+
+    for (long i=0; i<p->n_balls; ++i, ++next) {
+        int x0 = cells[next] % cols * s, y0 = cells[next] / cols * s;
+        double u = random_unit(&state);
+        double r = p->log_radius ? p->radius_min * pow(p->radius_max / p->radius_min, u)
+                                 : p->radius_min + (p->radius_max - p->radius_min) * u;
+        int margin = (int) ceil(r);
+        g->balls[i] = (struct world_spec_ball) {
+            x0 + random_int(&state, margin, s - margin),
+            y0 + random_int(&state, margin, s - margin),
+            quantize(r),
+            quantize(BALL_MASS * (r / BALL_RADIUS) * (r / BALL_RADIUS)),
+            BALL_BOUNCE
+        };
+    }
+
+    for (long i=0; i<n_walls; ++i, ++next) {
+        int x0 = cells[next] % cols * s, y0 = cells[next] / cols * s;
+        g->walls[i] = (struct world_spec_wall) {
+            x0 + random_int(&state, s / 4, s / 2),
+            y0 + random_int(&state, s / 3, s * 2 / 3),
+            random_int(&state, s / 16, s / 3), random_int(&state, -s / 6, s / 6),
+            random_int(&state, -s / 12, s / 12), random_int(&state, -s / 6, -4)
+        };
+    }
+
+    free(cells);
+    return true;
+}
+
+static bool write_text_world(FILE *const fp, const struct generated_world *const g)
+{
+    const struct world_spec *spec = &g->spec;
+
+    fprintf(fp, "# generated by trampball-tool gen\n");
+    fprintf(fp, "STAGE %d %d %d %d\n", spec->top, spec->left, spec->bottom, spec->right);
+    fprintf(fp, "GRAVITY %g %g\n", spec->gravity_x, spec->gravity_y);
+    for (uint32_t i=0; i<spec->n_trampolines; ++i) {
+        const struct world_spec_trampoline *t = &g->trampolines[i];
+        fprintf(fp, "TRAMPOLINE %d %d %d %d %d\n    K %.0f\n", t->anchors, t->x, t->y,
+                t->width, t->height, t->k);
+    }
+    for (uint32_t i=0; i<spec->n_balls; ++i) {
+        const struct world_spec_ball *b = &g->balls[i];
+        fprintf(fp, "BALL %.2f %.2f\n    RADIUS %.2f\n    MASS %.2f\n", b->x, b->y, b->radius, b->mass);
+    }
+    for (uint32_t i=0; i<spec->n_walls; ++i) {
+        const struct world_spec_wall *w = &g->walls[i];
+        fprintf(fp, "WALL %d %d %d %d %d %d\n", w->x, w->y, w->dx1, w->dy1, w->dx2, w->dy2);
+    }
+    return !ferror(fp);
+}
+
+static bool write_binary(FILE *const fp, const struct generated_world *const g)
+{
+    return write_binary_world_header(fp, &g->spec) &&
+           write_binary_trampolines(fp, g->trampolines, g->spec.n_trampolines) &&
+           write_binary_balls(fp, g->balls, g->spec.n_balls) &&
+           write_binary_walls(fp, g->walls, g->spec.n_walls);
+}
+
+static bool parse_long(const char *const s, long min, long *const v)
+{
+    char *endp;
+    *v = strtol(s, &endp, 10);
+    if (*s == '\0' || *endp != '\0' || *v < min) {
+        fprintf(stderr, "not an integer of at least %ld: %s\n", min, s);
+        return false;
+    }
+    return true;
+}
+
+static bool parse_double(const char *const s, double min, double *const v)
+{
+    char *endp;
+    *v = strtod(s, &endp);
+    if (*s == '\0' || *endp != '\0' || !(*v >= min)) {
+        fprintf(stderr, "not a number of at least %g: %s\n", min, s);
+        return false;
+    }
+    return true;
+}
+
+int gen_main(int argc, char *argv[])
+{
+    char *flags[] = { "help", "binary", "logradius", NULL };
+    char *opts[] = { "seed", "entities", "balls", "trampolines", "walldensity", "radius",
+                     "anchors", "stage", "cell", "output", NULL };
+    bool flag_states[3];
+    char *opt_vals[10];
+    struct gen_params p = {
+        1, DEFAULT_BALLS, DEFAULT_TRAMPOLINES, -1, 8, 32, false, 1, DEFAULT_CELL_SIZE, 0, 0
+    };
+    struct generated_world g = { { 0 }, NULL, NULL, NULL, 0 };
+    long l;
+    char *endp;
+
+    int n_args = parse_args(argc, argv, flags, opts, 0, flag_states, opt_vals, NULL);
+
+    if (n_args != 0 || flag_states[0]) {
+        fprintf(stderr, "trampball-tool gen - random worlds for stress testing\n"
+                        "\n"
+                        "  Usage: trampball-tool gen [-seed 1] [-entities N] [-balls 60]\n"
+                        "         [-trampolines 10] [-walldensity D] [-radius 8:32] [-logradius]\n"
+                        "         [-anchors 1] [-stage WIDTHxHEIGHT] [-cell 320]\n"
+                        "         [-output world.txt|world.tbw] [-binary]\n"
+                        "\n"
+                        "  The same seed and options always make the same world. Every object\n"
+                        "  gets a square cell of the stage to itself, so nothing overlaps.\n"
+                        "  -entities N makes N objects in all: 60%% balls, 10%% trampolines\n"
+                        "  and, with the default wall density, 30%% walls. -walldensity is in\n"
+                        "  walls per million square pixels. Ball radii are spread evenly over\n"
+                        "  -radius, or log-evenly with -logradius; -anchors is per 10 pixels\n"
+                        "  of trampoline width. Without -stage, the stage is as big as it\n"
+                        "  needs to be.\n"
+                        "\n"
+                        "  The world is written as text, or in the binary format with -binary\n"
+                        "  or an output file name ending in .tbw; both load anywhere a world\n"
+                        "  file is accepted. Without -output, it goes to stdout.\n");
+        return flag_states[0] ? 0 : 2;
+    }
+
+    if (opt_vals[0] != NULL) {
+        if (!parse_long(opt_vals[0], 0, &l)) return 2;
+        p.seed = l;
+    }
+    if (opt_vals[1] != NULL) {
+        if (!parse_long(opt_vals[1], 1, &l)) return 2;
+        p.n_balls = (long) (l * GEN_BALL_SHARE + 0.5);
+        p.n_trampolines = (long) (l * GEN_TRAMPOLINE_SHARE + 0.5);
+    }
+    if (opt_vals[2] != NULL && !parse_long(opt_vals[2], 0, &p.n_balls)) return 2;
+    if (opt_vals[3] != NULL && !parse_long(opt_vals[3], 0, &p.n_trampolines)) return 2;
+    if (opt_vals[4] != NULL && !parse_double(opt_vals[4], 0, &p.wall_density)) return 2;
+    if (opt_vals[5] != NULL) {
+        p.radius_min = strtod(opt_vals[5], &endp);
+        p.radius_max = (*endp == ':') ? strtod(endp + 1, &endp) : p.radius_min;
+        if (*opt_vals[5] == '\0' || *endp != '\0' || !(p.radius_min > 0) ||
+            p.radius_max < p.radius_min) {
+            fprintf(stderr, "not a radius range: %s\n", opt_vals[5]);
+            return 2;
+        }
+    }
+    if (opt_vals[6] != NULL && !parse_double(opt_vals[6], 0, &p.anchor_density)) return 2;
+    if (opt_vals[7] != NULL) {
+        p.stage_width = strtol(opt_vals[7], &endp, 10);
+        if (*endp == 'x') p.stage_height = strtol(endp + 1, &endp, 10);
+        if (*endp != '\0' || p.stage_width < 1 || p.stage_height < 1) {
+            fprintf(stderr, "not a stage size: %s\n", opt_vals[7]);
+            return 2;
+        }
+    }
+    if (opt_vals[8] != NULL) {
+        if (!parse_long(opt_vals[8], 16, &l)) return 2;
+        p.cell = l;
+    }
+    if (p.wall_density < 0)
+        p.wall_density = GEN_WALLS_PER_CELL * 1e6 / ((double) p.cell * p.cell);
+    if (p.radius_max > p.cell / 4.0) {
+        fprintf(stderr, "balls of radius %g don't fit in %d pixel cells\n", p.radius_max, p.cell);
+        return 2;
+    }
+
+    const char *out_fn = opt_vals[9];
+    size_t len = out_fn ? strlen(out_fn) : 0;
+    bool binary = flag_states[1] || (len > 4 && strcmp(out_fn + len - 4, ".tbw") == 0);
+    p.log_radius = flag_states[2];
+
+    int status = 0;
+    FILE *fp = stdout;
+    if (!generate(&p, &g)) {
+        status = 1;
+    } else if (out_fn != NULL && (fp = fopen(out_fn, binary ? "wb" : "w")) == NULL) {
+        perror(out_fn);
+        status = 1;
+    } else {
+        bool ok = binary ? write_binary(fp, &g) : write_text_world(fp, &g);
+        if (fp != stdout && fclose(fp) != 0) ok = false;
+        if (!ok) {
+            perror(out_fn ? out_fn : "stdout");
+            status = 1;
+        } else {
+            fprintf(stderr, "%u balls, %u trampolines (%ld anchors), %u walls on a %dx%d stage\n",
+                    g.spec.n_balls, g.spec.n_trampolines, g.anchors, g.spec.n_walls,
+                    g.spec.right, g.spec.top);
+        }
+    }
+
+    free(g.trampolines);
+    free(g.balls);
+    free(g.walls);
+    return status;
+}